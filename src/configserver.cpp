@@ -1,5 +1,6 @@
 #include "configserver.h"
 #include "webpages.h"
+#include "esp_timer.h"
 
 String ConfigServer::encrypt_cookie(String data) {
   // Pad data to multiple of 16 bytes (AES block size)
@@ -59,7 +60,7 @@ String ConfigServer::decrypt_cookie(String data) {
   int ret = mbedtls_base64_decode(decoded, sizeof(decoded), &decodedLen,
                                     (const unsigned char*)data.c_str(), data.length());
   if (ret != 0 || decodedLen < 16) {
-    Serial.println("Did not have enough data for an IV, invalid cookie.");
+    LOG_WARN("Did not have enough data for an IV, invalid cookie.");
     return ""; // Need at least 16 bytes for IV
   }
 
@@ -107,6 +108,164 @@ String ConfigServer::create_auth_cookie(String username) {
   return encrypt_cookie(cookieData);
 }
 
+String ConfigServer::line_status(int line) {
+  SIPClient &client = runtime.sip_line(line);
+  if (client.is_registered() && client.is_ringing()) {
+    return "ringing";
+  } else if (client.is_registered()) {
+    return "registered";
+  } else if (client.is_configured()) {
+    return "configured";
+  }
+  return "notconfigured";
+}
+
+static String json_string(const String &value) {
+  String escaped = "\"";
+  for (size_t i = 0; i < value.length(); i++) {
+    char c = value[i];
+    if (c == '"' || c == '\\' || c == '/') {
+      escaped += '\\';
+      escaped += c;
+    } else if ((uint8_t)c < 0x20) {
+      char code[7];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      escaped += code;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped + "\"";
+}
+
+// Lines past the two in the page markup, the dashboard clones Line 2 for each
+String ConfigServer::line_data() {
+  String data = "[";
+  for (int i = 2; i < SIP_MAX_LINES; i++) {
+    SIPClient &client = runtime.sip_line(i);
+    if (i > 2) data += ",";
+    data += "{\"line\":" + String(i + 1);
+    data += ",\"status\":" + json_string(line_status(i));
+    data += ",\"server\":" + json_string(client.sipServer);
+    data += ",\"port\":" + String(client.sipPort);
+    data += ",\"transport\":" + String(client.sipTransport);
+    data += ",\"verify\":" + String(client.sipVerify ? 1 : 0);
+    data += ",\"mode\":" + String(client.sipMode);
+    data += ",\"monitor\":" + json_string(client.sipMonitor);
+    data += ",\"username\":" + json_string(client.sipUsername);
+    data += ",\"password\":" + json_string(client.sipPassword);
+    data += ",\"ring\":" + String(runtime.lineRingPattern[i]);
+    data += ",\"error\":" + String(runtime.lineErrorPattern[i]) + "}";
+  }
+  return data + "]";
+}
+
+// Share of the time since boot spent in light sleep
+String ConfigServer::power_status() {
+  if (!runtime.power.isLightSleep()) {
+    return "Always on";
+  }
+  int64_t uptime = esp_timer_get_time();
+  uint64_t slept = runtime.power.getSleptMicros();
+  int percent = uptime > 0 ? (int)(slept * 100 / uptime) : 0;
+  return "Light sleep " + String(percent) + "% of the time, " + String(runtime.power.getSleepCount()) + " wakeups";
+}
+
+// Prometheus text format. Line state comes from the masks the loop keeps and counters are atomics,
+// so a scrape never waits on a line lock held by the SIP task.
+String ConfigServer::metrics_text() {
+  String out;
+  out.reserve(4096);
+  char labels[48];
+
+  Metrics::write_header(out, "line_configured", "Line has server and credentials", "gauge");
+  for (int i = 0; i < SIP_MAX_LINES; i++) {
+    snprintf(labels, sizeof(labels), "line=\"%d\"", i + 1);
+    Metrics::write_value(out, "line_configured", labels, (runtime.configuredLines >> i) & 1);
+  }
+  Metrics::write_header(out, "line_registered", "Line is registered, or subscribed for monitor lines", "gauge");
+  for (int i = 0; i < SIP_MAX_LINES; i++) {
+    snprintf(labels, sizeof(labels), "line=\"%d\"", i + 1);
+    Metrics::write_value(out, "line_registered", labels, (runtime.registeredLines >> i) & 1);
+  }
+  Metrics::write_header(out, "line_ringing", "Line is ringing", "gauge");
+  for (int i = 0; i < SIP_MAX_LINES; i++) {
+    snprintf(labels, sizeof(labels), "line=\"%d\"", i + 1);
+    Metrics::write_value(out, "line_ringing", labels, (runtime.ringingLines >> i) & 1);
+  }
+
+  Metrics::write_header(out, "registrations_total", "Successful REGISTER or SUBSCRIBE transactions", "counter");
+  for (int i = 0; i < SIP_MAX_LINES; i++) {
+    snprintf(labels, sizeof(labels), "line=\"%d\"", i + 1);
+    Metrics::write_value(out, "registrations_total", labels, runtime.sip_line(i).lineStats.registrations.load());
+  }
+  Metrics::write_header(out, "registration_failures_total", "Failed registration attempts", "counter");
+  for (int i = 0; i < SIP_MAX_LINES; i++) {
+    snprintf(labels, sizeof(labels), "line=\"%d\"", i + 1);
+    Metrics::write_value(out, "registration_failures_total", labels, runtime.sip_line(i).lineStats.registrationFailures.load());
+  }
+  Metrics::write_header(out, "auth_challenges_total", "401 and 407 challenges received", "counter");
+  for (int i = 0; i < SIP_MAX_LINES; i++) {
+    snprintf(labels, sizeof(labels), "line=\"%d\"", i + 1);
+    Metrics::write_value(out, "auth_challenges_total", labels, runtime.sip_line(i).lineStats.authChallenges.load());
+  }
+
+  // Per line and transport, what the shared UDP socket dropped before routing has no line
+  static const char *transports[] = { "udp", "stream" };
+  Metrics::write_header(out, "packets_received_total", "SIP messages that reached a line", "counter");
+  for (int i = 0; i < SIP_MAX_LINES; i++) {
+    for (int t = 0; t < 2; t++) {
+      SIPClient &line = runtime.sip_line(i);
+      snprintf(labels, sizeof(labels), "socket=\"%s\",line=\"%d\"", transports[t], i + 1);
+      Metrics::write_value(out, "packets_received_total", labels, (t == 0 ? line.udpStats : line.streamStats).received.load());
+    }
+  }
+  Metrics::write_header(out, "packets_processed_total", "SIP messages parsed and handed to their line", "counter");
+  for (int i = 0; i < SIP_MAX_LINES; i++) {
+    for (int t = 0; t < 2; t++) {
+      SIPClient &line = runtime.sip_line(i);
+      snprintf(labels, sizeof(labels), "socket=\"%s\",line=\"%d\"", transports[t], i + 1);
+      Metrics::write_value(out, "packets_processed_total", labels, (t == 0 ? line.udpStats : line.streamStats).processed.load());
+    }
+  }
+  Metrics::write_header(out, "packets_dropped_total", "SIP messages truncated, malformed or for no line", "counter");
+  Metrics::write_value(out, "packets_dropped_total", "socket=\"udp\"", runtime.sipEndpoint.socketStats.dropped.load());
+  for (int i = 0; i < SIP_MAX_LINES; i++) {
+    snprintf(labels, sizeof(labels), "socket=\"stream\",line=\"%d\"", i + 1);
+    Metrics::write_value(out, "packets_dropped_total", labels, runtime.sip_line(i).streamStats.dropped.load());
+  }
+  Metrics::write_header(out, "udp_drain_bursts_total", "Wakeups that drained at least a full lwIP receive mailbox of datagrams", "counter");
+  Metrics::write_value(out, "udp_drain_bursts_total", nullptr, runtime.sipEndpoint.socketStats.drainBursts.load());
+  Metrics::write_header(out, "udp_max_burst", "Most datagrams drained in one wakeup since boot", "gauge");
+  Metrics::write_value(out, "udp_max_burst", nullptr, runtime.sipEndpoint.socketStats.maxBurst.load());
+
+  metrics.timeToRegistered.write_histogram(out, "time_to_registered_seconds", "First REGISTER or SUBSCRIBE to its 2xx", 1000.0);
+  metrics.ringLatency.write_histogram(out, "ring_latency_seconds", "INVITE arrival to the LED frame showing it", 1000000.0);
+  metrics.ledFrameLateness.write_histogram(out, "led_frame_lateness_seconds", "LED frame timer deadline to the frame being drawn", 1000000.0);
+  metrics.loopTime.write_summary(out, "loop_duration_seconds", "One pass of the main loop", 1000000.0);
+
+  Metrics::write_header(out, "heap_free_bytes", "Free heap", "gauge");
+  Metrics::write_value(out, "heap_free_bytes", nullptr, ESP.getFreeHeap());
+  Metrics::write_header(out, "heap_min_free_bytes", "Lowest free heap since boot", "gauge");
+  Metrics::write_value(out, "heap_min_free_bytes", nullptr, ESP.getMinFreeHeap());
+  Metrics::write_header(out, "heap_largest_free_block_bytes", "Largest allocatable block", "gauge");
+  Metrics::write_value(out, "heap_largest_free_block_bytes", nullptr, ESP.getMaxAllocHeap());
+
+  Metrics::write_header(out, "lldp_neighbor_age_seconds", "Time since the last LLDP frame from the switch, -1 before any", "gauge");
+  Metrics::write_value(out, "lldp_neighbor_age_seconds", nullptr, runtime.lldp.getNeighborAge());
+
+  Metrics::write_header(out, "loop_idle_seconds_total", "Time the main loop spent waiting for work", "counter");
+  Metrics::write_value(out, "loop_idle_seconds_total", nullptr, runtime.idleMicros / 1000000.0);
+  Metrics::write_header(out, "light_sleep_seconds_total", "Time the chip spent in light sleep", "counter");
+  Metrics::write_value(out, "light_sleep_seconds_total", nullptr, runtime.power.getSleptMicros() / 1000000.0);
+  Metrics::write_header(out, "light_sleep_wakeups_total", "Light sleep periods, each one ended by a wakeup", "counter");
+  Metrics::write_value(out, "light_sleep_wakeups_total", nullptr, runtime.power.getSleepCount());
+
+  Metrics::write_header(out, "uptime_seconds", "Time since boot", "counter");
+  Metrics::write_value(out, "uptime_seconds", nullptr, millis() / 1000);
+  return out;
+}
+
 // Check if user is authenticated via cookie
 bool ConfigServer::is_authenticated() {
   if (!server.hasHeader("cookie") && !server.hasHeader("Cookie")) {
@@ -159,10 +318,10 @@ bool ConfigServer::is_authenticated() {
 
   // Check if cookie is valid and not expired
   if (authStatus == "authenticated" && millis() < expiryTime) {
-    Serial.println("User " + username + " validated from cookie. [Expires: " + parts[0] + "]");
+    LOG_DEBUG("User %s validated from cookie. [Expires: %s]", username.c_str(), parts[0].c_str());
     return true;
   } else {
-    Serial.println("User " + username + " failed validation with expired cookie.");
+    LOG_INFO("User %s failed validation with expired cookie.", username.c_str());
   }
 
   return false;
@@ -176,7 +335,7 @@ void ConfigServer::redirect_to_login() {
 
 void ConfigServer::init() {
   authSecret = runtime.get_random_string(32);
-  Serial.println("Initialized config server authentication with secret " + authSecret);
+  LOG_INFO("Initialized config server authentication");
 
   // Tell the server to collect Cookie headers
   const char* headerKeys[] = {"Cookie"};
@@ -230,13 +389,13 @@ void ConfigServer::init() {
       server.sendHeader("Location", "/");
       server.send(303);
 
-      Serial.println("User " + username + " logged in successfully, set authentication cookie.");
+      LOG_INFO("User %s logged in successfully, set authentication cookie.", username.c_str());
     } else {
       // Redirect back to login with error
       server.sendHeader("Location", "/login?error=1");
       server.send(303);
 
-      Serial.println("Failed login attempt - username: " + username);
+      LOG_WARN("Failed login attempt - username: %s", username.c_str());
     }
   });
 
@@ -247,7 +406,7 @@ void ConfigServer::init() {
     server.sendHeader("Location", "/login");
     server.send(303);
 
-    Serial.println("User logged out");
+    LOG_INFO("User logged out");
   });
 
   // Root page - configuration interface
@@ -287,48 +446,61 @@ void ConfigServer::init() {
       } else {
         htmlChunk.replace("{LLDP_NEIGHBOR}", "No LLDP neighbor detected");
       }
-      htmlChunk.replace("{LED_PATTERN}", String(runtime.ledManager.runningPattern));
+      htmlChunk.replace("{LED_PATTERN}", String(runtime.ledManager.getPattern(0)));
       htmlChunk.replace("{RELAY_PATTERN_1}", String(runtime.relay1.relayState));
       htmlChunk.replace("{RELAY_PATTERN_2}", String(runtime.relay2.relayState));
       htmlChunk.replace("{SOFTWARE_VERSION}", SOFTWARE_VERSION);
-
-      if (runtime.sipLine1.is_registered() && runtime.sipLine1.is_ringing()) {
-        htmlChunk.replace("{LINE_1_STATUS}", "ringing");
-      } else if (runtime.sipLine1.is_registered()) {
-        htmlChunk.replace("{LINE_1_STATUS}", "registered");
-      } else if (runtime.sipLine1.is_configured()) {
-        htmlChunk.replace("{LINE_1_STATUS}", "configured");
-      } else {
-        htmlChunk.replace("{LINE_1_STATUS}", "notconfigured");
+      htmlChunk.replace("{CAPTURE_COUNT}", String(runtime.sipEndpoint.capture.count()));
+      if (htmlChunk.indexOf("{POWER_STATUS}") >= 0) {
+        htmlChunk.replace("{POWER_STATUS}", power_status());
       }
 
-      if (runtime.sipLine2.is_registered() && runtime.sipLine1.is_ringing()) {
-        htmlChunk.replace("{LINE_2_STATUS}", "ringing");
-      } else if (runtime.sipLine2.is_registered()) {
-        htmlChunk.replace("{LINE_2_STATUS}", "registered");
-      } else if (runtime.sipLine2.is_configured()) {
-        htmlChunk.replace("{LINE_2_STATUS}", "configured");
-      } else {
-        htmlChunk.replace("{LINE_2_STATUS}", "notconfigured");
+      // Lines 1 and 2 are in the markup, the rest arrive as {LINE_DATA}
+      for (int i = 0; i < 2 && i < SIP_MAX_LINES; i++) {
+        String n = String(i + 1);
+        SIPClient &line = runtime.sip_line(i);
+        htmlChunk.replace("{LINE_" + n + "_STATUS}", line_status(i));
+        htmlChunk.replace("{SIP_SERVER_" + n + "}", line.sipServer);
+        htmlChunk.replace("{SIP_PORT_" + n + "}", String(line.sipPort));
+        htmlChunk.replace("{SIP_USERNAME_" + n + "}", line.sipUsername);
+        htmlChunk.replace("{SIP_PASSWORD_" + n + "}", line.sipPassword);
+        htmlChunk.replace("{SIP_TRANSPORT_" + n + "}", String(line.sipTransport));
+        htmlChunk.replace("{SIP_VERIFY_" + n + "}", line.sipVerify ? "1" : "0");
+        htmlChunk.replace("{SIP_MODE_" + n + "}", String(line.sipMode));
+        htmlChunk.replace("{SIP_MONITOR_" + n + "}", line.sipMonitor);
+        htmlChunk.replace("{LED_RING_" + n + "}", String(runtime.lineRingPattern[i]));
+        htmlChunk.replace("{LED_ERROR_" + n + "}", String(runtime.lineErrorPattern[i]));
+      }
+      if (htmlChunk.indexOf("{LINE_DATA}") >= 0) {
+        htmlChunk.replace("{LINE_DATA}", line_data());
       }
-
-      htmlChunk.replace("{SIP_SERVER_1}", runtime.sipLine1.sipServer);
-      htmlChunk.replace("{SIP_PORT_1}", String(runtime.sipLine1.sipPort));
-      htmlChunk.replace("{SIP_USERNAME_1}", runtime.sipLine1.sipUsername);
-      htmlChunk.replace("{SIP_PASSWORD_1}", runtime.sipLine1.sipPassword);
-      htmlChunk.replace("{SIP_SERVER_2}", runtime.sipLine2.sipServer);
-      htmlChunk.replace("{SIP_PORT_2}", String(runtime.sipLine2.sipPort));
-      htmlChunk.replace("{SIP_USERNAME_2}", runtime.sipLine2.sipUsername);
-      htmlChunk.replace("{SIP_PASSWORD_2}", runtime.sipLine2.sipPassword);
 
       htmlChunk.replace("{LED_IDLE}", String(runtime.idlePattern));
-      htmlChunk.replace("{LED_RING_1}", String(runtime.line1RingPattern));
-      htmlChunk.replace("{LED_RING_2}", String(runtime.line2RingPattern));
-      htmlChunk.replace("{LED_ERROR_1}", String(runtime.line1ErrorPattern));
-      htmlChunk.replace("{LED_ERROR_2}", String(runtime.line2ErrorPattern));
+      for (int i = 0; i < LED_USER_PATTERNS; i++) {
+        htmlChunk.replace("{LED_CUSTOM_" + String(i + 1) + "}", runtime.userPatterns[i]);
+      }
+      for (int i = 0; i < LED_MAX_STRIPS; i++) {
+        String n = String(i + 1);
+        htmlChunk.replace("{LED_PIN_" + n + "}", runtime.ledPin[i] < 0 ? String("") : String(runtime.ledPin[i]));
+        htmlChunk.replace("{LED_COUNT_" + n + "}", String(runtime.ledCount[i]));
+      }
+      for (int i = 0; i < LED_MAX_SEGMENTS; i++) {
+        String n = String(i + 1);
+        htmlChunk.replace("{SEGMENT_STRIP_" + n + "}", String(runtime.segmentStrip[i]));
+        htmlChunk.replace("{SEGMENT_FIRST_" + n + "}", String(runtime.segmentFirst[i]));
+        htmlChunk.replace("{SEGMENT_COUNT_" + n + "}", String(runtime.segmentCount[i]));
+        htmlChunk.replace("{SEGMENT_LINES_" + n + "}", runtime.format_line_mask(runtime.segmentLines[i]));
+      }
+
+      htmlChunk.replace("{SYSLOG_SERVER}", runtime.syslogServer);
+      htmlChunk.replace("{SYSLOG_PORT}", String(runtime.syslogPort));
+      htmlChunk.replace("{LOG_LEVEL}", String(runtime.logLevel));
+      htmlChunk.replace("{LIGHT_SLEEP}", runtime.lightSleep ? "1" : "0");
 
       htmlChunk.replace("{RELAY_1}", String(runtime.relay1Config));
       htmlChunk.replace("{RELAY_2}", String(runtime.relay2Config));
+      htmlChunk.replace("{RELAY_LINES_1}", runtime.format_line_mask(runtime.relay1Lines));
+      htmlChunk.replace("{RELAY_LINES_2}", runtime.format_line_mask(runtime.relay2Lines));
 
       // If not the last chunk, save the last OVERLAP characters for next iteration
       if (pos + chunk < len) {
@@ -353,22 +525,23 @@ void ConfigServer::init() {
       return;
     }
 
-    if (server.hasArg("sip_server_1") && server.hasArg("sip_port_1") && 
-      server.hasArg("sip_username_1") && server.hasArg("sip_password_1")) {
-        runtime.sipLine1.update_credentials(server.arg("sip_server_1"), server.arg("sip_port_1").toInt(),
-        server.arg("sip_username_1"), server.arg("sip_password_1"), server.arg("sip_server_1"));
-    }
-
-    if (server.hasArg("sip_server_2") && server.hasArg("sip_port_2") && 
-      server.hasArg("sip_username_2") && server.hasArg("sip_password_2")) {
-        runtime.sipLine2.update_credentials(server.arg("sip_server_2"), server.arg("sip_port_2").toInt(),
-        server.arg("sip_username_2"), server.arg("sip_password_2"), server.arg("sip_server_2"));
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+      String n = String(i + 1);
+      if (server.hasArg("sip_server_" + n) && server.hasArg("sip_port_" + n) &&
+        server.hasArg("sip_username_" + n) && server.hasArg("sip_password_" + n)) {
+          runtime.configure_line(i, server.arg("sip_server_" + n), server.arg("sip_port_" + n).toInt(),
+          server.arg("sip_username_" + n), server.arg("sip_password_" + n), server.arg("sip_server_" + n),
+          server.hasArg("sip_transport_" + n) ? server.arg("sip_transport_" + n).toInt() : SIP_TRANSPORT_UDP,
+          server.hasArg("sip_mode_" + n) ? server.arg("sip_mode_" + n).toInt() : SIP_MODE_REGISTER, server.arg("sip_monitor_" + n),
+          !server.hasArg("sip_verify_" + n) || server.arg("sip_verify_" + n).toInt() != 0);
+      }
     }
 
     runtime.save_configuration();
 
-    runtime.sipLine1.begin_registration();
-    runtime.sipLine2.begin_registration();
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+      runtime.sip_line(i).schedule_registration(0);
+    }
 
     server.sendHeader("Location", "/?save=sip");
     server.send(303);
@@ -383,13 +556,36 @@ void ConfigServer::init() {
     }
 
     if (server.hasArg("led_idle")) runtime.idlePattern = server.arg("led_idle").toInt();
-    if (server.hasArg("led_ring_1")) runtime.line1RingPattern = server.arg("led_ring_1").toInt();
-    if (server.hasArg("led_ring_2")) runtime.line2RingPattern = server.arg("led_ring_2").toInt();
-    if (server.hasArg("led_error_1")) runtime.line1ErrorPattern = server.arg("led_error_1").toInt();
-    if (server.hasArg("led_error_2")) runtime.line2ErrorPattern = server.arg("led_error_2").toInt();
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+      String n = String(i + 1);
+      if (server.hasArg("led_ring_" + n)) runtime.lineRingPattern[i] = server.arg("led_ring_" + n).toInt();
+      if (server.hasArg("led_error_" + n)) runtime.lineErrorPattern[i] = server.arg("led_error_" + n).toInt();
+    }
+    for (int i = 0; i < LED_USER_PATTERNS; i++) {
+      String n = String(i + 1);
+      if (server.hasArg("led_custom_" + n)) {
+        runtime.userPatterns[i] = server.arg("led_custom_" + n);
+        runtime.ledManager.setUserPattern(i, runtime.userPatterns[i]);
+      }
+    }
+    for (int i = 0; i < LED_MAX_STRIPS; i++) {
+      String n = String(i + 1);
+      if (server.hasArg("led_pin_" + n)) runtime.ledPin[i] = server.arg("led_pin_" + n).length() > 0 ? server.arg("led_pin_" + n).toInt() : -1;
+      if (server.hasArg("led_count_" + n)) runtime.ledCount[i] = server.arg("led_count_" + n).toInt();
+    }
+    for (int i = 0; i < LED_MAX_SEGMENTS; i++) {
+      String n = String(i + 1);
+      if (server.hasArg("segment_strip_" + n)) runtime.segmentStrip[i] = server.arg("segment_strip_" + n).toInt();
+      if (server.hasArg("segment_first_" + n)) runtime.segmentFirst[i] = server.arg("segment_first_" + n).toInt();
+      if (server.hasArg("segment_count_" + n)) runtime.segmentCount[i] = server.arg("segment_count_" + n).toInt();
+      if (server.hasArg("segment_lines_" + n)) runtime.segmentLines[i] = runtime.parse_line_mask(server.arg("segment_lines_" + n));
+    }
+    runtime.configure_leds();
 
     if (server.hasArg("relay_1")) runtime.relay1Config = server.arg("relay_1").toInt();
     if (server.hasArg("relay_2")) runtime.relay2Config = server.arg("relay_2").toInt();
+    if (server.hasArg("relay_lines_1")) runtime.relay1Lines = runtime.parse_line_mask(server.arg("relay_lines_1"));
+    if (server.hasArg("relay_lines_2")) runtime.relay2Lines = runtime.parse_line_mask(server.arg("relay_lines_2"));
 
     runtime.save_configuration();
 
@@ -407,13 +603,76 @@ void ConfigServer::init() {
 
     if (server.hasArg("hostname")) runtime.deviceHostname = server.arg("hostname");
     if (server.hasArg("admin_password")) runtime.webPassword = server.arg("admin_password");
+    if (server.hasArg("syslog_server")) runtime.syslogServer = server.arg("syslog_server");
+    if (server.hasArg("syslog_port")) runtime.syslogPort = server.arg("syslog_port").toInt();
+    if (server.hasArg("log_level")) runtime.logLevel = server.arg("log_level").toInt();
+    if (server.hasArg("light_sleep")) runtime.lightSleep = server.arg("light_sleep").toInt() != 0;
 
     runtime.save_configuration();
+    runtime.configure_logging();
+    runtime.power.setLightSleep(runtime.lightSleep);
 
     server.sendHeader("Location", "/?save=device");
     server.send(303);
   });
 
+#ifdef PROFILER_ENABLED
+  // Loop profile, only built into profiling firmware
+  server.on("/diagnostics", HTTP_GET, [&]() {
+    if (!is_authenticated()) {
+      redirect_to_login();
+      return;
+    }
+
+    String page = String(webpage_diagnostics);
+    page.replace("{HOSTNAME}", runtime.deviceHostname);
+    page.replace("{CPU_MHZ}", String(ESP.getCpuFreqMHz()));
+    page.replace("{PROFILE_DATA}", profiler.json());
+    server.send(200, "text/html", page);
+  });
+
+  server.on("/diagnostics/reset", HTTP_POST, [&]() {
+    if (!is_authenticated()) {
+      redirect_to_login();
+      return;
+    }
+
+    profiler.reset();
+    server.sendHeader("Location", "/diagnostics");
+    server.send(303);
+  });
+#endif
+
+  // Scraped by Prometheus, which has no session cookie, and holds nothing secret
+  server.on("/metrics", HTTP_GET, [&]() {
+    server.send(200, "text/plain; version=0.0.4", metrics_text());
+  });
+
+  // Recent SIP traffic for Wireshark, streamed one message at a time
+  server.on("/capture.pcap", HTTP_GET, [&]() {
+    if (!is_authenticated()) {
+      redirect_to_login();
+      return;
+    }
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.sendHeader("Content-Disposition", "attachment; filename=\"sip-capture.pcap\"");
+    server.send(200, "application/vnd.tcpdump.pcap", "");
+
+    static uint8_t packet[SIP_RX_BUFFER_SIZE + 64];
+    SIPCapture &capture = runtime.sipEndpoint.capture;
+    size_t length = capture.write_file_header(packet);
+    server.sendContent((const char *)packet, length);
+
+    SIPCaptureCursor cursor = capture.cursor();
+    uint32_t localIP = (uint32_t)ETH.localIP();
+    uint16_t localPort = runtime.sipEndpoint.local_port();
+    while ((length = capture.next_packet(cursor, localIP, localPort, packet, sizeof(packet))) > 0) {
+      server.sendContent((const char *)packet, length);
+    }
+    server.sendContent("");
+  });
+
   // Manual SIP registration
   server.on("/register-now", HTTP_POST, [&]() {
     // Check authentication
@@ -422,17 +681,17 @@ void ConfigServer::init() {
       return;
     }
 
-    runtime.sipLine1.begin_registration();
-    runtime.sipLine2.begin_registration();
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+      runtime.sip_line(i).schedule_registration(0);
+    }
     
     server.sendHeader("Location", "/?save=register-now");
     server.send(303);
   });
 
   server.begin();
-  Serial.println("Web server started on port 80");
-  Serial.print("Server should be accessible at: http://");
-  Serial.println(ETH.localIP());
+  LOG_INFO("Web server started on port 80");
+  LOG_INFO("Server should be accessible at: http://%s", ETH.localIP().toString().c_str());
 }
 
 void ConfigServer::handle() {
@@ -17,6 +17,10 @@ class ConfigServer {
         String encrypt_cookie(String data);
         String decrypt_cookie(String data);
         String create_auth_cookie(String username);
+        String line_status(int line);
+        String line_data();
+        String power_status();
+        String metrics_text();
     public:
         unsigned long sessionTimeout = 3600000; // 1 hour
         String authSecret;
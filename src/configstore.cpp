@@ -11,7 +11,7 @@ String ConfigStore::get_default_string(String key) {
 }
 
 int ConfigStore::get_default_integer(String key) {
-    if (key == "sipPort1" || key == "sipPort2") {
+    if (key.startsWith("sipPort")) {
         return 5060;
     }
     return 0;
@@ -0,0 +1,20 @@
+#ifndef IDLE_WAITS_H
+#define IDLE_WAITS_H
+
+// How long each task may block while idle, every one of these ends in a wakeup.
+// Kept free of the ESP-IDF so the wakeups they cost can be simulated.
+
+#define SIP_TASK_TIMEOUT_MS 1000 // Longest select() wait, line deadlines and wakeups normally end it sooner
+
+// Without the LLDP frame hook nothing tells the loop a web client is waiting, so it polls.
+// With it the loop only polls while a client was seen recently, to serve the rest of the request.
+#define LOOP_WEB_POLL_MS 10
+#define LOOP_WEB_LINGER_MS 100
+#define LOOP_IDLE_MAX_MS 1000
+
+#define LLDP_INTERVAL 30000 // 30 seconds
+
+#define SIP_KEEPALIVE_MIN_INTERVAL 15000  // After registering or a missed probe
+#define SIP_KEEPALIVE_MAX_INTERVAL 120000 // Healthy path, doubles up to this
+
+#endif
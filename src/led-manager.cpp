@@ -1,350 +1,276 @@
 #include <led-manager.h>
 
 LedManager::LedManager() {
-    strip = Adafruit_NeoPixel(WS2811_COUNT, WS2811_PIN, NEO_GRB + NEO_KHZ800);
+    mutex = xSemaphoreCreateMutex();
 }
 
-void LedManager::setPattern(int pattern) {
-    if (pattern == runningPattern) { return; }
-    lastTick = 0;
-    ledStage = 0;
-    runningPattern = pattern;
-    Serial.println("LED pattern changed to " + String(pattern));
+// Starts the render task, it draws once straight away so the strips show their patterns
+void LedManager::init() {
+    if (renderTask != NULL) return;
+    const esp_timer_create_args_t timerArgs = {
+        .callback = LedManager::onFrameTimer,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "led",
+        .skip_unhandled_events = true
+    };
+    if (esp_timer_create(&timerArgs, &frameTimer) != ESP_OK) {
+        LOG_ERROR("Failed to create the LED frame timer");
+        return;
+    }
+    xTaskCreatePinnedToCore(LedManager::renderLoop, "led", LED_TASK_STACK, this, LED_TASK_PRIORITY, &renderTask, LED_TASK_CORE);
 }
 
-void LedManager::init() {
-    strip.begin();
-    strip.setBrightness(250);
-    for (int i = 0; i < WS2811_COUNT; i++) {
-        strip.setPixelColor(i, strip.Color(0, 0, 0)); // Off
+// Wakes the render task, which pre-empts the caller and draws before it returns
+void LedManager::changed() {
+    if (renderTask != NULL) {
+        xTaskNotify(renderTask, LED_NOTIFY_CHANGE, eSetBits);
     }
-    strip.show();
 }
 
-void LedManager::handle() {
-    switch (runningPattern) {
-        case LED_OFF:
-            if (millis() - lastTick > 1000) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, 0, 0)); // Off
-                }
-                lastTick = millis();
-            }
-            break;
-        case RED_SOLID:
-            if (millis() - lastTick > 1000) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(255, 0, 0)); // Red
-                }
-                lastTick = millis();
-            }
-            break;
-        case GREEN_SOLID:
-            if (millis() - lastTick > 1000) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, 255, 0)); // Green
-                }
-                lastTick = millis();
-            }
-            break;
-        case BLUE_SOLID:
-            if (millis() - lastTick > 1000) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, 0, 255)); // Blue
-                }
-                lastTick = millis();
-            }
-            break;
-        case YELLOW_SOLID:
-            if (millis() - lastTick > 1000) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(255, 255, 0)); // Yellow
-                }
-                lastTick = millis();
-            }
-            break;
-        case PURPLE_SOLID:
-            if (millis() - lastTick > 1000) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, 255, 255)); // Purple
-                }
-                lastTick = millis();
-            }
-            break;
-        case RED_FLASH:
-            if (millis() - lastTick > 250) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color((255 * ledStage), 0, 0)); // Red or Off
-                }
-                if (ledStage == 0) {
-                    ledStage = 1;
-                } else {
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case GREEN_FLASH:
-            if (millis() - lastTick > 250) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, (255 * ledStage), 0)); // Green or Off
-                }
-                if (ledStage == 0) {
-                    ledStage = 1;
-                } else {
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case BLUE_FLASH:
-            if (millis() - lastTick > 250) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, 0, (255 * ledStage))); // Blue or Off
-                }
-                if (ledStage == 0) {
-                    ledStage = 1;
-                } else {
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case YELLOW_FLASH:
-            if (millis() - lastTick > 250) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color((255 * ledStage), (255 * ledStage), 0)); // Yellow or Off
-                }
-                if (ledStage == 0) {
-                    ledStage = 1;
-                } else {
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case PURPLE_FLASH:
-            if (millis() - lastTick > 250) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, (255 * ledStage), (255 * ledStage))); // Purple or Off
-                }
-                if (ledStage == 0) {
-                    ledStage = 1;
-                } else {
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case RED_GREEN_FLASH:
-            if (millis() - lastTick > 250) {
-                if (ledStage == 0) {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(255, 0, 0)); // Red
-                    }
-                    ledStage = 1;
-                } else {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(0, 255, 0)); // Green
-                    }
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case RED_BLUE_FLASH:
-            if (millis() - lastTick > 250) {
-                if (ledStage == 0) {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(255, 0, 0)); // Red
-                    }
-                    ledStage = 1;
-                } else {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(0, 0, 255)); // Blue
-                    }
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case RED_YELLOW_FLASH:
-            if (millis() - lastTick > 250) {
-                if (ledStage == 0) {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(255, 0, 0)); // Red
-                    }
-                    ledStage = 1;
-                } else {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(255, 255, 0)); // Yellow
-                    }
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case RED_PURPLE_FLASH:
-            if (millis() - lastTick > 250) {
-                if (ledStage == 0) {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(255, 0, 0)); // Red
-                    }
-                    ledStage = 1;
-                } else {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(0, 255, 255)); // Purple
-                    }
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case GREEN_BLUE_FLASH:
-            if (millis() - lastTick > 250) {
-                if (ledStage == 0) {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(0, 255, 0)); // Green
-                    }
-                    ledStage = 1;
-                } else {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(0, 0, 255)); // Blue
-                    }
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case GREEN_YELLOW_FLASH:
-            if (millis() - lastTick > 250) {
-                if (ledStage == 0) {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(0, 255, 0)); // Green
-                    }
-                    ledStage = 1;
-                } else {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(255, 255, 0)); // Yellow
-                    }
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case GREEN_PURPLE_FLASH:
-            if (millis() - lastTick > 250) {
-                if (ledStage == 0) {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(0, 255, 0)); // Green
-                    }
-                    ledStage = 1;
-                } else {
-                    for (int i = 0; i < WS2811_COUNT; i++) {
-                        strip.setPixelColor(i, strip.Color(0, 255, 255)); // Purple
-                    }
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case RED_CHASE:
-            if (millis() - lastTick > 100) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, 0, 0)); // Off
-                }
-                strip.setPixelColor(ledStage, strip.Color(255, 0, 0));
-                if (ledStage != WS2811_COUNT) {
-                    strip.setPixelColor(ledStage + 1, strip.Color(255, 0, 0));
-                } else {
-                    strip.setPixelColor(0, strip.Color(255, 0, 0));
-                }
-                ledStage += 1;
-                if (ledStage > WS2811_COUNT) {
-                    ledStage = 0;
-                }
-                lastTick = millis();
-            }
-            break;
-        case GREEN_CHASE:
-            if (millis() - lastTick > 100) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, 0, 0)); // Off
-                }
-                strip.setPixelColor(ledStage, strip.Color(255, 0, 0));
-                if (ledStage != WS2811_COUNT) {
-                    strip.setPixelColor(ledStage + 1, strip.Color(0, 255, 0));
-                } else {
-                    strip.setPixelColor(0, strip.Color(0, 255, 0));
-                }
-                ledStage += 1;
-                if (ledStage > WS2811_COUNT) {
-                    ledStage = 0;
-                }
-                lastTick = millis();
+// A new pattern shows straight away rather than at the old pattern's next step
+void LedManager::setPattern(int segment, int pattern) {
+    if (segment < 0 || segment >= LED_MAX_SEGMENTS) return;
+    LedSegment &target = segments[segment];
+    if (pattern == target.pattern) { return; }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    target.patternStart = millis();
+    target.pattern = pattern;
+    xSemaphoreGive(mutex);
+    LOG_DEBUG("LED segment %d pattern changed to %d", segment + 1, pattern);
+    if (target.count > 0) this->changed();
+}
+
+// Restarts the strip only if its pin or length changed, a length of 0 turns it off
+void LedManager::configureStrip(int strip, int pin, uint16_t count) {
+    if (strip < 0 || strip >= LED_MAX_STRIPS) return;
+    LedStrip &target = strips[strip];
+    if (pin < 0) count = 0;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (target.isStarted() && target.getPin() == pin && target.numPixels() == count) {
+        xSemaphoreGive(mutex);
+        return;
+    }
+    if (count == 0) {
+        target.end();
+    } else {
+        target.setBrightness(250);
+        target.begin(pin, count);
+    }
+    blank = true;
+    xSemaphoreGive(mutex);
+    this->changed();
+}
+
+void LedManager::configureSegment(int segment, int strip, uint16_t first, uint16_t count) {
+    if (segment < 0 || segment >= LED_MAX_SEGMENTS) return;
+    LedSegment &target = segments[segment];
+    if (strip < 0 || strip >= LED_MAX_STRIPS) count = 0;
+    if (target.strip == strip && target.first == first && target.count == count) return;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    target.strip = count > 0 ? strip : 0;
+    target.first = first;
+    target.count = count;
+    blank = true;
+    xSemaphoreGive(mutex);
+    this->changed();
+}
+
+const LedPatternSpec *LedManager::patternSpec(int pattern) {
+    if (pattern >= LED_USER_PATTERN && pattern < LED_USER_PATTERN + LED_USER_PATTERNS) {
+        return &userPatterns[pattern - LED_USER_PATTERN];
+    }
+    return builtinPattern(pattern);
+}
+
+// An empty or invalid pattern text leaves that user pattern dark
+void LedManager::setUserPattern(int index, const String &text) {
+    if (index < 0 || index >= LED_USER_PATTERNS) return;
+    LedPatternSpec pattern = {};
+    if (text.length() > 0 && !parsePattern(text, pattern)) {
+        LOG_WARN("Custom LED pattern %d is not valid: %s", index + 1, text.c_str());
+        pattern = {};
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    userPatterns[index] = pattern;
+    for (int i = 0; i < LED_MAX_SEGMENTS; i++) {
+        if (segments[i].pattern == LED_USER_PATTERN + index) {
+            segments[i].patternStart = millis();
+        }
+    }
+    xSemaphoreGive(mutex);
+    this->changed();
+}
+
+// Finds the keyframe offset milliseconds into the pattern and leaves offset relative to its start.
+// Each keyframe lasts scale times its duration, a chase step is taken once per pixel.
+int LedManager::frameAt(const LedPatternSpec &pattern, uint32_t &offset, uint32_t scale) {
+    offset %= patternLength(pattern) * scale;
+    for (int i = 0; i < pattern.count; i++) {
+        uint32_t length = pattern.frames[i].duration * scale;
+        if (offset < length) return i;
+        offset -= length;
+    }
+    return 0;
+}
+
+// amount is out of 256
+uint32_t LedManager::blend(uint32_t from, uint32_t to, uint32_t amount) {
+    uint32_t color = 0;
+    for (int shift = 0; shift < 24; shift += 8) {
+        int a = (from >> shift) & 0xFF;
+        int b = (to >> shift) & 0xFF;
+        color |= (uint32_t)(a + (((b - a) * (int)amount) >> 8)) << shift;
+    }
+    return color;
+}
+
+// level is out of 255, the same scaling LedStrip uses for brightness
+uint32_t LedManager::dim(uint32_t color, uint8_t level) {
+    uint32_t dimmed = 0;
+    for (int shift = 0; shift < 24; shift += 8) {
+        dimmed |= ((((color >> shift) & 0xFF) * (level + 1)) >> 8) << shift;
+    }
+    return dimmed;
+}
+
+// Draws the pattern as it is elapsed milliseconds in, returns how long until it next changes
+// or LED_ANIMATE when it moves every frame
+uint32_t LedManager::render(LedSegment &segment, const LedPatternSpec &pattern, uint32_t elapsed) {
+    LedStrip &strip = strips[segment.strip];
+    // Whatever part of the segment the strip is long enough for
+    uint16_t pixels = 0;
+    if (segment.first < strip.numPixels()) {
+        pixels = strip.numPixels() - segment.first;
+        if (segment.count < pixels) pixels = segment.count;
+    }
+    if (pixels == 0) {
+        return LED_SOLID_REFRESH;
+    }
+    if (pattern.count == 0) {
+        strip.fill(LED_BLACK, segment.first, pixels);
+        return LED_SOLID_REFRESH;
+    }
+
+    uint32_t offset = elapsed;
+    switch (pattern.effect) {
+        case LED_EFFECT_CHASE: {
+            int frame = frameAt(pattern, offset, pixels);
+            uint32_t step = pattern.frames[frame].duration;
+            uint16_t head = offset / step;
+            strip.fill(LED_BLACK, segment.first, pixels);
+            strip.setPixelColor(segment.first + head, pattern.frames[frame].color);
+            strip.setPixelColor(segment.first + (head + 1) % pixels, pattern.frames[frame].color);
+            return step - offset % step;
+        }
+        case LED_EFFECT_FADE: {
+            int frame = frameAt(pattern, offset, 1);
+            uint32_t duration = pattern.frames[frame].duration;
+            uint32_t next = pattern.frames[(frame + 1) % pattern.count].color;
+            strip.fill(blend(pattern.frames[frame].color, next, offset * 256 / duration), segment.first, pixels);
+            return LED_ANIMATE;
+        }
+        case LED_EFFECT_BREATHE: {
+            int frame = frameAt(pattern, offset, 1);
+            uint8_t level = ledBreath[offset * 256 / pattern.frames[frame].duration];
+            strip.fill(dim(pattern.frames[frame].color, level), segment.first, pixels);
+            return LED_ANIMATE;
+        }
+        case LED_EFFECT_COMET: {
+            int frame = frameAt(pattern, offset, pixels);
+            uint32_t step = pattern.frames[frame].duration;
+            uint32_t color = pattern.frames[frame].color;
+            uint16_t head = offset / step;
+            uint32_t fraction = (offset % step) * 256 / step; // How far the head is towards the next pixel
+            strip.fill(LED_BLACK, segment.first, pixels);
+            // The head is spread over the two pixels it sits between, the tail dims linearly behind it
+            if (pixels > 1) {
+                strip.setPixelColor(segment.first + (head + 1) % pixels, dim(color, fraction));
             }
-            break;
-        case BLUE_CHASE:
-            if (millis() - lastTick > 100) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, 0, 0)); // Off
-                }
-                strip.setPixelColor(ledStage, strip.Color(0, 0, 255));
-                if (ledStage != WS2811_COUNT) {
-                    strip.setPixelColor(ledStage + 1, strip.Color(0, 0, 255));
-                } else {
-                    strip.setPixelColor(0, strip.Color(0, 0, 255));
-                }
-                ledStage += 1;
-                if (ledStage > WS2811_COUNT) {
-                    ledStage = 0;
-                }
-                lastTick = millis();
+            for (int i = 0; i < LED_COMET_TAIL && i < pixels - 1; i++) {
+                uint32_t distance = i * 256 + fraction;
+                if (distance >= LED_COMET_TAIL * 256) break;
+                uint8_t level = 255 - distance / LED_COMET_TAIL;
+                strip.setPixelColor(segment.first + (head + pixels - i) % pixels, dim(color, level));
             }
-            break;
-        case YELLOW_CHASE:
-            if (millis() - lastTick > 100) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, 0, 0)); // Off
-                }
-                strip.setPixelColor(ledStage, strip.Color(255, 255, 0));
-                if (ledStage != WS2811_COUNT) {
-                    strip.setPixelColor(ledStage + 1, strip.Color(255, 255, 0));
-                } else {
-                    strip.setPixelColor(0, strip.Color(255, 255, 0));
-                }
-                ledStage += 1;
-                if (ledStage > WS2811_COUNT) {
-                    ledStage = 0;
-                }
-                lastTick = millis();
+            if (pixels == 1) strip.setPixelColor(segment.first, color);
+            return LED_ANIMATE;
+        }
+        default: {
+            int frame = frameAt(pattern, offset, 1);
+            strip.fill(pattern.frames[frame].color, segment.first, pixels);
+            return pattern.frames[frame].duration - offset;
+        }
+    }
+}
+
+// Draws every segment where its pattern is now, sends the strips that changed and sets the frame
+// timer for the next change. Animated effects keep a fixed cadence, a late frame is measured and
+// the next one comes a full period later rather than bunching up to catch up.
+void LedManager::drawFrame(bool timed) {
+    int64_t now = esp_timer_get_time();
+    if (timed) {
+        metrics.ledFrameLateness.observe(now > frameDeadline ? (uint32_t)(now - frameDeadline) : 0);
+    }
+
+    uint32_t interval = UINT32_MAX;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    {
+        PROFILE_SCOPE(PROFILE_LED);
+        if (blank) {
+            for (int i = 0; i < LED_MAX_STRIPS; i++) {
+                strips[i].fill(LED_BLACK);
             }
-            break;
-        case PURPLE_CHASE:
-            if (millis() - lastTick > 100) {
-                for (int i = 0; i < WS2811_COUNT; i++) {
-                    strip.setPixelColor(i, strip.Color(0, 0, 0)); // Off
-                }
-                strip.setPixelColor(ledStage, strip.Color(0, 255, 255));
-                if (ledStage != WS2811_COUNT) {
-                    strip.setPixelColor(ledStage + 1, strip.Color(0, 255, 255));
-                } else {
-                    strip.setPixelColor(0, strip.Color(0, 255, 255));
-                }
-                ledStage += 1;
-                if (ledStage > WS2811_COUNT) {
-                    ledStage = 0;
-                }
-                lastTick = millis();
+            blank = false;
+        }
+        uint32_t nowMs = millis();
+        for (int i = 0; i < LED_MAX_SEGMENTS; i++) {
+            LedSegment &segment = segments[i];
+            if (segment.count == 0) continue;
+            const LedPatternSpec *pattern = patternSpec(segment.pattern);
+            if (pattern == nullptr) {
+                LOG_ERROR("Bad LED pattern in memory!");
+                pattern = builtinPattern(LED_OFF);
             }
-            break;
-        default:
-            if (millis() - lastTick > 1000) {
-                Serial.println("Bad LED pattern in memory!");
+            interval = min(interval, this->render(segment, *pattern, nowMs - segment.patternStart));
+        }
+        for (int i = 0; i < LED_MAX_STRIPS; i++) {
+            strips[i].show();
+            if (strips[i].isPending()) {
+                interval = min<uint32_t>(interval, LED_BUSY_RETRY);
             }
-            lastTick = millis();
-            break;
+        }
     }
+    xSemaphoreGive(mutex);
 
-    strip.show();
-}
\ No newline at end of file
+    if (interval == LED_ANIMATE) {
+        if (!animating) {
+            frameDeadline = now + LED_FRAME_US;
+        } else if (timed) {
+            frameDeadline += LED_FRAME_US;
+            if (frameDeadline <= now) frameDeadline = now + LED_FRAME_US;
+        }
+        animating = true;
+    } else {
+        if (interval == UINT32_MAX) interval = LED_SOLID_REFRESH;
+        frameDeadline = now + (int64_t)interval * 1000;
+        animating = false;
+    }
+    esp_timer_stop(frameTimer);
+    esp_timer_start_once(frameTimer, frameDeadline > now ? frameDeadline - now : 0);
+}
+
+void LedManager::renderLoop(void *arg) {
+    LedManager *manager = (LedManager *)arg;
+    manager->drawFrame(false);
+    for (;;) {
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+        manager->drawFrame(events & LED_NOTIFY_FRAME);
+    }
+}
+
+void LedManager::onFrameTimer(void *arg) {
+    LedManager *manager = (LedManager *)arg;
+    xTaskNotify(manager->renderTask, LED_NOTIFY_FRAME, eSetBits);
+}
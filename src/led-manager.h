@@ -1,51 +1,73 @@
 #ifndef LEDMANAGER_H
 #define LEDMANAGER_H
 #include <Arduino.h>
-#include <Adafruit_NeoPixel.h>
-
-#define LED_FAST_FLASH 250
-#define LED_SLOW_FLASH 2000
+#include <logger.h>
+#include <profiler.h>
+#include <metrics.h>
+#include <led-strip.h>
+#include <led-pattern.h>
+#include "esp_timer.h"
 
 #define WS2811_PIN 2
 #define WS2811_COUNT 10
 
-enum LedPattern {
-  LED_OFF, //Dark
-  RED_SOLID, //Red Solid
-  GREEN_SOLID, //Green Solid
-  BLUE_SOLID, //Blue Solid
-  YELLOW_SOLID, //Yellow Solid
-  PURPLE_SOLID, //Purple Solid
-  RED_FLASH, //Red Flash
-  GREEN_FLASH, //Green Flash
-  BLUE_FLASH, //Blue Flash
-  YELLOW_FLASH, //Yellow Flash
-  PURPLE_FLASH, //Purple Flash
-  RED_GREEN_FLASH, //Red/Green Flash
-  RED_BLUE_FLASH, //Red/Blue Flash
-  RED_YELLOW_FLASH, //Red/Yellow Flash
-  RED_PURPLE_FLASH, //Red/Purple Flash
-  GREEN_BLUE_FLASH, //Green/Blue Flash
-  GREEN_YELLOW_FLASH, //Green/Yellow Flash
-  GREEN_PURPLE_FLASH, //Green/Purple Flash
-  RED_CHASE, //Red Chase
-  GREEN_CHASE, //Green Chase
-  BLUE_CHASE, //Blue Chase
-  YELLOW_CHASE, //Yellow Chase
-  PURPLE_CHASE //Purple Chase
+#define LED_MAX_STRIPS 2
+#define LED_MAX_SEGMENTS 4
+
+#define LED_FRAME_RATE 60
+#define LED_FRAME_US (1000000 / LED_FRAME_RATE)
+#define LED_ANIMATE 0 // render() result for effects that move every frame
+#define LED_BUSY_RETRY 5 // ms until a frame held back by the previous one still on the wire is sent
+
+#define LED_TASK_CORE 1
+#define LED_TASK_PRIORITY 3 // Above the loop task, a new pattern is on the strip before the loop carries on
+#define LED_TASK_STACK 4096
+
+#define LED_NOTIFY_CHANGE 0x01 // A pattern or the layout changed, draw now
+#define LED_NOTIFY_FRAME 0x02  // The frame timer fired
+
+// A run of pixels on one strip showing its own pattern
+struct LedSegment {
+  uint8_t strip = 0;
+  uint16_t first = 0;
+  uint16_t count = 0; // 0 while the segment is unused
+  int pattern = LED_OFF;
+  uint32_t patternStart = 0;
 };
 
 class LedManager {
   private:
-    Adafruit_NeoPixel strip; //(WS2811_COUNT, WS2811_PIN, NEO_GRB + NEO_KHZ800);
-    long lastTick = 0;
-    int ledStage = 0;
-  public:
-    int runningPattern = LED_OFF;
+    LedStrip strips[LED_MAX_STRIPS];
+    LedSegment segments[LED_MAX_SEGMENTS];
+    LedPatternSpec userPatterns[LED_USER_PATTERNS] = {};
+    bool blank = true; // Pixels no segment covers need clearing after a layout change
 
+    // Everything above is shared with the render task and only touched with the mutex held
+    SemaphoreHandle_t mutex;
+    TaskHandle_t renderTask = NULL;
+    esp_timer_handle_t frameTimer = NULL;
+    int64_t frameDeadline = 0; // us, when the frame timer is due
+    bool animating = false;
+
+    const LedPatternSpec *patternSpec(int pattern);
+    uint32_t render(LedSegment &segment, const LedPatternSpec &pattern, uint32_t elapsed);
+    void drawFrame(bool timed);
+    void changed();
+    static int frameAt(const LedPatternSpec &pattern, uint32_t &offset, uint32_t scale);
+    static uint32_t blend(uint32_t from, uint32_t to, uint32_t amount);
+    static uint32_t dim(uint32_t color, uint8_t level);
+    static void renderLoop(void *arg);
+    static void onFrameTimer(void *arg);
+#ifdef PIO_UNIT_TESTING
+    friend struct LedManagerProbe; // Draws frames without the render task
+#endif
+  public:
     LedManager();
-    void setPattern(int pattern);
     void init();
-    void handle();
+    void configureStrip(int strip, int pin, uint16_t count);
+    void configureSegment(int segment, int strip, uint16_t first, uint16_t count);
+    void setPattern(int segment, int pattern);
+    int getPattern(int segment) { return segments[segment].pattern; }
+    void setUserPattern(int index, const String &text);
 };
-#endif
\ No newline at end of file
+#endif
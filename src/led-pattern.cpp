@@ -0,0 +1,102 @@
+#include <led-pattern.h>
+
+// Built in patterns in LedPattern order, fixed at compile time and kept in flash
+static constexpr LedPatternSpec ledPatterns[] = {
+    solidPattern(LED_BLACK),
+    solidPattern(LED_RED),
+    solidPattern(LED_GREEN),
+    solidPattern(LED_BLUE),
+    solidPattern(LED_YELLOW),
+    solidPattern(LED_PURPLE),
+    flashPattern(LED_BLACK, LED_RED, LED_FAST_FLASH),
+    flashPattern(LED_BLACK, LED_GREEN, LED_FAST_FLASH),
+    flashPattern(LED_BLACK, LED_BLUE, LED_FAST_FLASH),
+    flashPattern(LED_BLACK, LED_YELLOW, LED_FAST_FLASH),
+    flashPattern(LED_BLACK, LED_PURPLE, LED_FAST_FLASH),
+    flashPattern(LED_RED, LED_GREEN, LED_FAST_FLASH),
+    flashPattern(LED_RED, LED_BLUE, LED_FAST_FLASH),
+    flashPattern(LED_RED, LED_YELLOW, LED_FAST_FLASH),
+    flashPattern(LED_RED, LED_PURPLE, LED_FAST_FLASH),
+    flashPattern(LED_GREEN, LED_BLUE, LED_FAST_FLASH),
+    flashPattern(LED_GREEN, LED_YELLOW, LED_FAST_FLASH),
+    flashPattern(LED_GREEN, LED_PURPLE, LED_FAST_FLASH),
+    chasePattern(LED_RED, LED_CHASE_STEP),
+    chasePattern(LED_GREEN, LED_CHASE_STEP),
+    chasePattern(LED_BLUE, LED_CHASE_STEP),
+    chasePattern(LED_YELLOW, LED_CHASE_STEP),
+    chasePattern(LED_PURPLE, LED_CHASE_STEP)
+};
+static_assert(sizeof(ledPatterns) / sizeof(ledPatterns[0]) == LED_BUILTIN_PATTERNS, "One entry per built in LedPattern");
+
+const LedPatternSpec *builtinPattern(int pattern) {
+    if (pattern < 0 || pattern >= LED_BUILTIN_PATTERNS) return nullptr;
+    return &ledPatterns[pattern];
+}
+
+// Milliseconds for one pass through the keyframes
+uint32_t patternLength(const LedPatternSpec &pattern) {
+    uint32_t length = 0;
+    for (int i = 0; i < pattern.count; i++) {
+        length += pattern.frames[i].duration;
+    }
+    return length;
+}
+
+// "<effect> <colour>[/<ms>] ...", e.g. "flash ff0000/200 0000ff/200", "breathe 0000ff/3000" or "solid ffa500".
+// Effects are solid, flash, chase, fade, breathe and comet.
+// Colours are RRGGBB hex, durations default to what the built in patterns of that kind use.
+bool parsePattern(const String &text, LedPatternSpec &pattern) {
+    String spec = text;
+    spec.trim();
+    spec.toLowerCase();
+
+    int space = spec.indexOf(' ');
+    if (space < 0) return false;
+    String effect = spec.substring(0, space);
+    uint16_t duration;
+    if (effect == "solid" || effect == "flash") {
+        pattern.effect = LED_EFFECT_FLASH;
+        duration = effect == "solid" ? LED_SOLID_REFRESH : LED_FAST_FLASH;
+    } else if (effect == "chase") {
+        pattern.effect = LED_EFFECT_CHASE;
+        duration = LED_CHASE_STEP;
+    } else if (effect == "fade") {
+        pattern.effect = LED_EFFECT_FADE;
+        duration = LED_SLOW_FLASH;
+    } else if (effect == "breathe") {
+        pattern.effect = LED_EFFECT_BREATHE;
+        duration = LED_SLOW_FLASH;
+    } else if (effect == "comet") {
+        pattern.effect = LED_EFFECT_COMET;
+        duration = LED_CHASE_STEP;
+    } else {
+        return false;
+    }
+
+    pattern.count = 0;
+    int position = space + 1;
+    while (position < (int)spec.length()) {
+        int end = spec.indexOf(' ', position);
+        if (end < 0) end = spec.length();
+        String frame = spec.substring(position, end);
+        position = end + 1;
+        if (frame.length() == 0) continue;
+        if (pattern.count == LED_MAX_KEYFRAMES) return false;
+
+        int slash = frame.indexOf('/');
+        String color = slash < 0 ? frame : frame.substring(0, slash);
+        if (color.startsWith("#")) color = color.substring(1);
+        if (color.length() != 6) return false;
+        char *parsed;
+        uint32_t value = strtoul(color.c_str(), &parsed, 16);
+        if (*parsed != '\0') return false;
+
+        long ms = duration;
+        if (slash >= 0) {
+            ms = frame.substring(slash + 1).toInt();
+            if (ms <= 0 || ms > UINT16_MAX) return false;
+        }
+        pattern.frames[pattern.count++] = { value, (uint16_t)ms };
+    }
+    return pattern.count > 0;
+}
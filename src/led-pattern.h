@@ -0,0 +1,89 @@
+#ifndef LEDPATTERN_H
+#define LEDPATTERN_H
+#include <Arduino.h>
+#include <led-strip.h>
+
+#define LED_FAST_FLASH 250
+#define LED_SLOW_FLASH 2000
+#define LED_SOLID_REFRESH 1000
+#define LED_CHASE_STEP 100
+#define LED_COMET_TAIL 8 // Pixels for a comet's tail to fade out
+
+#define LED_MAX_KEYFRAMES 8
+#define LED_USER_PATTERNS 4
+
+enum LedPattern {
+  LED_OFF, //Dark
+  RED_SOLID, //Red Solid
+  GREEN_SOLID, //Green Solid
+  BLUE_SOLID, //Blue Solid
+  YELLOW_SOLID, //Yellow Solid
+  PURPLE_SOLID, //Purple Solid
+  RED_FLASH, //Red Flash
+  GREEN_FLASH, //Green Flash
+  BLUE_FLASH, //Blue Flash
+  YELLOW_FLASH, //Yellow Flash
+  PURPLE_FLASH, //Purple Flash
+  RED_GREEN_FLASH, //Red/Green Flash
+  RED_BLUE_FLASH, //Red/Blue Flash
+  RED_YELLOW_FLASH, //Red/Yellow Flash
+  RED_PURPLE_FLASH, //Red/Purple Flash
+  GREEN_BLUE_FLASH, //Green/Blue Flash
+  GREEN_YELLOW_FLASH, //Green/Yellow Flash
+  GREEN_PURPLE_FLASH, //Green/Purple Flash
+  RED_CHASE, //Red Chase
+  GREEN_CHASE, //Green Chase
+  BLUE_CHASE, //Blue Chase
+  YELLOW_CHASE, //Yellow Chase
+  PURPLE_CHASE, //Purple Chase
+  LED_BUILTIN_PATTERNS,
+  LED_USER_PATTERN = LED_BUILTIN_PATTERNS // User patterns from config follow the built in ones
+};
+
+enum LedEffect {
+  LED_EFFECT_FLASH, // Whole strip steps through the keyframes, one keyframe is a solid colour
+  LED_EFFECT_CHASE, // Two lit pixels walk the strip, the next keyframe's colour on each lap
+  LED_EFFECT_FADE,   // Whole strip blends from each keyframe to the next over its duration
+  LED_EFFECT_BREATHE, // Whole strip swells from dark to the keyframe's colour and back, once per duration
+  LED_EFFECT_COMET    // A head glides along the strip with a fading tail, one pixel per duration
+};
+
+struct LedKeyframe {
+  uint32_t color;
+  uint16_t duration; // Milliseconds, per step for a chase
+};
+
+// A pattern is data, one renderer draws them all
+struct LedPatternSpec {
+  uint8_t effect;
+  uint8_t count;
+  LedKeyframe frames[LED_MAX_KEYFRAMES];
+};
+
+constexpr uint32_t LED_BLACK = LedStrip::Color(0, 0, 0);
+constexpr uint32_t LED_RED = LedStrip::Color(255, 0, 0);
+constexpr uint32_t LED_GREEN = LedStrip::Color(0, 255, 0);
+constexpr uint32_t LED_BLUE = LedStrip::Color(0, 0, 255);
+constexpr uint32_t LED_YELLOW = LedStrip::Color(255, 255, 0);
+constexpr uint32_t LED_PURPLE = LedStrip::Color(0, 255, 255);
+
+constexpr LedPatternSpec solidPattern(uint32_t color) {
+  return { LED_EFFECT_FLASH, 1, { { color, LED_SOLID_REFRESH } } };
+}
+
+constexpr LedPatternSpec flashPattern(uint32_t first, uint32_t second, uint16_t duration) {
+  return { LED_EFFECT_FLASH, 2, { { first, duration }, { second, duration } } };
+}
+
+constexpr LedPatternSpec chasePattern(uint32_t color, uint16_t step) {
+  return { LED_EFFECT_CHASE, 1, { { color, step } } };
+}
+
+constexpr LedPatternSpec fadePattern(uint32_t first, uint32_t second, uint16_t duration) {
+  return { LED_EFFECT_FADE, 2, { { first, duration }, { second, duration } } };
+}
+
+const LedPatternSpec *builtinPattern(int pattern);
+uint32_t patternLength(const LedPatternSpec &pattern);
+bool parsePattern(const String &text, LedPatternSpec &pattern);
+#endif
@@ -0,0 +1,229 @@
+#include <led-strip.h>
+
+// Pixel bytes through a bytes encoder, then the reset low time through a copy encoder
+struct LedStripEncoder {
+    rmt_encoder_t base;
+    rmt_encoder_handle_t bytes;
+    rmt_encoder_handle_t copy;
+    int state;
+    rmt_symbol_word_t reset;
+};
+
+static size_t led_strip_encode(rmt_encoder_t *encoder, rmt_channel_handle_t channel, const void *data, size_t size, rmt_encode_state_t *done) {
+    LedStripEncoder *led = (LedStripEncoder *)encoder;
+    rmt_encode_state_t session = RMT_ENCODING_RESET;
+    int state = RMT_ENCODING_RESET;
+    size_t encoded = 0;
+
+    if (led->state == 0) {
+        encoded += led->bytes->encode(led->bytes, channel, data, size, &session);
+        if (session & RMT_ENCODING_COMPLETE) {
+            led->state = 1;
+        }
+        if (session & RMT_ENCODING_MEM_FULL) {
+            *done = (rmt_encode_state_t)(state | RMT_ENCODING_MEM_FULL);
+            return encoded;
+        }
+    }
+    encoded += led->copy->encode(led->copy, channel, &led->reset, sizeof(led->reset), &session);
+    if (session & RMT_ENCODING_COMPLETE) {
+        led->state = 0;
+        state |= RMT_ENCODING_COMPLETE;
+    }
+    if (session & RMT_ENCODING_MEM_FULL) {
+        state |= RMT_ENCODING_MEM_FULL;
+    }
+    *done = (rmt_encode_state_t)state;
+    return encoded;
+}
+
+static esp_err_t led_strip_reset(rmt_encoder_t *encoder) {
+    LedStripEncoder *led = (LedStripEncoder *)encoder;
+    rmt_encoder_reset(led->bytes);
+    rmt_encoder_reset(led->copy);
+    led->state = 0;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_delete(rmt_encoder_t *encoder) {
+    LedStripEncoder *led = (LedStripEncoder *)encoder;
+    rmt_del_encoder(led->bytes);
+    rmt_del_encoder(led->copy);
+    free(led);
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_new_encoder(rmt_encoder_handle_t *out) {
+    LedStripEncoder *led = (LedStripEncoder *)calloc(1, sizeof(LedStripEncoder));
+    if (led == nullptr) return ESP_ERR_NO_MEM;
+    led->base.encode = led_strip_encode;
+    led->base.reset = led_strip_reset;
+    led->base.del = led_strip_delete;
+
+    rmt_bytes_encoder_config_t bits = {};
+    bits.bit0.level0 = 1;
+    bits.bit0.duration0 = LED_STRIP_T0H;
+    bits.bit0.level1 = 0;
+    bits.bit0.duration1 = LED_STRIP_T0L;
+    bits.bit1.level0 = 1;
+    bits.bit1.duration0 = LED_STRIP_T1H;
+    bits.bit1.level1 = 0;
+    bits.bit1.duration1 = LED_STRIP_T1L;
+    bits.flags.msb_first = 1;
+    esp_err_t err = rmt_new_bytes_encoder(&bits, &led->bytes);
+    if (err == ESP_OK) {
+        rmt_copy_encoder_config_t copy = {};
+        err = rmt_new_copy_encoder(&copy, &led->copy);
+    }
+    if (err != ESP_OK) {
+        if (led->bytes != NULL) rmt_del_encoder(led->bytes);
+        free(led);
+        return err;
+    }
+
+    led->reset.level0 = 0;
+    led->reset.duration0 = LED_STRIP_RESET_TICKS / 2;
+    led->reset.level1 = 0;
+    led->reset.duration1 = LED_STRIP_RESET_TICKS / 2;
+    *out = &led->base;
+    return ESP_OK;
+}
+
+bool LedStrip::newChannel(bool dma) {
+    rmt_tx_channel_config_t config = {};
+    config.gpio_num = (gpio_num_t)pin;
+    config.clk_src = RMT_CLK_SRC_DEFAULT;
+    config.resolution_hz = LED_STRIP_RMT_RESOLUTION;
+    config.mem_block_symbols = dma ? LED_STRIP_DMA_SYMBOLS : LED_STRIP_RMT_SYMBOLS;
+    config.trans_queue_depth = 1;
+    config.flags.with_dma = dma;
+    return rmt_new_tx_channel(&config, &channel) == ESP_OK;
+}
+
+// Falls back to plain RMT memory on chips without RMT DMA
+bool LedStrip::begin(uint8_t pin, uint16_t count) {
+    this->end();
+    if (count == 0) return false;
+    if (count > LED_STRIP_MAX_PIXELS) count = LED_STRIP_MAX_PIXELS;
+    this->pin = pin;
+    this->count = count;
+
+    // Whole words so fills can work four pixels (three words) at a time
+    size_t size = (count * 3 + 3) & ~3u;
+    pixels = (uint8_t *)calloc(size, 1);
+    frame = (uint8_t *)calloc(size, 1);
+    if (pixels == nullptr || frame == nullptr) {
+        LOG_ERROR("No memory for %u LED pixels", count);
+        this->end();
+        return false;
+    }
+
+    bool dma = this->newChannel(true);
+    if (!dma && !this->newChannel(false)) {
+        LOG_ERROR("Could not get an RMT channel for the LED strip on pin %u", pin);
+        this->end();
+        return false;
+    }
+    esp_err_t err = led_strip_new_encoder(&encoder);
+    if (err == ESP_OK) {
+        err = rmt_enable(channel);
+    }
+    if (err != ESP_OK) {
+        LOG_ERROR("Could not start the LED strip: 0x%x", (int)err);
+        this->end();
+        return false;
+    }
+    LOG_INFO("LED strip of %u pixels on pin %u, RMT%s", count, pin, dma ? " with DMA" : "");
+    dirty = true;
+    return true;
+}
+
+// Lets the last frame finish, then gives back the channel and buffers
+void LedStrip::end() {
+    if (channel != NULL) {
+        rmt_tx_wait_all_done(channel, -1);
+        rmt_disable(channel);
+        rmt_del_channel(channel);
+        channel = NULL;
+    }
+    if (encoder != NULL) {
+        rmt_del_encoder(encoder);
+        encoder = NULL;
+    }
+    free(pixels);
+    free(frame);
+    pixels = nullptr;
+    frame = nullptr;
+    count = 0;
+}
+
+// Gamma and brightness are applied as pixels are stored, in the strip's GRB order
+void LedStrip::scale(uint32_t color, uint8_t grb[3]) {
+    grb[0] = (ledGamma[(color >> 8) & 0xFF] * (brightness + 1)) >> 8;
+    grb[1] = (ledGamma[(color >> 16) & 0xFF] * (brightness + 1)) >> 8;
+    grb[2] = (ledGamma[color & 0xFF] * (brightness + 1)) >> 8;
+}
+
+// Marks the frame dirty only if the pixel changes
+void LedStrip::setPixelColor(uint16_t index, uint32_t color) {
+    if (index >= count) return;
+    uint8_t grb[3];
+    this->scale(color, grb);
+    uint8_t *pixel = pixels + index * 3;
+    if (memcmp(pixel, grb, 3) != 0) {
+        memcpy(pixel, grb, 3);
+        dirty = true;
+    }
+}
+
+// Four pixels are exactly three words, so the aligned middle of the range is written a word at a time
+void LedStrip::fill(uint32_t color, uint16_t first, uint16_t length) {
+    if (first >= count) return;
+    if (length > count - first) length = count - first;
+    uint16_t end = first + length;
+
+    uint16_t index = first;
+    while (index < end && (index & 3) != 0) {
+        this->setPixelColor(index++, color);
+    }
+
+    uint8_t grb[3];
+    this->scale(color, grb);
+    uint8_t run[12];
+    for (int i = 0; i < 12; i++) run[i] = grb[i % 3];
+    uint32_t words[3];
+    memcpy(words, run, sizeof(words));
+
+    uint32_t *word = (uint32_t *)(pixels + index * 3);
+    uint32_t changed = 0;
+    for (; index + 4 <= end; index += 4, word += 3) {
+        changed |= (word[0] ^ words[0]) | (word[1] ^ words[1]) | (word[2] ^ words[2]);
+        word[0] = words[0];
+        word[1] = words[1];
+        word[2] = words[2];
+    }
+    if (changed != 0) dirty = true;
+
+    while (index < end) {
+        this->setPixelColor(index++, color);
+    }
+}
+
+// Sends the framebuffer if it changed since the last frame, returns whether it did.
+// Never waits: a frame takes 30 us a pixel on the wire, about 31 ms for LED_STRIP_MAX_PIXELS, and
+// the caller holds the LED mutex. While the previous frame is still going out this one stays
+// pending and the caller tries again shortly.
+bool LedStrip::show() {
+    if (!dirty || channel == NULL) return false;
+    if (rmt_tx_wait_all_done(channel, 0) != ESP_OK) return false;
+    memcpy(frame, pixels, count * 3);
+
+    rmt_transmit_config_t transmit = {};
+    esp_err_t err = rmt_transmit(channel, encoder, frame, count * 3, &transmit);
+    if (err != ESP_OK) {
+        LOG_WARN("LED frame not sent: 0x%x", (int)err);
+        return false;
+    }
+    dirty = false;
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef LEDSTRIP_H
+#define LEDSTRIP_H
+#include <Arduino.h>
+#include <logger.h>
+#include <led-tables.h>
+#include "driver/rmt_tx.h"
+#include "driver/rmt_encoder.h"
+
+// WS2811 at 800 kHz, timed in 0.1 us RMT ticks
+#define LED_STRIP_RMT_RESOLUTION 10000000
+#define LED_STRIP_T0H 3
+#define LED_STRIP_T0L 9
+#define LED_STRIP_T1H 9
+#define LED_STRIP_T1L 3
+#define LED_STRIP_RESET_TICKS 2800 // 280 us low latches the frame, newer WS2811 batches need more than 50
+#define LED_STRIP_DMA_SYMBOLS 1024
+#define LED_STRIP_RMT_SYMBOLS 48
+#define LED_STRIP_MAX_PIXELS 1024
+
+// WS2811 strip driven by the RMT peripheral. Pixels are drawn into a framebuffer that remembers
+// whether anything changed, and show() only sends a frame when it did. The transmit runs from
+// RMT (with DMA when the chip has it), so the CPU neither waits on it nor masks interrupts.
+class LedStrip {
+  private:
+    uint8_t pin = 0;
+    uint16_t count = 0;
+    uint8_t brightness = 255;
+    uint8_t *pixels = nullptr; // GRB, the order the strip wants them on the wire
+    uint8_t *frame = nullptr;  // What RMT is sending, pixels may be redrawn meanwhile
+    bool dirty = true;
+
+    rmt_channel_handle_t channel = NULL;
+    rmt_encoder_handle_t encoder = NULL;
+
+    bool newChannel(bool dma);
+    void scale(uint32_t color, uint8_t grb[3]);
+  public:
+    bool begin(uint8_t pin, uint16_t count);
+    void end();
+    bool isStarted() { return channel != NULL; }
+    void setBrightness(uint8_t brightness) { this->brightness = brightness; }
+    void setPixelColor(uint16_t index, uint32_t color);
+    void fill(uint32_t color) { this->fill(color, 0, count); }
+    void fill(uint32_t color, uint16_t first, uint16_t length);
+    bool show();
+    bool isPending() { return dirty && channel != NULL; }
+    uint8_t getPin() { return pin; }
+    uint16_t numPixels() { return count; }
+
+    static constexpr uint32_t Color(uint8_t red, uint8_t green, uint8_t blue) {
+      return ((uint32_t)red << 16) | ((uint32_t)green << 8) | blue;
+    }
+};
+#endif
@@ -0,0 +1,61 @@
+#ifndef LEDTABLES_H
+#define LEDTABLES_H
+#include <stdint.h>
+
+// Lookup tables for the LED renderer, computed by the compiler so the frame loop is integer only.
+// The doubles below never reach the target, every table is a constant in flash.
+
+constexpr double ledTablePi = 3.14159265358979323846;
+
+// Fifth root by Newton's method, x^2.2 is x^2 times the fifth root of x
+constexpr double ledFifthRoot(double x) {
+    if (x <= 0) return 0;
+    double root = 1;
+    for (int i = 0; i < 64; i++) {
+        root -= (root * root * root * root * root - x) / (5 * root * root * root * root);
+    }
+    return root;
+}
+
+constexpr double ledCosine(double x) {
+    while (x > ledTablePi) x -= 2 * ledTablePi;
+    while (x < -ledTablePi) x += 2 * ledTablePi;
+    double term = 1;
+    double sum = 1;
+    for (int i = 1; i < 20; i++) {
+        term *= -x * x / ((2 * i - 1) * (2 * i));
+        sum += term;
+    }
+    return sum;
+}
+
+struct LedTable {
+    uint8_t values[256];
+    constexpr uint8_t operator[](uint8_t index) const { return values[index]; }
+};
+
+// Gamma 2.2, perceived brightness to PWM duty, so fades and tails dim evenly instead of jumping at the bottom
+constexpr LedTable ledGammaTable() {
+    LedTable table = {};
+    for (int i = 0; i < 256; i++) {
+        double x = i / 255.0;
+        table.values[i] = (uint8_t)(x * x * ledFifthRoot(x) * 255 + 0.5);
+    }
+    return table;
+}
+
+// One breath, (1 - cos) / 2 over a full turn, dark at both ends and full in the middle
+constexpr LedTable ledBreathTable() {
+    LedTable table = {};
+    for (int i = 0; i < 256; i++) {
+        table.values[i] = (uint8_t)((1 - ledCosine(2 * ledTablePi * i / 256)) / 2 * 255 + 0.5);
+    }
+    return table;
+}
+
+inline constexpr LedTable ledGamma = ledGammaTable();
+inline constexpr LedTable ledBreath = ledBreathTable();
+
+static_assert(ledGamma[0] == 0 && ledGamma[255] == 255, "Gamma keeps black and full");
+static_assert(ledBreath[0] == 0 && ledBreath[128] == 255, "A breath starts dark and peaks halfway");
+#endif
@@ -1,5 +1,6 @@
 #include <lldp.h>
 #include <ETH.h>
+#include "lwip/sockets.h"
 
 // W5500 register definitions for raw socket mode
 #define SnMR_MACRAW 0x04  // MAC RAW mode
@@ -8,7 +9,7 @@
 esp_eth_handle_t LLDPService::getEthHandle() {
   esp_netif_t *netif = esp_netif_get_handle_from_ifkey("ETH_DEF");
   if (netif == NULL) {
-    Serial.println("Could not get netif handle");
+    LOG_ERROR("Could not get netif handle");
     return NULL;
   }
 
@@ -18,7 +19,7 @@ esp_eth_handle_t LLDPService::getEthHandle() {
   // Get the IO driver (returns void* which is the esp_eth_handle_t)
   void *driver = esp_netif_get_io_driver(netif);
   if (driver == NULL) {
-    Serial.println("Could not get IO driver");
+    LOG_ERROR("Could not get IO driver");
     return NULL;
   }
 
@@ -26,37 +27,39 @@ esp_eth_handle_t LLDPService::getEthHandle() {
   return (esp_eth_handle_t)driver;
 }
 
-void LLDPService::init() {
+void LLDPService::init(TimerWheel &timers) {
+    this->timers = &timers;
+    sendTimer = Timer(LLDPService::lldpSendTimer, this);
+    timers.schedule(sendTimer, 0);
+
     if (eth_handle == NULL) {
         eth_handle = getEthHandle();
         if (eth_handle == NULL) {
-            Serial.println("ERROR: Could not get Ethernet handle for LLDP");
-            Serial.println("LLDP will not be available");
+            LOG_ERROR("Could not get Ethernet handle for LLDP, LLDP will not be available");
         } else {
             // Enable promiscuous mode to receive all frames including multicast
-            Serial.println("Enabling promiscuous mode...");
+            LOG_INFO("Enabling promiscuous mode...");
             bool promiscuous = true;
             esp_err_t promisc_err = esp_eth_ioctl(eth_handle, ETH_CMD_S_PROMISCUOUS, &promiscuous);
             if (promisc_err != ESP_OK) {
-                Serial.print("WARNING: Failed to enable promiscuous mode: 0x");
-                Serial.println(promisc_err, HEX);
-                Serial.println("Trying alternate approach - enabling receive all multicast...");
+                LOG_WARN("Failed to enable promiscuous mode: 0x%x", (int)promisc_err);
+                LOG_INFO("Trying alternate approach - enabling receive all multicast...");
 
                 // Try ETH_CMD_S_MULTICAST_ALL as fallback
                 bool rx_allmulti = true;
                 esp_err_t multicast_err = esp_eth_ioctl(eth_handle, (esp_eth_io_cmd_t)0x8003, &rx_allmulti);  // ETH_CMD_S_RX_ALLMULTI
                 if (multicast_err == ESP_OK) {
-                    Serial.println("SUCCESS: Receive all multicast enabled");
+                    LOG_INFO("Receive all multicast enabled");
                 } else {
-                    Serial.print("WARNING: Failed to enable multicast reception: 0x");
-                    Serial.println(multicast_err, HEX);
+                    LOG_WARN("Failed to enable multicast reception: 0x%x", (int)multicast_err);
                 }
             }
 
             esp_err_t err = esp_eth_update_input_path(eth_handle, lldpFrameReceiver, this);
             if (err != ESP_OK) {
-                Serial.print("ERROR: Failed to register LLDP frame receiver: 0x");
-                Serial.println(err, HEX);
+                LOG_ERROR("Failed to register LLDP frame receiver: 0x%x", (int)err);
+            } else {
+                frameHook = true;
             }
         }
     }
@@ -66,14 +69,17 @@ void LLDPService::update_description(String description) {
     this->description = description;
 }
 
+// Keeps its timer running while disabled, so turning LLDP back on needs nothing else
 void LLDPService::handle() {
-    if (!enabled) {
-        return;
-    }
-    if ((millis() - lastLLDPTime) > lldpInterval || lastLLDPTime == 0) {
+    PROFILE_SCOPE(PROFILE_LLDP);
+    if (enabled) {
         this->send();
-        lastLLDPTime = millis();
     }
+    timers->schedule(sendTimer, lldpInterval);
+}
+
+void LLDPService::lldpSendTimer(void *arg) {
+    ((LLDPService *)arg)->handle();
 }
 
 void LLDPService::send() {
@@ -200,12 +206,28 @@ void LLDPService::send() {
     esp_err_t err = esp_eth_transmit(eth_handle, lldpFrame, framePos);
 
     if (err == ESP_OK) {
-        Serial.println("LLDP frame sent successfully (" + String(framePos) + " bytes)");
+        LOG_DEBUG("LLDP frame sent successfully (%d bytes)", (int)framePos);
     } else {
-        Serial.println("LLDP frame send failed: " + String(err));
+        LOG_WARN("LLDP frame send failed: %d", (int)err);
     }
 }
 
+// IPv4 TCP to the wake port, unfragmented or the first fragment
+bool LLDPService::isWakeFrame(const uint8_t *frame, uint32_t length) {
+    if (length < 34 || frame[12] != 0x08 || frame[13] != 0x00 || frame[23] != IPPROTO_TCP) {
+        return false;
+    }
+    // Later fragments carry payload where the TCP header would be
+    if (((frame[20] & 0x1F) | frame[21]) != 0) {
+        return false;
+    }
+    uint32_t tcp = 14 + (frame[14] & 0x0F) * 4;
+    if (length < tcp + 4) {
+        return false;
+    }
+    return ((frame[tcp + 2] << 8) | frame[tcp + 3]) == wakePort;
+}
+
 // Static callback function for receiving Ethernet frames
 esp_err_t LLDPService::lldpFrameReceiver(esp_eth_handle_t hdl, uint8_t *buffer, uint32_t len, void *priv) {
     LLDPService *service = (LLDPService *)priv;
@@ -226,12 +248,18 @@ esp_err_t LLDPService::lldpFrameReceiver(esp_eth_handle_t hdl, uint8_t *buffer,
         return ESP_OK;
     }
 
+    // Traffic for the web server wakes the main loop, nothing else can tell it a client is waiting
+    if (service->wakeTask != NULL && service->isWakeFrame(buffer, len)) {
+        service->lastWakeFrame = millis();
+        xTaskNotifyGive(service->wakeTask);
+    }
+
     // Forward all non-LLDP packets to the network stack
     // This is critical because esp_eth_update_input_path replaces the default handler
     if (service->netif != NULL) {
         esp_err_t ret = esp_netif_receive(service->netif, buffer, len, NULL);
         if (ret != ESP_OK) {
-            Serial.println("Failed to forward packet to netif: " + String(ret));
+            LOG_WARN("Failed to forward packet to netif: %d", (int)ret);
         }
         return ret;
     }
@@ -261,7 +289,7 @@ void LLDPService::parseLLDPFrame(uint8_t *frame, uint16_t length) {
 
         // Check if we have enough data
         if (pos + tlvLength > length) {
-            Serial.println("Invalid LLDP TLV length, stopping parse");
+            LOG_WARN("Invalid LLDP TLV length, stopping parse");
             break;
         }
 
@@ -342,9 +370,6 @@ void LLDPService::parseLLDPFrame(uint8_t *frame, uint16_t length) {
         lastLLDPReceived = millis();
         lldpDataValid = true;
 
-        Serial.print("Received LLDP neighbor info: hostname=");
-        Serial.print(switchHostname);
-        Serial.print(", port=");
-        Serial.println(switchPortId);
+        LOG_INFO("Received LLDP neighbor info: hostname=%s, port=%s", switchHostname.c_str(), switchPortId.c_str());
     }
 }
\ No newline at end of file
@@ -1,18 +1,21 @@
 #ifndef LLDP_H
 #define LLDP_H
 #include <Arduino.h>
+#include <logger.h>
+#include <timer-wheel.h>
+#include <profiler.h>
+#include <idle-waits.h>
 #include "esp_eth.h"
 #include "esp_netif.h"
 #include "esp_event.h"
 #include <ETH.h>
 
-#define LLDP_INTERVAL 30000 // 30 seconds
-
 class LLDPService {
     private:
         esp_eth_handle_t eth_handle = NULL;
         esp_netif_t *netif = NULL;
-        unsigned long lastLLDPTime = 0;
+        TimerWheel *timers = nullptr;
+        Timer sendTimer;
         unsigned long lldpInterval = LLDP_INTERVAL;
 
         String &hostname;
@@ -25,15 +28,26 @@ class LLDPService {
         unsigned long lastLLDPReceived = 0;
         bool lldpDataValid = false;
 
+        // Every received frame passes through our input path, so it doubles as the web server's wakeup
+        bool frameHook = false;
+        TaskHandle_t wakeTask = NULL;
+        uint16_t wakePort = 0;
+        volatile uint32_t lastWakeFrame = 0;
+        bool isWakeFrame(const uint8_t *frame, uint32_t length);
+
         esp_eth_handle_t getEthHandle();
         void parseLLDPFrame(uint8_t *frame, uint16_t length);
         static esp_err_t lldpFrameReceiver(esp_eth_handle_t hdl, uint8_t *buffer, uint32_t len, void *priv);
+        static void lldpSendTimer(void *arg);
     public:
         bool enabled = true;
 
         LLDPService(String &h, String d) : hostname(h), description(d) {}
 
-        void init();
+        void init(TimerWheel &timers);
+        void setWakeTask(TaskHandle_t task, uint16_t tcpPort) { wakeTask = task; wakePort = tcpPort; }
+        bool hasFrameHook() { return frameHook; }
+        uint32_t getLastWakeFrame() { return lastWakeFrame; }
         void update_description(String description);
         void handle();
         void send();
@@ -43,5 +57,6 @@ class LLDPService {
         String getSwitchPortId() { return switchPortId; }
         String getSwitchPortDesc() { return switchPortDesc; }
         bool hasValidLLDPData() { return lldpDataValid && (millis() - lastLLDPReceived < 180000); } // Valid for 3 minutes
+        long getNeighborAge() { return lldpDataValid ? (long)((millis() - lastLLDPReceived) / 1000) : -1; } // Seconds, -1 before any frame
 };
 #endif
\ No newline at end of file
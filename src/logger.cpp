@@ -0,0 +1,307 @@
+#include <logger.h>
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+
+Logger logger;
+
+static const char *const levelNames[] = { "E", "W", "I", "D" };
+static const uint8_t syslogSeverities[] = { 3, 4, 6, 7 };
+
+Logger::Logger() : head(0), dropped(0) {
+    for (uint32_t i = 0; i < LOG_RING_SIZE; i++) {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    syslogMutex = xSemaphoreCreateMutex();
+    syslogHost[0] = 0;
+    hostname[0] = 0;
+}
+
+void Logger::begin() {
+    if (drainTask == NULL) {
+        xTaskCreatePinnedToCore(Logger::drain_task, "log", LOG_TASK_STACK, this, LOG_TASK_PRIORITY, &drainTask, LOG_TASK_CORE);
+    }
+}
+
+void Logger::set_syslog(String host, uint16_t port, String hostname) {
+    xSemaphoreTake(syslogMutex, portMAX_DELAY);
+    strlcpy(syslogHost, host.c_str(), sizeof(syslogHost));
+    strlcpy(this->hostname, hostname.c_str(), sizeof(this->hostname));
+    syslogPort = port != 0 ? port : LOG_SYSLOG_PORT;
+    syslogAddress = 0;
+    resolvedAt = 0;
+    xSemaphoreGive(syslogMutex);
+}
+
+// Never blocks: claims a slot, copies the arguments and publishes it, or counts a drop when full
+void Logger::log(uint8_t level, const char *format, ...) {
+    uint32_t position = head.load(std::memory_order_relaxed);
+    LogSlot *slot;
+    for (;;) {
+        slot = &ring[position & (LOG_RING_SIZE - 1)];
+        int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) - position);
+        if (diff == 0) {
+            if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            this->wake_drain();
+            return;
+        } else {
+            position = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    LogRecord &record = slot->record;
+    record.timestamp = millis();
+    record.format = format;
+    record.level = level;
+    va_list args;
+    va_start(args, format);
+    this->capture(record, format, args);
+    va_end(args);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    this->wake_drain();
+}
+
+void Logger::wake_drain() {
+    TaskHandle_t task = drainTask;
+    if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
+}
+
+// Walks the conversions once, keeping numbers as words and copying strings into the payload
+bool Logger::capture(LogRecord &record, const char *format, va_list args) {
+    record.argCount = 0;
+    record.payloadLength = 0;
+    record.specCount = 0;
+
+    for (const char *f = format; *f != 0; f++) {
+        if (*f != '%') continue;
+        f++;
+        if (*f == '%') continue;
+
+        int precision = -1;
+        while (*f != 0 && strchr("-+ #0", *f)) f++;
+        if (*f == '*') {
+            if (record.argCount >= LOG_MAX_ARGS) return false;
+            record.args[record.argCount++] = va_arg(args, int);
+            f++;
+        }
+        while (isdigit(*f)) f++;
+        if (*f == '.') {
+            f++;
+            precision = 0;
+            if (*f == '*') {
+                precision = va_arg(args, int);
+                if (record.argCount >= LOG_MAX_ARGS) return false;
+                record.args[record.argCount++] = precision;
+                f++;
+            } else {
+                while (isdigit(*f)) precision = precision * 10 + (*f++ - '0');
+            }
+        }
+        int longs = 0;
+        while (*f != 0 && strchr("hlzjt", *f)) {
+            if (*f == 'l') longs++;
+            f++;
+        }
+
+        switch (*f) {
+            case 's': {
+                const char *value = va_arg(args, const char *);
+                if (value == nullptr) value = "(null)";
+                size_t room = LOG_PAYLOAD_SIZE - record.payloadLength;
+                if (room == 0) return false;
+                size_t length = precision >= 0 ? strnlen(value, precision) : strlen(value);
+                if (length > room - 1) length = room - 1;
+                memcpy(record.payload + record.payloadLength, value, length);
+                record.payload[record.payloadLength + length] = 0;
+                record.payloadLength += length + 1;
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': {
+                if (record.argCount + 2 > LOG_MAX_ARGS) return false;
+                double value = va_arg(args, double);
+                memcpy(&record.args[record.argCount], &value, sizeof(value));
+                record.argCount += 2;
+                break;
+            }
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c': case 'p':
+                if (longs >= 2) {
+                    if (record.argCount + 2 > LOG_MAX_ARGS) return false;
+                    uint64_t value = va_arg(args, uint64_t);
+                    memcpy(&record.args[record.argCount], &value, sizeof(value));
+                    record.argCount += 2;
+                } else {
+                    if (record.argCount >= LOG_MAX_ARGS) return false;
+                    record.args[record.argCount++] = va_arg(args, uint32_t);
+                }
+                break;
+            default:
+                return false;
+        }
+        record.specCount++;
+    }
+    return true;
+}
+
+// The deferred half of printf: replays each conversion against the captured arguments
+int Logger::format(const LogRecord &record, char *out, size_t size) {
+    size_t length = 0;
+    uint8_t arg = 0;
+    uint8_t specs = 0;
+    const char *payload = record.payload;
+    char spec[16];
+
+    const char *f = record.format;
+    while (*f != 0 && length < size - 1) {
+        if (*f != '%' || f[1] == '%') {
+            out[length++] = *f;
+            f += *f == '%' ? 2 : 1;
+            continue;
+        }
+        if (specs == record.specCount) {
+            strlcpy(out + length, "...", size - length);
+            length = strlen(out);
+            break;
+        }
+
+        // Copy the conversion so snprintf sees exactly what the caller wrote
+        const char *start = f++;
+        int stars = 0;
+        int starValues[2];
+        while (*f != 0 && !strchr("sfFeEgGdiuxXocp", *f)) {
+            if (*f == '*' && stars < 2) starValues[stars++] = record.args[arg++];
+            f++;
+        }
+        char conversion = *f++;
+        size_t specLength = f - start;
+        if (specLength >= sizeof(spec)) break;
+        memcpy(spec, start, specLength);
+        spec[specLength] = 0;
+
+        char *target = out + length;
+        size_t room = size - length;
+        int written;
+        if (conversion == 's') {
+            const char *value = payload;
+            payload += strlen(payload) + 1;
+            written = stars == 2 ? snprintf(target, room, spec, starValues[0], starValues[1], value)
+                : stars == 1 ? snprintf(target, room, spec, starValues[0], value)
+                : snprintf(target, room, spec, value);
+        } else if (strchr("fFeEgG", conversion) || strstr(spec, "ll")) {
+            uint64_t bits;
+            memcpy(&bits, &record.args[arg], sizeof(bits));
+            arg += 2;
+            if (strchr("fFeEgG", conversion)) {
+                double value;
+                memcpy(&value, &bits, sizeof(value));
+                written = stars == 2 ? snprintf(target, room, spec, starValues[0], starValues[1], value)
+                    : stars == 1 ? snprintf(target, room, spec, starValues[0], value)
+                    : snprintf(target, room, spec, value);
+            } else {
+                written = stars == 2 ? snprintf(target, room, spec, starValues[0], starValues[1], bits)
+                    : stars == 1 ? snprintf(target, room, spec, starValues[0], bits)
+                    : snprintf(target, room, spec, bits);
+            }
+        } else {
+            uint32_t value = record.args[arg++];
+            written = stars == 2 ? snprintf(target, room, spec, starValues[0], starValues[1], value)
+                : stars == 1 ? snprintf(target, room, spec, starValues[0], value)
+                : snprintf(target, room, spec, value);
+        }
+        if (written < 0) break;
+        length += (size_t)written < room ? written : room - 1;
+        specs++;
+    }
+    out[length] = 0;
+    return length;
+}
+
+void Logger::drain_task(void *arg) {
+    Logger *logger = (Logger *)arg;
+    for (;;) {
+        // Woken by log() rather than polling, an idle system has nothing keeping it out of light sleep
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        logger->drain();
+    }
+}
+
+void Logger::drain() {
+    char line[LOG_LINE_SIZE];
+
+    uint32_t lost = dropped.exchange(0, std::memory_order_relaxed);
+    if (lost > 0) {
+        int length = snprintf(line, sizeof(line), "%lu log records dropped", (unsigned long)lost);
+        this->write(LOG_LEVEL_WARN, line, length, 0);
+    }
+
+    for (;;) {
+        LogSlot &slot = ring[tail & (LOG_RING_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1) break;
+
+        LogRecord &record = slot.record;
+        int prefix = snprintf(line, sizeof(line), "[%lu.%03lu] %s ", (unsigned long)(record.timestamp / 1000),
+            (unsigned long)(record.timestamp % 1000), levelNames[record.level & 3]);
+        int length = prefix + this->format(record, line + prefix, sizeof(line) - prefix);
+        uint8_t level = record.level;
+
+        // Hand the slot back before the slow part
+        slot.sequence.store(tail + LOG_RING_SIZE, std::memory_order_release);
+        tail++;
+
+        this->write(level, line, length, prefix);
+    }
+}
+
+// The collector stamps its own time, so syslog gets the line without the uptime prefix
+void Logger::write(uint8_t level, const char *line, size_t length, size_t prefix) {
+    Serial.write(line, length);
+    Serial.write("\r\n", 2);
+    this->send_syslog(level, line + prefix, length - prefix);
+}
+
+// RFC 5424 over UDP, one message per datagram so any collector can parse it (RFC 5426 3.1)
+void Logger::send_syslog(uint8_t level, const char *message, size_t length) {
+    xSemaphoreTake(syslogMutex, portMAX_DELAY);
+    if (syslogHost[0] == 0) {
+        xSemaphoreGive(syslogMutex);
+        return;
+    }
+
+    uint32_t now = millis();
+    if (syslogAddress == 0 && (resolvedAt == 0 || now - resolvedAt > LOG_SYSLOG_RESOLVE_INTERVAL)) {
+        resolvedAt = now;
+        struct hostent *host = gethostbyname(syslogHost);
+        if (host != nullptr && host->h_addrtype == AF_INET) {
+            memcpy(&syslogAddress, host->h_addr_list[0], sizeof(syslogAddress));
+        }
+    }
+    if (syslogAddress == 0) {
+        xSemaphoreGive(syslogMutex);
+        return;
+    }
+    if (syslogSocket < 0) {
+        syslogSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    }
+
+    // Facility local0
+    char datagram[LOG_LINE_SIZE + 64];
+    int header = snprintf(datagram, sizeof(datagram), "<%u>1 - %s visualalert - - - ", 16 * 8 + syslogSeverities[level & 3],
+        hostname[0] != 0 ? hostname : "-");
+    if (length > sizeof(datagram) - header) length = sizeof(datagram) - header;
+    memcpy(datagram + header, message, length);
+
+    struct sockaddr_in destination = {};
+    destination.sin_family = AF_INET;
+    destination.sin_port = htons(syslogPort);
+    destination.sin_addr.s_addr = syslogAddress;
+    int fd = syslogSocket;
+    xSemaphoreGive(syslogMutex);
+
+    if (fd >= 0) {
+        sendto(fd, datagram, header + length, MSG_DONTWAIT, (struct sockaddr *)&destination, sizeof(destination));
+    }
+}
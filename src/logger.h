@@ -0,0 +1,90 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+#include <Arduino.h>
+#include <atomic>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+// Records above this level are compiled out, -D LOG_COMPILE_LEVEL=LOG_LEVEL_INFO for release builds
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING_SIZE 32     // Records, a power of two
+#define LOG_MAX_ARGS 8       // 32-bit words of numeric arguments per record
+#define LOG_PAYLOAD_SIZE 160 // Bytes of copied string arguments per record
+#define LOG_LINE_SIZE 320
+
+#define LOG_TASK_CORE 1
+#define LOG_TASK_PRIORITY 1 // Below the loop task, output only happens when nothing else wants the CPU
+#define LOG_TASK_STACK 4096
+
+#define LOG_SYSLOG_PORT 514
+#define LOG_SYSLOG_RESOLVE_INTERVAL 60000
+
+// Format and arguments as captured on the hot path, formatted later by the drain task.
+// The format string is kept by pointer and must be a literal.
+struct LogRecord {
+    uint32_t timestamp;
+    const char *format;
+    uint8_t level;
+    uint8_t argCount;
+    uint8_t payloadLength;
+    uint8_t specCount; // Conversions captured, fewer than the format has when it was truncated
+    uint32_t args[LOG_MAX_ARGS];
+    char payload[LOG_PAYLOAD_SIZE];
+};
+
+// Bounded multi-producer queue (Vyukov), a slot is ours once its sequence matches our position
+struct LogSlot {
+    std::atomic<uint32_t> sequence;
+    LogRecord record;
+};
+
+class Logger {
+    private:
+        LogSlot ring[LOG_RING_SIZE];
+        std::atomic<uint32_t> head;
+        uint32_t tail = 0;
+        std::atomic<uint32_t> dropped;
+        TaskHandle_t drainTask = NULL;
+
+        SemaphoreHandle_t syslogMutex;
+        char syslogHost[64];
+        char hostname[32];
+        uint16_t syslogPort = LOG_SYSLOG_PORT;
+        uint32_t syslogAddress = 0;
+        uint32_t resolvedAt = 0;
+        int syslogSocket = -1;
+
+        static void drain_task(void *arg);
+        void drain();
+        void wake_drain();
+        bool capture(LogRecord &record, const char *format, va_list args);
+        int format(const LogRecord &record, char *out, size_t size);
+        void write(uint8_t level, const char *line, size_t length, size_t prefix);
+        void send_syslog(uint8_t level, const char *message, size_t length);
+
+    public:
+        volatile uint8_t level = LOG_LEVEL_INFO;
+
+        Logger();
+
+        void begin();
+        void set_syslog(String host, uint16_t port, String hostname);
+        void log(uint8_t level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+        uint32_t dropped_records() { return dropped.load(std::memory_order_relaxed); }
+};
+
+extern Logger logger;
+
+// The level check comes first so disabled records cost neither argument evaluation nor a slot
+#define LOG_AT(lvl, ...) do { if ((lvl) <= LOG_COMPILE_LEVEL && (lvl) <= logger.level) logger.log((lvl), __VA_ARGS__); } while (0)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#endif
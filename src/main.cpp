@@ -38,29 +38,38 @@ void onIPAddressLost() {
 
 void WiFiEvent(WiFiEvent_t event) {
   if (event == ARDUINO_EVENT_ETH_GOT_IP) {
-      Serial.print("ETH Got IP: ");
-      Serial.println(ETH.localIP());
-      Serial.print("Gateway: ");
-      Serial.println(ETH.gatewayIP());
+      LOG_INFO("ETH Got IP: %s", ETH.localIP().toString().c_str());
+      LOG_INFO("Gateway: %s", ETH.gatewayIP().toString().c_str());
 
       runtime.ethernetIP = ETH.localIP().toString();
 
       onIPAddressAssigned();
   } else if (event == ARDUINO_EVENT_ETH_LOST_IP || event == ARDUINO_EVENT_ETH_DISCONNECTED || event == ARDUINO_EVENT_ETH_STOP) {
-      Serial.println("ETH Lost IP");
+      LOG_WARN("ETH Lost IP");
 
       runtime.ethernetIP = "0.0.0.0";
 
       onIPAddressLost();
   }
+
+  // The loop may be asleep until its next timer
+  runtime.wake();
+}
+
+// Highest numbered line in the mask, later lines win as line 2 always did over line 1
+int topLine(uint32_t lines) {
+  return 31 - __builtin_clz(lines);
 }
 
-int getLEDPattern() {
-  if (runtime.sipLine2.is_registered() && runtime.sipLine2.is_ringing()) {
-    return runtime.line2RingPattern;
+// Pattern for an LED segment following the lines in the mask
+int getLEDPattern(uint32_t lines) {
+  uint32_t ringing = runtime.ringing_lines() & lines;
+  if (ringing) {
+    return runtime.lineRingPattern[topLine(ringing)];
   }
-  if (runtime.sipLine1.is_registered() && runtime.sipLine1.is_ringing()) {
-    return runtime.line1RingPattern;
+  uint32_t error = runtime.error_lines() & lines;
+  if (error) {
+    return runtime.lineErrorPattern[topLine(error)];
   }
   if (ETH.connected()) {
     return runtime.idlePattern;
@@ -68,90 +77,50 @@ int getLEDPattern() {
   return 0;
 }
 
-int getRelayPattern(int config) {
+int getRelayPattern(int config, uint32_t lines) {
+  // The single-line modes predate line masks and narrow the relay to that line
+  if (config == ON_WHILE_LINE1 || config == TOGGLE_WHILE_LINE1) {
+    lines = 1u << 0;
+  } else if (config == ON_WHILE_LINE2 || config == TOGGLE_WHILE_LINE2) {
+    lines = 1u << 1;
+  }
+  bool ringing = (runtime.ringing_lines() & lines) != 0;
+  bool error = (runtime.error_lines() & lines) != 0;
+
   switch(config) {
-    case RELAY_DISABLED:
-      return RELAY_OFF;
-      break;
     case ON_WHILE_RINGING:
-      if (runtime.sipLine2.is_registered() && runtime.sipLine2.is_ringing()) {
-        return RELAY_ON;
-      }
-      if (runtime.sipLine1.is_registered() && runtime.sipLine1.is_ringing()) {
-        return RELAY_ON;
-      }
-      return RELAY_OFF;
-      break;
     case ON_WHILE_LINE1:
-      if (runtime.sipLine1.is_registered() && runtime.sipLine1.is_ringing()) {
-        return RELAY_ON;
-      }
-      return RELAY_OFF;
-      break;
     case ON_WHILE_LINE2:
-      if (runtime.sipLine2.is_registered() && runtime.sipLine2.is_ringing()) {
-        return RELAY_ON;
-      }
-      return RELAY_OFF;
-      break;
+      return ringing ? RELAY_ON : RELAY_OFF;
     case ON_WHILE_ERROR:
-      if (runtime.sipLine1.is_configured() && !runtime.sipLine1.is_registered()) {
-        return RELAY_ON;
-      }
-      if (runtime.sipLine2.is_configured() && !runtime.sipLine2.is_registered()) {
-        return RELAY_ON;
-      }
-      return RELAY_OFF;
-      break;
+      return error ? RELAY_ON : RELAY_OFF;
     case TOGGLE_WHILE_RINGING:
-      if (runtime.sipLine2.is_registered() && runtime.sipLine2.is_ringing()) {
-        return TOGGLE;
-      }
-      if (runtime.sipLine1.is_registered() && runtime.sipLine1.is_ringing()) {
-        return TOGGLE;
-      }
-      return RELAY_OFF;
-      break;
     case TOGGLE_WHILE_LINE1:
-      if (runtime.sipLine1.is_registered() && runtime.sipLine1.is_ringing()) {
-        return TOGGLE;
-      }
-      return RELAY_OFF;
-      break;
     case TOGGLE_WHILE_LINE2:
-      if (runtime.sipLine2.is_registered() && runtime.sipLine2.is_ringing()) {
-        return TOGGLE;
-      }
-      return RELAY_OFF;
-      break;
+      return ringing ? TOGGLE : RELAY_OFF;
     case TOGGLE_WHILE_ERROR:
-      if (runtime.sipLine1.is_configured() && !runtime.sipLine1.is_registered()) {
-        return TOGGLE;
-      }
-      if (runtime.sipLine2.is_configured() && !runtime.sipLine2.is_registered()) {
-        return TOGGLE;
-      }
-      return RELAY_OFF;
-      break;
+      return error ? TOGGLE : RELAY_OFF;
     default:
       return RELAY_OFF;
-      break;
   }
-  return RELAY_OFF;
 }
 
 void updateLEDs() {
-  runtime.ledManager.setPattern(getLEDPattern());
+  runtime.process_line_events();
+
+  for (int i = 0; i < LED_MAX_SEGMENTS; i++) {
+    runtime.ledManager.setPattern(i, getLEDPattern(runtime.segmentLines[i]));
+  }
 
-  runtime.relay1.setState(getRelayPattern(runtime.relay1Config));
-  runtime.relay2.setState(getRelayPattern(runtime.relay2Config));
+  runtime.relay1.setState(getRelayPattern(runtime.relay1Config, runtime.relay1Lines));
+  runtime.relay2.setState(getRelayPattern(runtime.relay2Config, runtime.relay2Lines));
 
-  //One time update while we are booting
-  runtime.ledManager.handle();
+  // A pattern change has been drawn by the LED task already, it pre-empts this one
+  runtime.report_ring_latency();
 }
 
 void initEthernet() {
-  Serial.println("Initializing Ethernet...");
+  LOG_INFO("Initializing Ethernet...");
   
   WiFi.onEvent(WiFiEvent);
 
@@ -159,14 +128,14 @@ void initEthernet() {
   runtime.get_ethernet_mac(ethMac);
   esp_iface_mac_addr_set(ethMac, ESP_MAC_BASE);
 
-  Serial.println("Initializing SPI...");
+  LOG_INFO("Initializing SPI...");
   SPI.begin(ETH_SPI_SCK, ETH_SPI_MISO, ETH_SPI_MOSI);
-  Serial.println("Initializing W5500 PHY...");
+  LOG_INFO("Initializing W5500 PHY...");
   ETH.begin(ETH_PHY_TYPE, ETH_PHY_ADDR, ETH_PHY_CS, ETH_PHY_IRQ, ETH_PHY_RST, SPI);
 
   ETH.setHostname(runtime.deviceHostname.c_str());
 
-  Serial.println("Ethernet is initialized with MAC " + ETH.macAddress());
+  LOG_INFO("Ethernet is initialized with MAC %s", ETH.macAddress().c_str());
 
   updateLEDs();
   
@@ -174,14 +143,13 @@ void initEthernet() {
   int timeout = 0;
   while (!ETH.linkUp() && timeout < 20) {
     delay(500);
-    Serial.print(".");
     timeout++;
   }
   
   if (ETH.linkUp()) {
-    Serial.println("\nEthernet connected!");
+    LOG_INFO("Ethernet connected!");
   } else {
-    Serial.println("\nEthernet connection failed!");
+    LOG_ERROR("Ethernet connection failed!");
     delay(60000);
     ESP.restart();
   }
@@ -191,7 +159,9 @@ void setup() {
   Serial.begin(115200);
   delay(1000);
 
-  Serial.println("SIP Alerter is starting...");
+  // Everything after this goes through the log task, nothing on the hot paths waits on the UART
+  logger.begin();
+  LOG_INFO("SIP Alerter is starting...");
 
   runtime.init();
 
@@ -199,29 +169,46 @@ void setup() {
 
   runtime.load_configuration();
 
-  Serial.println("System MAC Address: " + runtime.get_ethernet_mac_address());
-  Serial.println("System Hostname: " + runtime.deviceHostname);
+  LOG_INFO("System MAC Address: %s", runtime.get_ethernet_mac_address().c_str());
+  LOG_INFO("System Hostname: %s", runtime.deviceHostname.c_str());
 
   initEthernet();
 
+  // The W5500 interrupt is wired to a GPIO that can wake the chip
+  runtime.power.init(ETH_PHY_IRQ);
+  runtime.power.setLightSleep(runtime.lightSleep);
+
   // Wait a bit for Ethernet to fully initialize
   delay(500);
 
   // Note: configServer.init() is now called in onIPAddressAssigned()
   // after the ESP32 receives an IP address from DHCP
 
-  runtime.lldp.init();
+  runtime.lldp.init(runtime.timers);
 
-  Serial.println("Setup complete!");
+  LOG_INFO("Setup complete!");
 }
 
 void loop() {
+  uint32_t loopStart = micros();
+
   // Handle web server
-  configServer.handle();
+  {
+    PROFILE_SCOPE(PROFILE_WEB);
+    configServer.handle();
+  }
     
   // Update LED status
-  updateLEDs();
+  {
+    PROFILE_SCOPE(PROFILE_STATUS);
+    updateLEDs();
+  }
 
-  // Handle SIP messages
+  // Handle LLDP, LEDs and relays (SIP runs in its own task)
   runtime.handle();
+
+  metrics.loopTime.observe(micros() - loopStart);
+
+  // Nothing to do until the next timer, line event or web request
+  runtime.wait_for_work();
 }
@@ -0,0 +1,102 @@
+#include <metrics.h>
+
+static const uint32_t ringLatencyBounds[] = { 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000 };
+static const uint32_t ledFrameLatenessBounds[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 16667, 50000 };
+static const uint32_t timeToRegisteredBounds[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000, 300000 };
+
+// Powers of two from 1 us, fine enough for percentiles of a loop that should take well under a millisecond
+static uint32_t loopTimeBounds[METRIC_MAX_BUCKETS];
+static const uint32_t *log2_bounds() {
+    for (int i = 0; i < METRIC_MAX_BUCKETS; i++) loopTimeBounds[i] = 1u << i;
+    return loopTimeBounds;
+}
+
+Metrics metrics;
+
+MetricHistogram::MetricHistogram(const uint32_t *bounds, uint8_t size) : count(0), sum(0) {
+    this->bounds = bounds;
+    this->size = size < METRIC_MAX_BUCKETS ? size : METRIC_MAX_BUCKETS;
+    for (int i = 0; i <= METRIC_MAX_BUCKETS; i++) {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void MetricHistogram::observe(uint32_t value) {
+    int bucket = 0;
+    while (bucket < size && value > bounds[bucket]) bucket++;
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the q-th observation, the last bound when it is past them all
+uint32_t MetricHistogram::quantile(float q) {
+    uint32_t total = 0;
+    for (int i = 0; i <= size; i++) total += counts[i].load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+
+    uint32_t rank = (uint32_t)(q * total + 0.5f);
+    if (rank < 1) rank = 1;
+    uint32_t seen = 0;
+    for (int i = 0; i < size; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) return bounds[i];
+    }
+    return bounds[size - 1];
+}
+
+void MetricHistogram::write_histogram(String &out, const char *name, const char *help, double scale) {
+    Metrics::write_header(out, name, help, "histogram");
+    char labels[32];
+    uint32_t cumulative = 0;
+    for (int i = 0; i < size; i++) {
+        cumulative += counts[i].load(std::memory_order_relaxed);
+        snprintf(labels, sizeof(labels), "le=\"%g\"", bounds[i] / scale);
+        Metrics::write_value(out, (String(name) + "_bucket").c_str(), labels, cumulative);
+    }
+    cumulative += counts[size].load(std::memory_order_relaxed);
+    Metrics::write_value(out, (String(name) + "_bucket").c_str(), "le=\"+Inf\"", cumulative);
+    Metrics::write_value(out, (String(name) + "_sum").c_str(), nullptr, sum.load(std::memory_order_relaxed) / scale);
+    Metrics::write_value(out, (String(name) + "_count").c_str(), nullptr, cumulative);
+}
+
+void MetricHistogram::write_summary(String &out, const char *name, const char *help, double scale) {
+    Metrics::write_header(out, name, help, "summary");
+    static const float quantiles[] = { 0.5f, 0.9f, 0.99f };
+    char labels[24];
+    for (float q : quantiles) {
+        snprintf(labels, sizeof(labels), "quantile=\"%g\"", q);
+        Metrics::write_value(out, name, labels, this->quantile(q) / scale);
+    }
+    Metrics::write_value(out, (String(name) + "_sum").c_str(), nullptr, sum.load(std::memory_order_relaxed) / scale);
+    Metrics::write_value(out, (String(name) + "_count").c_str(), nullptr, count.load(std::memory_order_relaxed));
+}
+
+Metrics::Metrics()
+    : ringLatency(ringLatencyBounds, sizeof(ringLatencyBounds) / sizeof(ringLatencyBounds[0])),
+      timeToRegistered(timeToRegisteredBounds, sizeof(timeToRegisteredBounds) / sizeof(timeToRegisteredBounds[0])),
+      loopTime(log2_bounds(), METRIC_MAX_BUCKETS),
+      ledFrameLateness(ledFrameLatenessBounds, sizeof(ledFrameLatenessBounds) / sizeof(ledFrameLatenessBounds[0])) {
+}
+
+void Metrics::write_header(String &out, const char *name, const char *help, const char *type) {
+    out += "# HELP " METRIC_PREFIX;
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE " METRIC_PREFIX;
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+void Metrics::write_value(String &out, const char *name, const char *labels, double value) {
+    char line[160];
+    if (labels != nullptr) {
+        snprintf(line, sizeof(line), METRIC_PREFIX "%s{%s} %.9g\n", name, labels, value);
+    } else {
+        snprintf(line, sizeof(line), METRIC_PREFIX "%s %.9g\n", name, value);
+    }
+    out += line;
+}
@@ -0,0 +1,41 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <Arduino.h>
+#include <atomic>
+
+#define METRIC_MAX_BUCKETS 24
+#define METRIC_PREFIX "visualalert_"
+
+// Fixed-bucket histogram, observations are relaxed atomic adds so any task can record without a lock
+class MetricHistogram {
+    private:
+        const uint32_t *bounds;
+        uint8_t size;
+        std::atomic<uint32_t> counts[METRIC_MAX_BUCKETS + 1]; // The last one is +Inf
+        std::atomic<uint32_t> count;
+        std::atomic<uint32_t> sum; // Wraps like any counter, scrapers treat it as a reset
+
+    public:
+        MetricHistogram(const uint32_t *bounds, uint8_t size);
+
+        void observe(uint32_t value);
+        uint32_t quantile(float q);
+        void write_histogram(String &out, const char *name, const char *help, double scale);
+        void write_summary(String &out, const char *name, const char *help, double scale);
+};
+
+class Metrics {
+    public:
+        MetricHistogram ringLatency;      // INVITE arrival to LED frame, us
+        MetricHistogram timeToRegistered; // First REGISTER to 2xx, ms
+        MetricHistogram loopTime;         // One pass of the Arduino loop, us
+        MetricHistogram ledFrameLateness; // LED frame timer deadline to the frame being drawn, us
+
+        Metrics();
+
+        static void write_header(String &out, const char *name, const char *help, const char *type);
+        static void write_value(String &out, const char *name, const char *labels, double value);
+};
+
+extern Metrics metrics;
+#endif
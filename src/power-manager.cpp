@@ -0,0 +1,73 @@
+#include <power-manager.h>
+
+void PowerManager::init(int wakePin) {
+    this->wakePin = (gpio_num_t)wakePin;
+#ifdef POWER_LIGHT_SLEEP_SUPPORTED
+    esp_sleep_enable_gpio_wakeup();
+
+    esp_pm_sleep_cbs_register_config_t callbacks = {};
+    callbacks.enter_cb = PowerManager::onSleepEnter;
+    callbacks.exit_cb = PowerManager::onSleepExit;
+    callbacks.enter_cb_user_arg = this;
+    callbacks.exit_cb_user_arg = this;
+    esp_err_t err = esp_pm_light_sleep_register_cbs(&callbacks);
+    if (err != ESP_OK) {
+        LOG_ERROR("Could not register light sleep callbacks: 0x%x", (int)err);
+    }
+#endif
+}
+
+void PowerManager::setLightSleep(bool enabled) {
+#ifdef POWER_LIGHT_SLEEP_SUPPORTED
+    // No frequency scaling, the Arduino SPI and UART drivers only recompute their dividers for setCpuFrequencyMhz()
+    int mhz = getCpuFrequencyMhz();
+    esp_pm_config_t config = {};
+    config.max_freq_mhz = mhz;
+    config.min_freq_mhz = mhz;
+    config.light_sleep_enable = enabled;
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+        LOG_ERROR("Could not configure light sleep: 0x%x", (int)err);
+        return;
+    }
+    lightSleep = enabled;
+    LOG_INFO("Light sleep %s", enabled ? "enabled" : "disabled");
+#else
+    if (enabled) {
+        LOG_WARN("Light sleep is not built in, it needs CONFIG_PM_ENABLE, CONFIG_FREERTOS_USE_TICKLESS_IDLE and CONFIG_PM_LIGHT_SLEEP_CALLBACKS");
+    }
+#endif
+}
+
+// Both halves are updated with the scheduler stopped, so re-read until they agree
+uint64_t PowerManager::getSleptMicros() {
+    uint64_t first;
+    uint64_t second;
+    do {
+        first = sleptMicros;
+        second = sleptMicros;
+    } while (first != second);
+    return first;
+}
+
+// The W5500 driver's falling-edge interrupt cannot wake the chip, so the pin is a low-level wakeup
+// only while asleep. A frame that arrives meanwhile holds the line low, which leaves the interrupt
+// pending for the driver once we are back on the edge trigger.
+esp_err_t IRAM_ATTR PowerManager::onSleepEnter(int64_t sleepTime, void *arg) {
+    PowerManager *power = (PowerManager *)arg;
+    if (power->wakePin != GPIO_NUM_NC) {
+        gpio_wakeup_enable(power->wakePin, GPIO_INTR_LOW_LEVEL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t IRAM_ATTR PowerManager::onSleepExit(int64_t sleepTime, void *arg) {
+    PowerManager *power = (PowerManager *)arg;
+    if (power->wakePin != GPIO_NUM_NC) {
+        gpio_wakeup_disable(power->wakePin);
+        gpio_set_intr_type(power->wakePin, GPIO_INTR_NEGEDGE);
+    }
+    power->sleptMicros += sleepTime;
+    power->sleepCount++;
+    return ESP_OK;
+}
@@ -0,0 +1,39 @@
+#ifndef POWERMANAGER_H
+#define POWERMANAGER_H
+#include <Arduino.h>
+#include <logger.h>
+#include "sdkconfig.h"
+#include "driver/gpio.h"
+#include "esp_sleep.h"
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+// Automatic light sleep needs power management, tickless idle and the sleep callbacks in sdkconfig.
+// The callbacks are not optional, they are what lets the W5500 interrupt wake us.
+#if defined(CONFIG_PM_ENABLE) && defined(CONFIG_FREERTOS_USE_TICKLESS_IDLE) && defined(CONFIG_PM_LIGHT_SLEEP_CALLBACKS)
+#define POWER_LIGHT_SLEEP_SUPPORTED 1
+#endif
+
+// Lets the chip light sleep whenever every task is blocked, waking on the W5500 interrupt or the
+// next FreeRTOS timeout. Loop timers and select() deadlines are what bound how long it sleeps.
+class PowerManager {
+  private:
+    gpio_num_t wakePin = GPIO_NUM_NC;
+    bool lightSleep = false;
+
+    // Written by the sleep callbacks with the scheduler stopped, read anywhere
+    volatile uint64_t sleptMicros = 0;
+    volatile uint32_t sleepCount = 0;
+
+    static esp_err_t onSleepEnter(int64_t sleepTime, void *arg);
+    static esp_err_t onSleepExit(int64_t sleepTime, void *arg);
+  public:
+    void init(int wakePin);
+    void setLightSleep(bool enabled);
+    bool isLightSleep() { return lightSleep; }
+
+    uint64_t getSleptMicros();
+    uint32_t getSleepCount() { return sleepCount; }
+};
+#endif
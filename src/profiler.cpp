@@ -0,0 +1,89 @@
+#include <profiler.h>
+
+#ifdef PROFILER_ENABLED
+Profiler profiler;
+
+static const char *const sectionNames[PROFILE_SECTIONS] = { "web", "sip", "lldp", "status", "led", "relay" };
+
+Profiler::Profiler() {
+    memset(sections, 0, sizeof(sections));
+    for (int i = 0; i < PROFILE_SECTIONS; i++) {
+        sections[i].min = UINT32_MAX;
+    }
+}
+
+const char *Profiler::section_name(uint8_t section) {
+    return section < PROFILE_SECTIONS ? sectionNames[section] : "";
+}
+
+// 0-3 exactly, then the octave and the two bits below its leading one
+uint8_t Profiler::bucket_of(uint32_t cycles) {
+    if (cycles < 4) return cycles;
+    int octave = 31 - __builtin_clz(cycles);
+    return (octave - 1) * 4 + ((cycles >> (octave - 2)) & 3);
+}
+
+uint32_t Profiler::bucket_upper(uint8_t bucket) {
+    if (bucket < 4) return bucket;
+    int octave = bucket / 4 + 1;
+    uint32_t lower = (uint32_t)(4 + bucket % 4) << (octave - 2);
+    return lower + ((1u << (octave - 2)) - 1);
+}
+
+void Profiler::record(uint8_t section, uint32_t cycles) {
+    ProfileSection &s = sections[section];
+    if (s.resetPending) {
+        memset(s.buckets, 0, sizeof(s.buckets));
+        s.count = 0;
+        s.total = 0;
+        s.max = 0;
+        s.min = UINT32_MAX;
+        s.resetPending = false;
+    }
+    s.count++;
+    s.total += cycles;
+    if (cycles < s.min) s.min = cycles;
+    if (cycles > s.max) s.max = cycles;
+    s.buckets[bucket_of(cycles)]++;
+}
+
+void Profiler::reset() {
+    for (int i = 0; i < PROFILE_SECTIONS; i++) {
+        sections[i].resetPending = true;
+    }
+}
+
+// Per section min/avg/p99/max in microseconds, for the diagnostics page
+String Profiler::json() {
+    float cyclesPerMicro = ESP.getCpuFreqMHz();
+    String out = "[";
+    char entry[160];
+    for (int i = 0; i < PROFILE_SECTIONS; i++) {
+        ProfileSection &s = sections[i];
+        uint32_t count = s.resetPending ? 0 : s.count;
+
+        uint32_t p99 = 0;
+        if (count > 0) {
+            uint32_t rank = count - count / 100;
+            uint32_t seen = 0;
+            for (int b = 0; b < PROFILE_BUCKETS; b++) {
+                seen += s.buckets[b];
+                if (seen >= rank) {
+                    p99 = bucket_upper(b);
+                    break;
+                }
+            }
+            if (p99 > s.max) p99 = s.max;
+        }
+
+        snprintf(entry, sizeof(entry), "%s{\"name\":\"%s\",\"count\":%lu,\"min\":%.1f,\"avg\":%.1f,\"p99\":%.1f,\"max\":%.1f}",
+            i > 0 ? "," : "", sectionNames[i], (unsigned long)count,
+            count > 0 ? s.min / cyclesPerMicro : 0.0f,
+            count > 0 ? (float)(s.total / count) / cyclesPerMicro : 0.0f,
+            p99 / cyclesPerMicro,
+            count > 0 ? s.max / cyclesPerMicro : 0.0f);
+        out += entry;
+    }
+    return out + "]";
+}
+#endif
@@ -0,0 +1,67 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <Arduino.h>
+
+// Build with -D PROFILER_ENABLED to time each subsystem's handle() in CPU cycles,
+// without it the scopes below compile to nothing
+#ifdef PROFILER_ENABLED
+#include "esp_cpu.h"
+
+// Log-linear buckets, four per power of two, so p99 is within a quarter octave
+#define PROFILE_BUCKETS 124
+
+enum ProfileSectionId {
+    PROFILE_WEB,
+    PROFILE_SIP,
+    PROFILE_LLDP,
+    PROFILE_STATUS, // Line state to LED pattern
+    PROFILE_LED,
+    PROFILE_RELAY,
+    PROFILE_SECTIONS
+};
+
+// Each section is written by one task only, readers tolerate a sample landing mid-read
+struct ProfileSection {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[PROFILE_BUCKETS];
+    volatile bool resetPending; // Set by the reader, honoured by the writer before its next sample
+};
+
+class Profiler {
+    private:
+        ProfileSection sections[PROFILE_SECTIONS];
+
+        static uint8_t bucket_of(uint32_t cycles);
+        static uint32_t bucket_upper(uint8_t bucket);
+
+    public:
+        Profiler();
+
+        void record(uint8_t section, uint32_t cycles);
+        void reset();
+        static const char *section_name(uint8_t section);
+        String json();
+};
+
+extern Profiler profiler;
+
+class ProfileScope {
+    private:
+        uint8_t section;
+        uint32_t start;
+
+    public:
+        ProfileScope(uint8_t section) : section(section), start(esp_cpu_get_cycle_count()) {}
+        ~ProfileScope() { profiler.record(section, esp_cpu_get_cycle_count() - start); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(section) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(section)
+#else
+#define PROFILE_SCOPE(section)
+#endif
+#endif
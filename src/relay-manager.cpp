@@ -4,49 +4,50 @@ RelayManager::RelayManager(int relayPin) {
     this->relayPin = relayPin;
 }
 
+// A new state applies straight away rather than at the old state's next step
 void RelayManager::setState(int state) {
     if (state == relayState) { return; }
-    lastTick = 0;
     relayStage = 0;
     relayState = state;
-    Serial.println("Relay pattern changed to " + String(relayState));
+    LOG_DEBUG("Relay pattern changed to %d", relayState);
+    if (timers != nullptr) {
+        this->handle();
+    }
 }
 
-void RelayManager::init() {
+void RelayManager::init(TimerWheel &timers) {
+    this->timers = &timers;
+    stepTimer = Timer(RelayManager::onStepTimer, this);
     pinMode(this->relayPin, OUTPUT);
+    this->timers->schedule(stepTimer, 0);
 }
 
+// Drives the pin for the current step and schedules the next one
 void RelayManager::handle() {
+    PROFILE_SCOPE(PROFILE_RELAY);
     switch (relayState) {
         case RELAY_OFF:
-            if (millis() - lastTick > 1000) {
-                digitalWrite(this->relayPin, LOW);
-                lastTick = millis();
-            }
+            digitalWrite(this->relayPin, LOW);
             break;
         case RELAY_ON:
-            if (millis() - lastTick > 1000) {
-                digitalWrite(this->relayPin, HIGH);
-                lastTick = millis();
-            }
+            digitalWrite(this->relayPin, HIGH);
             break;
         case TOGGLE:
-            if (millis() - lastTick > 1000) {
-                if (relayStage == 0) {
-                    digitalWrite(this->relayPin, HIGH);
-                    relayStage = 1;
-                } else {
-                    digitalWrite(this->relayPin, LOW);
-                    relayStage = 0;
-                }
-                lastTick = millis();
+            if (relayStage == 0) {
+                digitalWrite(this->relayPin, HIGH);
+                relayStage = 1;
+            } else {
+                digitalWrite(this->relayPin, LOW);
+                relayStage = 0;
             }
             break;
         default:
-            if (millis() - lastTick > 1000) {
-                Serial.println("Bad relay pattern in memory!");
-            }
-            lastTick = millis();
+            LOG_ERROR("Bad relay pattern in memory!");
             break;
     }
-}
\ No newline at end of file
+    timers->schedule(stepTimer, RELAY_STEP_INTERVAL);
+}
+
+void RelayManager::onStepTimer(void *arg) {
+    ((RelayManager *)arg)->handle();
+}
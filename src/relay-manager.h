@@ -1,6 +1,11 @@
 #ifndef RELAYMANAGER_H
 #define RELAYMANAGER_H
 #include <Arduino.h>
+#include <logger.h>
+#include <timer-wheel.h>
+#include <profiler.h>
+
+#define RELAY_STEP_INTERVAL 1000 // Toggle period, and how often a steady state is re-asserted
 
 enum RelayConfiguration {
   RELAY_DISABLED,
@@ -24,14 +29,17 @@ class RelayManager {
   private:
     int relayPin = 0;
     
-    long lastTick = 0;
+    TimerWheel *timers = nullptr;
+    Timer stepTimer;
     int relayStage = 0;
+
+    static void onStepTimer(void *arg);
   public:
     int relayState = RELAY_DISABLED;
 
     RelayManager(int relayPin);
     void setState(int state);
-    void init();
+    void init(TimerWheel &timers);
     void handle();
 };
 #endif
\ No newline at end of file
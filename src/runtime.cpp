@@ -1,5 +1,6 @@
 #include <runtime.h>
 #include "esp_random.h"
+#include "esp_timer.h"
 
 void Runtime::load_configuration() {
     String ethernetMAC = get_ethernet_mac_address();
@@ -7,58 +8,116 @@ void Runtime::load_configuration() {
 
     deviceHostname = configStore.get_string("hostname", "VisualAlert-" + ethernetMAC.substring(ethernetMAC.length() - 5, ethernetMAC.length()));
 
-    sipLine1.update_credentials(configStore.get_string("sipServer1"), configStore.get_integer("sipPort1"),
-        configStore.get_string("sipUsername1"), configStore.get_string("sipPassword1"), configStore.get_string("sipRealm1"));
-    sipLine2.update_credentials(configStore.get_string("sipServer2"), configStore.get_integer("sipPort2"),
-        configStore.get_string("sipUsername2"), configStore.get_string("sipPassword2"), configStore.get_string("sipRealm2"));
+    // Per-line keys carry the 1-based line number, sipServer1, sipServer2, ...
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        String n = String(i + 1);
+        configure_line(i, configStore.get_string("sipServer" + n), configStore.get_integer("sipPort" + n),
+            configStore.get_string("sipUsername" + n), configStore.get_string("sipPassword" + n), configStore.get_string("sipRealm" + n),
+            configStore.get_integer("sipTransport" + n, SIP_TRANSPORT_UDP), configStore.get_integer("sipMode" + n, SIP_MODE_REGISTER),
+            configStore.get_string("sipMonitor" + n), configStore.get_boolean("sipVerify" + n, true));
+    }
 
     mDNSEnabled = configStore.get_boolean("mdnsEnabled", true);
+    lightSleep = configStore.get_boolean("lightSleep", true);
     lldp.enabled = configStore.get_boolean("lldpEnabled", true);
 
     webPassword = configStore.get_string("webPassword", "admin");
 
+    syslogServer = configStore.get_string("syslogServer");
+    syslogPort = configStore.get_integer("syslogPort", LOG_SYSLOG_PORT);
+    logLevel = configStore.get_integer("logLevel", LOG_LEVEL_INFO);
+    configure_logging();
+
     // Load LED pattern configurations
     idlePattern = configStore.get_integer("idlePattern", GREEN_SOLID);
-    line1RingPattern = configStore.get_integer("line1RingPattern", YELLOW_FLASH);
-    line2RingPattern = configStore.get_integer("line2RingPattern", BLUE_FLASH);
-    line1ErrorPattern = configStore.get_integer("line1ErrorPattern", RED_SOLID);
-    line2ErrorPattern = configStore.get_integer("line2ErrorPattern", RED_SOLID);
+    static const int defaultRingPatterns[] = { YELLOW_FLASH, BLUE_FLASH, GREEN_FLASH, PURPLE_FLASH, RED_FLASH };
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        String n = String(i + 1);
+        lineRingPattern[i] = configStore.get_integer("ringPattern" + n, defaultRingPatterns[i % 5]);
+        lineErrorPattern[i] = configStore.get_integer("errorPattern" + n, RED_SOLID);
+    }
+    for (int i = 0; i < LED_USER_PATTERNS; i++) {
+        userPatterns[i] = configStore.get_string("userPattern" + String(i + 1));
+        ledManager.setUserPattern(i, userPatterns[i]);
+    }
+
+    // One strip on the original pin with one segment for every line unless configured otherwise
+    for (int i = 0; i < LED_MAX_STRIPS; i++) {
+        String n = String(i + 1);
+        ledPin[i] = configStore.get_integer("ledPin" + n, i == 0 ? WS2811_PIN : -1);
+        ledCount[i] = configStore.get_integer("ledCount" + n, i == 0 ? WS2811_COUNT : 0);
+    }
+    for (int i = 0; i < LED_MAX_SEGMENTS; i++) {
+        String n = String(i + 1);
+        segmentStrip[i] = configStore.get_integer("segStrip" + n, 0);
+        segmentFirst[i] = configStore.get_integer("segFirst" + n, 0);
+        segmentCount[i] = configStore.get_integer("segCount" + n, i == 0 ? LED_STRIP_MAX_PIXELS : 0);
+        segmentLines[i] = configStore.get_integer("segLines" + n, SIP_ALL_LINES);
+    }
+    configure_leds();
 
     // Load relay configurations
     relay1Config = configStore.get_integer("relay1Config", ON_WHILE_LINE1);
     relay2Config = configStore.get_integer("relay2Config", ON_WHILE_LINE2);
+    relay1Lines = configStore.get_integer("relay1Lines", SIP_ALL_LINES);
+    relay2Lines = configStore.get_integer("relay2Lines", SIP_ALL_LINES);
 }
 
 void Runtime::save_configuration() {
     configStore.put_string("hostname", deviceHostname);
 
-    configStore.put_string("sipServer1", sipLine1.sipServer);
-    configStore.put_integer("sipPort1", sipLine1.sipPort);
-    configStore.put_string("sipUsername1", sipLine1.sipUsername);
-    configStore.put_string("sipPassword1", sipLine1.sipPassword);
-    configStore.put_string("sipRealm1", sipLine1.sipRealm);
-
-    configStore.put_string("sipServer2", sipLine2.sipServer);
-    configStore.put_integer("sipPort2", sipLine2.sipPort);
-    configStore.put_string("sipUsername2", sipLine2.sipUsername);
-    configStore.put_string("sipPassword2", sipLine2.sipPassword);
-    configStore.put_string("sipRealm2", sipLine2.sipRealm);
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        String n = String(i + 1);
+        SIPClient &line = sip_line(i);
+        configStore.put_string("sipServer" + n, line.sipServer);
+        configStore.put_integer("sipPort" + n, line.sipPort);
+        configStore.put_string("sipUsername" + n, line.sipUsername);
+        configStore.put_string("sipPassword" + n, line.sipPassword);
+        configStore.put_string("sipRealm" + n, line.sipRealm);
+        configStore.put_integer("sipTransport" + n, line.sipTransport);
+        configStore.put_integer("sipMode" + n, line.sipMode);
+        configStore.put_string("sipMonitor" + n, line.sipMonitor);
+        configStore.put_boolean("sipVerify" + n, line.sipVerify);
+    }
 
     configStore.put_boolean("lldpEnabled", lldp.enabled);
     configStore.put_boolean("mdnsEnabled", mDNSEnabled);
+    configStore.put_boolean("lightSleep", lightSleep);
 
     configStore.put_string("webPassword", webPassword);
 
+    configStore.put_string("syslogServer", syslogServer);
+    configStore.put_integer("syslogPort", syslogPort);
+    configStore.put_integer("logLevel", logLevel);
+
     // Save LED pattern configurations
     configStore.put_integer("idlePattern", idlePattern);
-    configStore.put_integer("line1RingPattern", line1RingPattern);
-    configStore.put_integer("line2RingPattern", line2RingPattern);
-    configStore.put_integer("line1ErrorPattern", line1ErrorPattern);
-    configStore.put_integer("line2ErrorPattern", line2ErrorPattern);
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        String n = String(i + 1);
+        configStore.put_integer("ringPattern" + n, lineRingPattern[i]);
+        configStore.put_integer("errorPattern" + n, lineErrorPattern[i]);
+    }
+    for (int i = 0; i < LED_USER_PATTERNS; i++) {
+        configStore.put_string("userPattern" + String(i + 1), userPatterns[i]);
+    }
+    for (int i = 0; i < LED_MAX_STRIPS; i++) {
+        String n = String(i + 1);
+        configStore.put_integer("ledPin" + n, ledPin[i]);
+        configStore.put_integer("ledCount" + n, ledCount[i]);
+    }
+    for (int i = 0; i < LED_MAX_SEGMENTS; i++) {
+        String n = String(i + 1);
+        configStore.put_integer("segStrip" + n, segmentStrip[i]);
+        configStore.put_integer("segFirst" + n, segmentFirst[i]);
+        configStore.put_integer("segCount" + n, segmentCount[i]);
+        configStore.put_integer("segLines" + n, segmentLines[i]);
+    }
 
     // Save relay configurations
     configStore.put_integer("relay1Config", relay1Config);
     configStore.put_integer("relay2Config", relay2Config);
+    configStore.put_integer("relay1Lines", relay1Lines);
+    configStore.put_integer("relay2Lines", relay2Lines);
 
     ETH.setHostname(deviceHostname.c_str());
 }
@@ -67,34 +126,163 @@ void Runtime::init() {
     // Enable the internal voltage reference as random seed
     // Disables WiFi and BLE
     bootloader_random_enable();
-    Serial.println("Cryptographic RNG initialized with ESP32 hardware RNG");
+    LOG_INFO("Cryptographic RNG initialized with ESP32 hardware RNG");
 
     configStore.init();
-    Serial.println("ConfigStore initialized.");
+    LOG_INFO("ConfigStore initialized.");
 
     ledManager.init();
-    Serial.println("LED Manager initialized.");
+    LOG_INFO("LED Manager initialized.");
+
+    relay1.init(timers);
+    relay2.init(timers);
+    LOG_INFO("Relay Manager initialized.");
+
+    loopTask = xTaskGetCurrentTaskHandle();
+    lldp.setWakeTask(loopTask, 80);
+
+    sipEndpoint.capture.begin();
+    lineEvents = xQueueCreate(SIP_EVENT_QUEUE_LENGTH, sizeof(SIPLineEvent));
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        sip_line(i).set_event_queue(lineEvents, i, loopTask);
+        sipEndpoint.add_line(&sip_line(i));
+    }
+    SIPResolver::begin(SIP_MAX_LINES, SIPEndpoint::wake, &sipEndpoint);
+    xTaskCreatePinnedToCore(Runtime::sip_task, "sip", SIP_TASK_STACK, this, SIP_TASK_PRIORITY, &sipTask, SIP_TASK_CORE);
+    LOG_INFO("SIP task started.");
+}
+
+void Runtime::sip_task(void *arg) {
+    Runtime *runtime = (Runtime *)arg;
+    for (;;) {
+        runtime->handle_sip();
+    }
+}
 
-    relay1.init();
-    relay2.init();
-    Serial.println("Relay Manager initialized.");
+// Blocks until the SIP socket or a line connection is ready, another task wakes us or a line deadline passes
+void Runtime::handle_sip() {
+    fd_set readable;
+    fd_set writable;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    int maxFd = sipEndpoint.socket_fd();
+    if (maxFd >= 0) {
+        FD_SET(maxFd, &readable);
+    }
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        maxFd = sip_line(i).watch(&readable, &writable, maxFd);
+    }
+
+    if (maxFd < 0) {
+        vTaskDelay(pdMS_TO_TICKS(SIP_TASK_TIMEOUT_MS));
+        return;
+    }
+    int wakeFd = sipEndpoint.wake_fd();
+    if (wakeFd >= 0) {
+        FD_SET(wakeFd, &readable);
+        if (wakeFd > maxFd) maxFd = wakeFd;
+    }
+
+    uint32_t now = millis();
+    uint32_t wait = SIP_TASK_TIMEOUT_MS;
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        wait = sip_line(i).next_timeout(now, wait);
+    }
+
+    struct timeval timeout = { (time_t)(wait / 1000), (suseconds_t)((wait % 1000) * 1000) };
+    if (select(maxFd + 1, &readable, &writable, NULL, &timeout) < 0) {
+        // Socket closed underneath us by ip_end()
+        vTaskDelay(pdMS_TO_TICKS(10));
+        return;
+    }
+    if (wakeFd >= 0 && FD_ISSET(wakeFd, &readable)) {
+        sipEndpoint.clear_wake();
+    }
+
+    // Only the work after select() returns, the wait itself is not SIP's time
+    PROFILE_SCOPE(PROFILE_SIP);
+    sipEndpoint.receive();
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        sip_line(i).handle();
+    }
 }
 
+// Applies queued line state changes, returns true if anything changed
+bool Runtime::process_line_events() {
+    bool changed = false;
+    SIPLineEvent event;
+    while (xQueueReceive(lineEvents, &event, 0) == pdTRUE) {
+        if (event.line >= SIP_MAX_LINES) continue;
+        uint32_t bit = 1u << event.line;
+        switch (event.type) {
+            case SIP_EVENT_REGISTERED:
+                registeredLines |= bit;
+                break;
+            case SIP_EVENT_UNREGISTERED:
+                registeredLines &= ~bit;
+                break;
+            case SIP_EVENT_RINGING:
+                ringingLines |= bit;
+                if (pendingRingTimestamp == 0) {
+                    pendingRingTimestamp = event.timestamp;
+                }
+                break;
+            case SIP_EVENT_IDLE:
+                ringingLines &= ~bit;
+                break;
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+// Called once the LED frame reflecting a ring event has been pushed
+void Runtime::report_ring_latency() {
+    if (pendingRingTimestamp == 0) return;
+    lastRingLatency = micros() - pendingRingTimestamp;
+    if (lastRingLatency > maxRingLatency) {
+        maxRingLatency = lastRingLatency;
+    }
+    pendingRingTimestamp = 0;
+    metrics.ringLatency.observe(lastRingLatency);
+    LOG_INFO("INVITE to LED latency: %lu us (max %lu us)", (unsigned long)lastRingLatency, (unsigned long)maxRingLatency);
+}
+
+// Runs whatever LLDP and relay steps have come due, LED frames are drawn by their own task
 void Runtime::handle() {
-    sipLine1.handle();
-    sipLine2.handle();
+    timers.advance();
+}
 
-    lldp.handle();
+// Sleeps until the next timer or a notification from a line event, web traffic or a network change.
+// While every task is blocked like this the chip can light sleep.
+void Runtime::wait_for_work() {
+    uint32_t limit = LOOP_IDLE_MAX_MS;
+    if (!lldp.hasFrameHook() || millis() - lldp.getLastWakeFrame() < LOOP_WEB_LINGER_MS) {
+        limit = LOOP_WEB_POLL_MS;
+    }
+    uint32_t timeout = timers.next_timeout();
+    if (timeout > limit) {
+        timeout = limit;
+    }
+    // Round up, pdMS_TO_TICKS() truncates anything under a tick to a busy spin
+    TickType_t ticks = (timeout + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
 
-    ledManager.handle();
+    int64_t start = esp_timer_get_time();
+    ulTaskNotifyTake(pdTRUE, ticks);
+    idleMicros += esp_timer_get_time() - start;
+}
 
-    relay1.handle();
-    relay2.handle();
+void Runtime::wake() {
+    if (loopTask != NULL) {
+        xTaskNotifyGive(loopTask);
+    }
 }
 
 void Runtime::ip_begin() {
-    sipLine1.init();
-    sipLine2.init();
+    sipEndpoint.begin();
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        sip_line(i).init();
+    }
 
     if (mDNSEnabled) {
         MDNS.end();
@@ -104,21 +292,77 @@ void Runtime::ip_begin() {
         MDNS.addService("visualalert", "_tcp", 80);
     }
 
-    if (sipLine1.is_configured() && !sipLine1.is_registered()) {
-        sipLine1.begin_registration();
-    }
-    if (sipLine2.is_configured() && !sipLine2.is_registered()) {
-        sipLine2.begin_registration();
+    // Randomised first REGISTER so a building full of units does not register in the same second
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        SIPClient &line = sip_line(i);
+        if (line.is_configured() && !line.is_registered()) {
+            line.schedule_registration(sip_register_startup());
+        }
     }
 }
 
 void Runtime::ip_end() {
-    sipLine1.end();
-    sipLine2.end();
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        sip_line(i).end();
+    }
+    sipEndpoint.end();
 
     MDNS.end();
 }
 
+void Runtime::configure_leds() {
+    for (int i = 0; i < LED_MAX_STRIPS; i++) {
+        ledManager.configureStrip(i, ledPin[i], constrain(ledCount[i], 0, LED_STRIP_MAX_PIXELS));
+    }
+    for (int i = 0; i < LED_MAX_SEGMENTS; i++) {
+        ledManager.configureSegment(i, segmentStrip[i], constrain(segmentFirst[i], 0, LED_STRIP_MAX_PIXELS),
+            constrain(segmentCount[i], 0, LED_STRIP_MAX_PIXELS));
+    }
+}
+
+void Runtime::configure_logging() {
+    logger.level = constrain(logLevel, LOG_LEVEL_ERROR, LOG_LEVEL_DEBUG);
+    logger.set_syslog(syslogServer, syslogPort, deviceHostname);
+}
+
+// Applies new credentials and keeps the configured-lines mask in step
+void Runtime::configure_line(int line, String sipServer, int sipPort, String sipUsername, String sipPassword, String sipRealm, int sipTransport,
+    int sipMode, String sipMonitor, bool sipVerify) {
+    SIPClient &client = sip_line(line);
+    client.update_credentials(sipServer, sipPort, sipUsername, sipPassword, sipRealm, sipTransport, sipMode, sipMonitor, sipVerify);
+    if (client.is_configured()) {
+        configuredLines |= 1u << line;
+    } else {
+        configuredLines &= ~(1u << line);
+    }
+}
+
+// "1,3,5" to a mask with bits 0, 2 and 4 set, empty means every line
+uint32_t Runtime::parse_line_mask(const String &lines) {
+    String tokens[SIP_MAX_LINES];
+    int count = split_string(lines, ',', tokens, SIP_MAX_LINES);
+    uint32_t mask = 0;
+    for (int i = 0; i < count; i++) {
+        int line = tokens[i].toInt();
+        if (line >= 1 && line <= SIP_MAX_LINES) {
+            mask |= 1u << (line - 1);
+        }
+    }
+    return mask != 0 ? mask : SIP_ALL_LINES;
+}
+
+String Runtime::format_line_mask(uint32_t mask) {
+    if ((mask & SIP_ALL_LINES) == SIP_ALL_LINES) return "";
+    String lines = "";
+    for (int i = 0; i < SIP_MAX_LINES; i++) {
+        if (mask & (1u << i)) {
+            if (lines.length() > 0) lines += ",";
+            lines += String(i + 1);
+        }
+    }
+    return lines;
+}
+
 int Runtime::get_srandom_byte() {
     return esp_random();
 }
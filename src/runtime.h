@@ -7,6 +7,10 @@
 #include <ESPmDNS.h>
 #include <led-manager.h>
 #include <relay-manager.h>
+#include <profiler.h>
+#include <timer-wheel.h>
+#include <power-manager.h>
+#include <idle-waits.h>
 #include "esp_mac.h"
 extern "C" {
 #include "bootloader_random.h"
@@ -17,39 +21,100 @@ extern "C" {
 #define RELAY1 6
 #define RELAY2 5
 
+#define SIP_TASK_CORE 0 // lwIP runs on the PRO core
+#define SIP_TASK_PRIORITY 5
+#define SIP_TASK_STACK 8192
+#define SIP_EVENT_QUEUE_LENGTH 16
+
 class Runtime {
     public:
         ConfigStore configStore;
 
+        // Deadlines for everything the main loop drives, only touched from the loop task
+        TimerWheel timers;
+
         String deviceHostname = "VisualAlert-FFFFF";
         String ethernetIP = "0.0.0.0";
 
         int idlePattern = GREEN_SOLID;
-        int line1RingPattern = RED_CHASE;
-        int line2RingPattern = BLUE_CHASE;
-        int line1ErrorPattern = RED_SOLID;
-        int line2ErrorPattern = RED_SOLID;
+        int lineRingPattern[SIP_MAX_LINES];
+        int lineErrorPattern[SIP_MAX_LINES];
+        String userPatterns[LED_USER_PATTERNS]; // Pattern text, see parsePattern()
         LedManager ledManager;
 
+        // Strips are off with no pin or no length. Segments follow the lines in their mask like the relays do,
+        // a segment longer than its strip stops at the end.
+        int ledPin[LED_MAX_STRIPS];
+        int ledCount[LED_MAX_STRIPS];
+        int segmentStrip[LED_MAX_SEGMENTS];
+        int segmentFirst[LED_MAX_SEGMENTS];
+        int segmentCount[LED_MAX_SEGMENTS];
+        uint32_t segmentLines[LED_MAX_SEGMENTS];
+
+        // Relays follow the lines in their mask, the legacy per-line modes pick one line
         int relay1Config = ON_WHILE_LINE1;
         int relay2Config = ON_WHILE_LINE2;
+        uint32_t relay1Lines = SIP_ALL_LINES;
+        uint32_t relay2Lines = SIP_ALL_LINES;
         RelayManager relay1 = RelayManager(RELAY1);
         RelayManager relay2 = RelayManager(RELAY2);
 
+        // Light sleep whenever every task is blocked
+        PowerManager power;
+        bool lightSleep = true;
+
         bool mDNSEnabled = true;
         LLDPService lldp = LLDPService(deviceHostname, "ESP32 SIP Device");
 
-        SIPClient sipLine1 = SIPClient(5060);
-        SIPClient sipLine2 = SIPClient(5061);
+        // One socket on SIP_LOCAL_PORT for every line
+        SIPEndpoint sipEndpoint = SIPEndpoint(SIP_LOCAL_PORT);
+        SIPClient sipLines[SIP_MAX_LINES];
 
         String webPassword = "admin";
 
+        // Remote syslog is off while the server is empty
+        String syslogServer = "";
+        int syslogPort = LOG_SYSLOG_PORT;
+        int logLevel = LOG_LEVEL_INFO;
+
+        // Line state as last reported by the SIP task, bit n is line n
+        uint32_t configuredLines = 0;
+        uint32_t registeredLines = 0;
+        uint32_t ringingLines = 0;
+        QueueHandle_t lineEvents = NULL;
+        TaskHandle_t sipTask = NULL;
+        TaskHandle_t loopTask = NULL;
+
+        // Time the loop spent blocked in wait_for_work()
+        uint64_t idleMicros = 0;
+
+        // INVITE arrival to first LED frame
+        uint32_t pendingRingTimestamp = 0;
+        uint32_t lastRingLatency = 0;
+        uint32_t maxRingLatency = 0;
+
         void init();
         void load_configuration();
         void save_configuration();
         void ip_begin();
         void ip_end();
         void handle();
+        void wait_for_work();
+        void wake();
+        void handle_sip();
+        static void sip_task(void *arg);
+        bool process_line_events();
+        void report_ring_latency();
+        void configure_logging();
+        void configure_leds();
+
+        SIPClient &sip_line(int line) { return sipLines[line]; }
+        void configure_line(int line, String sipServer, int sipPort, String sipUsername, String sipPassword, String sipRealm, int sipTransport,
+            int sipMode, String sipMonitor, bool sipVerify = true);
+        uint32_t ringing_lines() { return ringingLines & registeredLines; }
+        uint32_t error_lines() { return configuredLines & ~registeredLines; }
+        uint32_t parse_line_mask(const String &lines);
+        String format_line_mask(uint32_t mask);
 
         void get_ethernet_mac(uint8_t baseMac[6]);
         String get_ethernet_mac_address();
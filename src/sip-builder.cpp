@@ -0,0 +1,48 @@
+#include <sip-builder.h>
+
+void SIPMessageBuilder::reset() {
+    length = 0;
+    overflow = false;
+    if (capacity > 0) buffer[0] = 0;
+}
+
+SIPMessageBuilder &SIPMessageBuilder::append(const char *text, size_t len) {
+    if (overflow || length + len >= capacity) {
+        overflow = true;
+        return *this;
+    }
+    memcpy(buffer + length, text, len);
+    length += len;
+    buffer[length] = 0;
+    return *this;
+}
+
+SIPMessageBuilder &SIPMessageBuilder::append(const char *text) {
+    return append(text, strlen(text));
+}
+
+SIPMessageBuilder &SIPMessageBuilder::append(SIPView view) {
+    return append(view.data, view.length);
+}
+
+SIPMessageBuilder &SIPMessageBuilder::append(const String &text) {
+    return append(text.c_str(), text.length());
+}
+
+SIPMessageBuilder &SIPMessageBuilder::appendNumber(unsigned long value) {
+    char digits[12];
+    int len = snprintf(digits, sizeof(digits), "%lu", value);
+    return append(digits, len);
+}
+
+SIPMessageBuilder &SIPMessageBuilder::header(const char *name, SIPView value) {
+    append(name);
+    append(": ", 2);
+    append(value);
+    return append("\r\n", 2);
+}
+
+// Empty body terminator
+SIPMessageBuilder &SIPMessageBuilder::end() {
+    return append("Content-Length: 0\r\n\r\n");
+}
@@ -0,0 +1,32 @@
+#ifndef SIPBUILDER_H
+#define SIPBUILDER_H
+#include <Arduino.h>
+#include <sip-message.h>
+
+#define SIP_TX_BUFFER_SIZE 1500
+
+// Appends message text into a caller-owned fixed buffer, never allocates
+class SIPMessageBuilder {
+    private:
+        char *buffer;
+        size_t capacity;
+        size_t length = 0;
+        bool overflow = false;
+
+    public:
+        SIPMessageBuilder(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity) { reset(); }
+
+        void reset();
+        SIPMessageBuilder &append(const char *text);
+        SIPMessageBuilder &append(const char *text, size_t len);
+        SIPMessageBuilder &append(SIPView view);
+        SIPMessageBuilder &append(const String &text);
+        SIPMessageBuilder &appendNumber(unsigned long value);
+        SIPMessageBuilder &header(const char *name, SIPView value);
+        SIPMessageBuilder &end();
+
+        const char *data() const { return buffer; }
+        size_t size() const { return length; }
+        bool ok() const { return !overflow; }
+};
+#endif
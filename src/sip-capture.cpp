@@ -0,0 +1,183 @@
+#include <sip-capture.h>
+#include <sys/time.h>
+#include "lwip/sockets.h"
+#include "esp_heap_caps.h"
+
+#define SIP_CAPTURE_ALIGN(n) (((n) + 3) & ~3u)
+#define SIP_CAPTURE_HEADERS 44 // pcap record, IPv4 and UDP headers ahead of each message
+
+SIPCapture::SIPCapture() {
+    captureMutex = xSemaphoreCreateMutex();
+}
+
+// PSRAM when the module has it, a small internal buffer otherwise
+bool SIPCapture::begin() {
+    if (ring != nullptr) return true;
+    ring = (uint8_t *)heap_caps_malloc(SIP_CAPTURE_PSRAM_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    size = SIP_CAPTURE_PSRAM_SIZE;
+    if (ring == nullptr) {
+        ring = (uint8_t *)heap_caps_malloc(SIP_CAPTURE_INTERNAL_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        size = SIP_CAPTURE_INTERNAL_SIZE;
+    }
+    if (ring == nullptr) {
+        size = 0;
+        LOG_WARN("No memory for the SIP capture buffer");
+        return false;
+    }
+    LOG_INFO("SIP capture buffer of %lu bytes", (unsigned long)size);
+    return true;
+}
+
+uint32_t SIPCapture::count() {
+    return headSequence - tailSequence;
+}
+
+// Drops the oldest record, or steps over the end-of-ring marker
+void SIPCapture::evict() {
+    SIPCaptureRecord record;
+    if (tail + sizeof(record) > size) {
+        tail = 0;
+        return;
+    }
+    memcpy(&record, ring + tail, sizeof(record));
+    if (record.length == 0) {
+        tail = 0;
+        return;
+    }
+    tail += SIP_CAPTURE_ALIGN(sizeof(record) + record.length);
+    tailSequence++;
+}
+
+void SIPCapture::record(uint8_t direction, uint32_t remoteIP, uint16_t remotePort, const char *data, size_t length) {
+    if (ring == nullptr || length == 0) return;
+    uint32_t need = SIP_CAPTURE_ALIGN(sizeof(SIPCaptureRecord) + length);
+    if (need + sizeof(SIPCaptureRecord) > size || length > UINT16_MAX) return;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    SIPCaptureRecord record = {};
+    record.seconds = now.tv_sec;
+    record.micros = now.tv_usec;
+    record.remoteIP = remoteIP;
+    record.remotePort = remotePort;
+    record.length = length;
+    record.direction = direction;
+
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    for (;;) {
+        if (headSequence == tailSequence) {
+            head = tail = 0;
+            break;
+        }
+        if (head > tail) {
+            // Used space is [tail, head), take the end or wrap to the start
+            if (head + need <= size) break;
+            if (head + sizeof(record) <= size) {
+                SIPCaptureRecord marker = {};
+                memcpy(ring + head, &marker, sizeof(marker));
+            }
+            head = 0;
+        } else {
+            // Wrapped, the free space is [head, tail)
+            if (head + need <= tail) break;
+            this->evict();
+        }
+    }
+
+    record.sequence = headSequence;
+    memcpy(ring + head, &record, sizeof(record));
+    memcpy(ring + head + sizeof(record), data, length);
+    head += need;
+    headSequence++;
+    xSemaphoreGive(captureMutex);
+}
+
+size_t SIPCapture::write_file_header(uint8_t *out) {
+    // Native byte order, readers tell from the magic
+    uint32_t header[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, SIP_CAPTURE_LINKTYPE_IPV4 };
+    memcpy(out, header, sizeof(header));
+    return sizeof(header);
+}
+
+SIPCaptureCursor SIPCapture::cursor() {
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    SIPCaptureCursor cursor = { tail, tailSequence, headSequence };
+    xSemaphoreGive(captureMutex);
+    return cursor;
+}
+
+uint16_t SIPCapture::ip_checksum(const uint8_t *header, size_t length) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < length; i += 2) {
+        sum += (header[i] << 8) | header[i + 1];
+    }
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~sum;
+}
+
+// Copies the next message out as a pcap record with made-up IPv4/UDP headers, 0 when done.
+// Messages overwritten since the cursor was taken are skipped.
+size_t SIPCapture::next_packet(SIPCaptureCursor &cursor, uint32_t localIP, uint16_t localPort, uint8_t *out, size_t capacity) {
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    // The oldest record is always at the tail, which moves when the ring empties
+    if ((int32_t)(cursor.sequence - tailSequence) <= 0) {
+        cursor.offset = tail;
+        cursor.sequence = tailSequence;
+    }
+    if ((int32_t)(cursor.sequence - cursor.end) >= 0 || cursor.sequence == headSequence) {
+        xSemaphoreGive(captureMutex);
+        return 0;
+    }
+
+    SIPCaptureRecord record;
+    if (cursor.offset + sizeof(record) > size) cursor.offset = 0;
+    memcpy(&record, ring + cursor.offset, sizeof(record));
+    if (record.length == 0) {
+        cursor.offset = 0;
+        memcpy(&record, ring, sizeof(record));
+    }
+
+    size_t length = record.length;
+    if (length > capacity - SIP_CAPTURE_HEADERS) length = capacity - SIP_CAPTURE_HEADERS;
+    memcpy(out + SIP_CAPTURE_HEADERS, ring + cursor.offset + sizeof(record), length);
+    cursor.offset += SIP_CAPTURE_ALIGN(sizeof(record) + record.length);
+    cursor.sequence++;
+    xSemaphoreGive(captureMutex);
+
+    uint32_t captured = 28 + length;
+    uint32_t original = 28 + record.length;
+    uint32_t pcapHeader[4] = { record.seconds, record.micros, captured, original };
+    memcpy(out, pcapHeader, sizeof(pcapHeader));
+
+    // Streams are shown as UDP too, Wireshark decodes SIP the same either way
+    uint32_t source = record.direction == SIP_CAPTURE_IN ? record.remoteIP : localIP;
+    uint32_t destination = record.direction == SIP_CAPTURE_IN ? localIP : record.remoteIP;
+    uint16_t sourcePort = record.direction == SIP_CAPTURE_IN ? record.remotePort : localPort;
+    uint16_t destinationPort = record.direction == SIP_CAPTURE_IN ? localPort : record.remotePort;
+
+    uint8_t *ip = out + 16;
+    memset(ip, 0, 28);
+    ip[0] = 0x45;
+    ip[2] = original >> 8;
+    ip[3] = original & 0xFF;
+    ip[4] = record.sequence >> 8;
+    ip[5] = record.sequence & 0xFF;
+    ip[6] = 0x40; // Don't fragment
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    memcpy(ip + 12, &source, 4);
+    memcpy(ip + 16, &destination, 4);
+    uint16_t checksum = ip_checksum(ip, 20);
+    ip[10] = checksum >> 8;
+    ip[11] = checksum & 0xFF;
+
+    uint8_t *udp = ip + 20;
+    uint16_t udpLength = 8 + record.length;
+    udp[0] = sourcePort >> 8;
+    udp[1] = sourcePort & 0xFF;
+    udp[2] = destinationPort >> 8;
+    udp[3] = destinationPort & 0xFF;
+    udp[4] = udpLength >> 8;
+    udp[5] = udpLength & 0xFF;
+    return 16 + captured;
+}
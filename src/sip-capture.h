@@ -0,0 +1,58 @@
+#ifndef SIPCAPTURE_H
+#define SIPCAPTURE_H
+#include <Arduino.h>
+#include <logger.h>
+
+#define SIP_CAPTURE_PSRAM_SIZE (256 * 1024)
+#define SIP_CAPTURE_INTERNAL_SIZE (16 * 1024) // Without PSRAM, a few dozen messages
+#define SIP_CAPTURE_LINKTYPE_IPV4 228
+
+enum SIPCaptureDirection {
+    SIP_CAPTURE_IN,
+    SIP_CAPTURE_OUT
+};
+
+// One captured message, followed in the ring by its bytes
+struct SIPCaptureRecord {
+    uint32_t sequence;
+    uint32_t seconds;
+    uint32_t micros;
+    uint32_t remoteIP; // Network byte order
+    uint16_t remotePort;
+    uint16_t length;   // 0 marks the end of the ring, the next record is at the start
+    uint8_t direction;
+};
+
+// Where a reader is in the ring, so a download can be sent one message at a time
+struct SIPCaptureCursor {
+    uint32_t offset;
+    uint32_t sequence;
+    uint32_t end; // Sequence of the first message not included in this download
+};
+
+// Bounded ring of the SIP messages sent and received, oldest dropped first, exported as pcap
+class SIPCapture {
+    private:
+        uint8_t *ring = nullptr;
+        uint32_t size = 0;
+        uint32_t head = 0; // Next write offset
+        uint32_t tail = 0; // Oldest record
+        uint32_t headSequence = 0;
+        uint32_t tailSequence = 0;
+        SemaphoreHandle_t captureMutex;
+
+        void evict();
+        static uint16_t ip_checksum(const uint8_t *header, size_t length);
+
+    public:
+        SIPCapture();
+
+        bool begin();
+        void record(uint8_t direction, uint32_t remoteIP, uint16_t remotePort, const char *data, size_t length);
+        uint32_t count();
+
+        size_t write_file_header(uint8_t *out);
+        SIPCaptureCursor cursor();
+        size_t next_packet(SIPCaptureCursor &cursor, uint32_t localIP, uint16_t localPort, uint8_t *out, size_t capacity);
+};
+#endif
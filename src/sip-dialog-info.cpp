@@ -0,0 +1,161 @@
+#include <sip-dialog-info.h>
+#include <sip-dialog.h>
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+SIPDialogInfoReader::SIPDialogInfoReader(SIPView body) {
+    p = body.data;
+    end = body.data + body.length;
+
+    // Read up to the root element, its attributes say how to apply the document
+    SIPView name, attributes;
+    bool closing, empty;
+    while (this->next_tag(name, attributes, closing, empty)) {
+        if (!closing && local_name(name).equals("dialog-info")) {
+            documentState = attribute(attributes, "state");
+            version = attribute(attributes, "version").toInt();
+            valid = true;
+            if (empty) p = end; // No dialogs at all
+            return;
+        }
+    }
+}
+
+// Moves past the next element tag, skipping the prolog and comments
+bool SIPDialogInfoReader::next_tag(SIPView &name, SIPView &attributes, bool &closing, bool &empty) {
+    while (p < end) {
+        const char *open = (const char *)memchr(p, '<', end - p);
+        if (open == nullptr || open + 1 >= end) {
+            p = end;
+            return false;
+        }
+        p = open + 1;
+
+        if (*p == '?' || *p == '!') {
+            // Declarations and comments, a comment may contain '>'
+            bool comment = end - p >= 3 && memcmp(p, "!--", 3) == 0;
+            while (p < end && !(*p == '>' && (!comment || (p - open >= 3 && p[-1] == '-' && p[-2] == '-')))) p++;
+            p++;
+            continue;
+        }
+
+        closing = *p == '/';
+        if (closing) p++;
+        const char *nameStart = p;
+        while (p < end && !is_space(*p) && *p != '/' && *p != '>') p++;
+        name = SIPView(nameStart, p - nameStart);
+
+        const char *attributeStart = p;
+        char quote = 0;
+        while (p < end && (quote != 0 || *p != '>')) {
+            if (quote == 0 && (*p == '"' || *p == '\'')) {
+                quote = *p;
+            } else if (*p == quote) {
+                quote = 0;
+            }
+            p++;
+        }
+        if (p >= end) return false;
+        empty = p > attributeStart && p[-1] == '/';
+        attributes = SIPView(attributeStart, p - attributeStart - (empty ? 1 : 0));
+        p++;
+        return true;
+    }
+    return false;
+}
+
+SIPView SIPDialogInfoReader::text_until_tag() {
+    const char *start = p;
+    const char *open = (const char *)memchr(p, '<', end - p);
+    const char *stop = open != nullptr ? open : end;
+    return SIPView(start, stop - start).trim();
+}
+
+SIPView SIPDialogInfoReader::attribute(SIPView attributes, const char *name) {
+    size_t nameLen = strlen(name);
+    const char *a = attributes.data;
+    const char *stop = attributes.data + attributes.length;
+    while (a < stop) {
+        while (a < stop && is_space(*a)) a++;
+        const char *key = a;
+        while (a < stop && *a != '=' && !is_space(*a)) a++;
+        size_t keyLen = a - key;
+        while (a < stop && (is_space(*a) || *a == '=')) a++;
+        if (a >= stop || (*a != '"' && *a != '\'')) break;
+
+        char quote = *a++;
+        const char *value = a;
+        while (a < stop && *a != quote) a++;
+        if (keyLen == nameLen && memcmp(key, name, nameLen) == 0) {
+            return SIPView(value, a - value);
+        }
+        a++;
+    }
+    return SIPView();
+}
+
+// Drops a namespace prefix, dlg:dialog and dialog are the same element
+SIPView SIPDialogInfoReader::local_name(SIPView name) {
+    int colon = name.indexOf(':');
+    if (colon < 0) return name;
+    return SIPView(name.data + colon + 1, name.length - colon - 1);
+}
+
+bool SIPDialogInfoReader::next(SIPDialogInfoEntry &entry) {
+    if (!valid) return false;
+
+    SIPView name, attributes;
+    bool closing, empty;
+    while (this->next_tag(name, attributes, closing, empty)) {
+        if (closing || !local_name(name).equals("dialog")) continue;
+
+        entry.id = attribute(attributes, "id");
+        entry.direction = attribute(attributes, "direction");
+        entry.state = SIPView();
+        if (empty) return true;
+
+        // <state> is a direct child, <local> and <remote> are skipped over
+        while (this->next_tag(name, attributes, closing, empty)) {
+            SIPView local = local_name(name);
+            if (closing && local.equals("dialog")) return true;
+            if (!closing && !empty && local.equals("state")) {
+                entry.state = this->text_until_tag();
+            }
+        }
+        return !entry.id.isEmpty();
+    }
+    return false;
+}
+
+// Applies a NOTIFY body, false when it is not a dialog-info document
+bool SIPWatchedDialogs::apply(SIPView body) {
+    SIPDialogInfoReader reader(body);
+    if (!reader.valid) return false;
+
+    // Partial documents build on the previous version, a stale one would undo newer state
+    bool full = !reader.documentState.equals("partial");
+    if (!full && seen && reader.version <= version) return true;
+    if (full) count = 0;
+    version = reader.version;
+    seen = true;
+
+    SIPDialogInfoEntry entry;
+    while (reader.next(entry)) {
+        uint32_t id = SIPDialogTable::hash(entry.id);
+        // Ringing toward the extension, not ringback on a call it placed
+        bool ringing = entry.state.equals("early") && !entry.direction.equals("initiator");
+
+        int index = -1;
+        for (int i = 0; i < count; i++) {
+            if (early[i] == id) index = i;
+        }
+        if (ringing && index < 0 && count < SIP_WATCHED_DIALOGS) {
+            early[count++] = id;
+        } else if (!ringing && index >= 0) {
+            early[index] = early[--count];
+        }
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef SIPDIALOGINFO_H
+#define SIPDIALOGINFO_H
+#include <Arduino.h>
+#include <sip-message.h>
+
+#define SIP_WATCHED_DIALOGS 4 // Early dialogs remembered per monitored extension
+
+// One <dialog> element of an RFC 4235 dialog-info document
+struct SIPDialogInfoEntry {
+    SIPView id;
+    SIPView direction; // "initiator", "recipient" or empty
+    SIPView state;     // trying, proceeding, early, confirmed or terminated
+};
+
+// Walks a dialog-info body in place, one <dialog> at a time, nothing is copied
+class SIPDialogInfoReader {
+    private:
+        const char *p;
+        const char *end;
+
+        bool next_tag(SIPView &name, SIPView &attributes, bool &closing, bool &empty);
+        SIPView text_until_tag();
+        static SIPView attribute(SIPView attributes, const char *name);
+        static SIPView local_name(SIPView name);
+
+    public:
+        SIPView documentState; // "full" or "partial"
+        uint32_t version = 0;
+        bool valid = false;
+
+        SIPDialogInfoReader(SIPView body);
+        bool next(SIPDialogInfoEntry &entry);
+};
+
+// Early dialogs of a watched extension by id hash, enough to apply partial notifications
+class SIPWatchedDialogs {
+    private:
+        uint32_t early[SIP_WATCHED_DIALOGS];
+        uint8_t count = 0;
+        uint32_t version = 0;
+        bool seen = false;
+
+    public:
+        bool apply(SIPView body);
+        void clear() { count = 0; seen = false; }
+        bool is_ringing() const { return count > 0; }
+};
+#endif
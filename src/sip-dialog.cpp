@@ -0,0 +1,99 @@
+#include <sip-dialog.h>
+
+#define SIP_DIALOG_MASK (SIP_MAX_DIALOGS - 1)
+
+// FNV-1a
+uint32_t SIPDialogTable::hash(SIPView callId) {
+    uint32_t h = 2166136261u;
+    for (uint16_t i = 0; i < callId.length; i++) {
+        h ^= (uint8_t)callId.data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int SIPDialogTable::find_slot(SIPView callId, uint32_t hash) {
+    int index = hash & SIP_DIALOG_MASK;
+    for (int probe = 0; probe < SIP_MAX_DIALOGS; probe++) {
+        SIPDialog &d = slots[index];
+        if (d.state == SIP_DIALOG_FREE) return -1;
+        if (d.hash == hash && callId.equals(d.callId)) return index;
+        index = (index + 1) & SIP_DIALOG_MASK;
+    }
+    return -1;
+}
+
+SIPDialog *SIPDialogTable::find(SIPView callId) {
+    int index = find_slot(callId, hash(callId));
+    return index >= 0 ? &slots[index] : nullptr;
+}
+
+SIPDialog *SIPDialogTable::create(SIPView callId, SIPView fromTag, const char *toTag) {
+    if (callId.isEmpty() || callId.length >= SIP_DIALOG_CALL_ID_SIZE || fromTag.length >= SIP_DIALOG_TAG_SIZE) {
+        return nullptr;
+    }
+
+    uint32_t h = hash(callId);
+    int existing = find_slot(callId, h);
+    if (existing >= 0) return &slots[existing];
+    if (count >= SIP_MAX_DIALOGS) return nullptr;
+
+    int index = h & SIP_DIALOG_MASK;
+    while (slots[index].state != SIP_DIALOG_FREE) {
+        index = (index + 1) & SIP_DIALOG_MASK;
+    }
+
+    SIPDialog &d = slots[index];
+    d.state = SIP_DIALOG_EARLY;
+    d.hash = h;
+    d.created = millis();
+    memcpy(d.callId, callId.data, callId.length);
+    d.callId[callId.length] = 0;
+    memcpy(d.fromTag, fromTag.data, fromTag.length);
+    d.fromTag[fromTag.length] = 0;
+    strlcpy(d.toTag, toTag, sizeof(d.toTag));
+    count++;
+    return &d;
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones
+void SIPDialogTable::remove_slot(int index) {
+    slots[index].state = SIP_DIALOG_FREE;
+    count--;
+
+    int next = (index + 1) & SIP_DIALOG_MASK;
+    while (slots[next].state != SIP_DIALOG_FREE) {
+        int home = slots[next].hash & SIP_DIALOG_MASK;
+        // Move the entry back if its home slot is not between the hole and its position
+        bool movable = (next > index) ? (home <= index || home > next) : (home <= index && home > next);
+        if (movable) {
+            slots[index] = slots[next];
+            slots[next].state = SIP_DIALOG_FREE;
+            index = next;
+        }
+        next = (next + 1) & SIP_DIALOG_MASK;
+    }
+}
+
+bool SIPDialogTable::remove(SIPView callId) {
+    int index = find_slot(callId, hash(callId));
+    if (index < 0) return false;
+    remove_slot(index);
+    return true;
+}
+
+void SIPDialogTable::expire(uint32_t now, uint32_t maxAge) {
+    for (int i = 0; i < SIP_MAX_DIALOGS; i++) {
+        if (slots[i].state != SIP_DIALOG_FREE && now - slots[i].created > maxAge) {
+            remove_slot(i);
+            i = -1; // Entries may have shifted, rescan
+        }
+    }
+}
+
+void SIPDialogTable::clear() {
+    for (int i = 0; i < SIP_MAX_DIALOGS; i++) {
+        slots[i].state = SIP_DIALOG_FREE;
+    }
+    count = 0;
+}
@@ -0,0 +1,47 @@
+#ifndef SIPDIALOG_H
+#define SIPDIALOG_H
+#include <Arduino.h>
+#include <sip-message.h>
+
+#define SIP_MAX_DIALOGS 8 // Power of two, slots are indexed by Call-ID hash
+#define SIP_DIALOG_CALL_ID_SIZE 80
+#define SIP_DIALOG_TAG_SIZE 32
+
+enum SIPDialogState {
+    SIP_DIALOG_FREE,
+    SIP_DIALOG_EARLY
+};
+
+struct SIPDialog {
+    uint8_t state;
+    uint32_t hash;
+    uint32_t created;
+    char callId[SIP_DIALOG_CALL_ID_SIZE];
+    char fromTag[SIP_DIALOG_TAG_SIZE];
+    char toTag[SIP_DIALOG_TAG_SIZE];
+};
+
+// Open-addressed table of the calls currently offered to a line
+class SIPDialogTable {
+    private:
+        SIPDialog slots[SIP_MAX_DIALOGS];
+        uint8_t count = 0;
+
+        int find_slot(SIPView callId, uint32_t hash);
+        void remove_slot(int index);
+
+    public:
+        SIPDialogTable() { clear(); }
+
+        static uint32_t hash(SIPView callId);
+
+        SIPDialog *find(SIPView callId);
+        SIPDialog *create(SIPView callId, SIPView fromTag, const char *toTag);
+        bool remove(SIPView callId);
+        void expire(uint32_t now, uint32_t maxAge);
+        void clear();
+
+        bool has_early() const { return count > 0; }
+        int size() const { return count; }
+};
+#endif
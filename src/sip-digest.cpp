@@ -0,0 +1,182 @@
+#include <sip-digest.h>
+#include "mbedtls/md5.h"
+#include "mbedtls/sha256.h"
+
+static bool copy_view(SIPView view, char *out, size_t size) {
+    if (view.length >= size) {
+        out[0] = 0;
+        return false;
+    }
+    memcpy(out, view.data, view.length);
+    out[view.length] = 0;
+    return true;
+}
+
+static void to_hex(const uint8_t *digest, size_t length, char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < length; i++) {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0x0F];
+    }
+    hex[length * 2] = 0;
+}
+
+// Hashes the parts joined by ':' without building the joined string
+void SIPDigest::hash(const char *parts[], int count, char *hex) {
+    uint8_t digest[32];
+    if (algorithm == SIP_DIGEST_SHA256) {
+        // Runs on the SHA accelerator when mbedTLS hardware SHA is enabled
+        mbedtls_sha256_context ctx;
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_starts(&ctx, 0);
+        for (int i = 0; i < count; i++) {
+            if (i > 0) mbedtls_sha256_update(&ctx, (const unsigned char *)":", 1);
+            mbedtls_sha256_update(&ctx, (const unsigned char *)parts[i], strlen(parts[i]));
+        }
+        mbedtls_sha256_finish(&ctx, digest);
+        mbedtls_sha256_free(&ctx);
+        to_hex(digest, 32, hex);
+    } else {
+        mbedtls_md5_context ctx;
+        mbedtls_md5_init(&ctx);
+        mbedtls_md5_starts(&ctx);
+        for (int i = 0; i < count; i++) {
+            if (i > 0) mbedtls_md5_update(&ctx, (const unsigned char *)":", 1);
+            mbedtls_md5_update(&ctx, (const unsigned char *)parts[i], strlen(parts[i]));
+        }
+        mbedtls_md5_finish(&ctx, digest);
+        mbedtls_md5_free(&ctx);
+        to_hex(digest, 16, hex);
+    }
+}
+
+void SIPDigest::reset() {
+    algorithm = SIP_DIGEST_MD5;
+    session = false;
+    qopAuth = false;
+    proxy = false;
+    realm[0] = 0;
+    nonce[0] = 0;
+    opaque[0] = 0;
+    cnonce[0] = 0;
+    nonceCount = 0;
+    ha1[0] = 0;
+    ha1Valid = false;
+    ha1Realm[0] = 0;
+}
+
+// 0 when we cannot answer the algorithm, otherwise higher is stronger
+int SIPDigest::strength(SIPView algorithm) {
+    if (algorithm.isEmpty() || algorithm.equalsIgnoreCase("MD5") || algorithm.equalsIgnoreCase("MD5-sess")) {
+        return 1;
+    }
+    if (algorithm.equalsIgnoreCase("SHA-256") || algorithm.equalsIgnoreCase("SHA-256-sess")) {
+        return 2;
+    }
+    return 0;
+}
+
+const char *SIPDigest::algorithm_name() const {
+    return algorithm == SIP_DIGEST_SHA256 ? (session ? "SHA-256-sess" : "SHA-256") : (session ? "MD5-sess" : "MD5");
+}
+
+// Stores the strongest WWW-Authenticate/Proxy-Authenticate challenge we support, false if none can be answered
+bool SIPDigest::challenge(const SIPMessage &message, const String &defaultRealm) {
+    const SIPChallenge *offer = nullptr;
+    for (int i = 0; i < message.challengeCount; i++) {
+        if (strength(message.challenges[i].algorithm) > (offer != nullptr ? strength(offer->algorithm) : 0)) {
+            offer = &message.challenges[i];
+        }
+    }
+    if (offer == nullptr) {
+        nonce[0] = 0;
+        return false;
+    }
+    SIPView name = offer->algorithm;
+    algorithm = strength(name) == 2 ? SIP_DIGEST_SHA256 : SIP_DIGEST_MD5;
+    session = name.length > 5 && strncasecmp(name.data + name.length - 5, "-sess", 5) == 0;
+
+    // qop is a list, we only implement "auth"
+    qopAuth = false;
+    SIPView qop = offer->qop;
+    uint16_t start = 0;
+    for (uint16_t i = 0; i <= qop.length; i++) {
+        if (i == qop.length || qop.data[i] == ',') {
+            if (SIPView(qop.data + start, i - start).trim().equalsIgnoreCase("auth")) {
+                qopAuth = true;
+            }
+            start = i + 1;
+        }
+    }
+
+    proxy = message.statusCode == 407;
+
+    if (offer->realm.isEmpty()) {
+        strlcpy(realm, defaultRealm.c_str(), sizeof(realm));
+    } else {
+        copy_view(offer->realm, realm, sizeof(realm));
+    }
+    copy_view(offer->opaque, opaque, sizeof(opaque));
+
+    char newNonce[SIP_DIGEST_NONCE_SIZE];
+    if (!copy_view(offer->nonce, newNonce, sizeof(newNonce)) || newNonce[0] == 0) {
+        nonce[0] = 0;
+        return false;
+    }
+    if (strcmp(newNonce, nonce) != 0) {
+        strcpy(nonce, newNonce);
+        nonceCount = 0;
+        snprintf(cnonce, sizeof(cnonce), "%08lx%08lx", (unsigned long)random(0x7FFFFFFF), (unsigned long)random(0x7FFFFFFF));
+    }
+    return true;
+}
+
+// Appends an (Proxy-)Authorization header answering the stored challenge with the next nonce count
+void SIPDigest::write_authorization(SIPMessageBuilder &tx, const char *method, const char *uri, const String &username, const String &password) {
+    if (!ha1Valid || ha1Algorithm != algorithm || strcmp(ha1Realm, realm) != 0) {
+        const char *parts[] = { username.c_str(), realm, password.c_str() };
+        hash(parts, 3, ha1);
+        ha1Valid = true;
+        ha1Algorithm = algorithm;
+        strlcpy(ha1Realm, realm, sizeof(ha1Realm));
+    }
+
+    nonceCount++;
+    char nc[9];
+    snprintf(nc, sizeof(nc), "%08lx", (unsigned long)nonceCount);
+
+    const char *key = ha1;
+    char sessionKey[SIP_DIGEST_HEX_SIZE];
+    if (session) {
+        const char *parts[] = { ha1, nonce, cnonce };
+        hash(parts, 3, sessionKey);
+        key = sessionKey;
+    }
+
+    char ha2[SIP_DIGEST_HEX_SIZE];
+    const char *ha2Parts[] = { method, uri };
+    hash(ha2Parts, 2, ha2);
+
+    char response[SIP_DIGEST_HEX_SIZE];
+    if (qopAuth) {
+        const char *parts[] = { key, nonce, nc, cnonce, "auth", ha2 };
+        hash(parts, 6, response);
+    } else {
+        const char *parts[] = { key, nonce, ha2 };
+        hash(parts, 3, response);
+    }
+
+    tx.append(proxy ? "Proxy-Authorization: Digest " : "Authorization: Digest ");
+    tx.append("username=\"").append(username).append("\", ");
+    tx.append("realm=\"").append(realm).append("\", ");
+    tx.append("nonce=\"").append(nonce).append("\", ");
+    tx.append("uri=\"").append(uri).append("\", ");
+    tx.append("response=\"").append(response).append("\", ");
+    if (opaque[0] != 0) {
+        tx.append("opaque=\"").append(opaque).append("\", ");
+    }
+    if (qopAuth) {
+        tx.append("qop=auth, nc=").append(nc).append(", cnonce=\"").append(cnonce).append("\", ");
+    }
+    tx.append("algorithm=").append(this->algorithm_name()).append("\r\n");
+}
@@ -0,0 +1,48 @@
+#ifndef SIPDIGEST_H
+#define SIPDIGEST_H
+#include <Arduino.h>
+#include <sip-message.h>
+#include <sip-builder.h>
+
+#define SIP_DIGEST_REALM_SIZE 64
+#define SIP_DIGEST_NONCE_SIZE 128
+#define SIP_DIGEST_HEX_SIZE 65 // SHA-256 as hex plus terminator
+
+enum SIPDigestAlgorithm {
+    SIP_DIGEST_MD5,
+    SIP_DIGEST_SHA256
+};
+
+// RFC 7616 / RFC 8760 digest state for one set of credentials
+class SIPDigest {
+    private:
+        uint8_t algorithm = SIP_DIGEST_MD5;
+        bool session = false;    // -sess variant
+        bool qopAuth = false;
+        bool proxy = false;      // Challenge came from a 407
+        char realm[SIP_DIGEST_REALM_SIZE];
+        char nonce[SIP_DIGEST_NONCE_SIZE];
+        char opaque[SIP_DIGEST_NONCE_SIZE];
+        char cnonce[17];
+        uint32_t nonceCount = 0;
+
+        // H(username:realm:password), cached until credentials, realm or algorithm change
+        char ha1[SIP_DIGEST_HEX_SIZE];
+        bool ha1Valid = false;
+        uint8_t ha1Algorithm = SIP_DIGEST_MD5;
+        char ha1Realm[SIP_DIGEST_REALM_SIZE];
+
+        void hash(const char *parts[], int count, char *hex);
+        static int strength(SIPView algorithm);
+
+    public:
+        SIPDigest() { reset(); }
+
+        void reset();
+        bool challenge(const SIPMessage &message, const String &defaultRealm);
+        bool has_nonce() const { return nonce[0] != 0; }
+        const char *realm_name() const { return realm; }
+        const char *algorithm_name() const;
+        void write_authorization(SIPMessageBuilder &tx, const char *method, const char *uri, const String &username, const String &password);
+};
+#endif
@@ -0,0 +1,209 @@
+#include <sip-endpoint.h>
+#include <sip.h>
+
+SIPEndpoint::SIPEndpoint(uint16_t localPort) {
+    this->localPort = localPort;
+    this->endpointMutex = xSemaphoreCreateRecursiveMutex();
+}
+
+void SIPEndpoint::add_line(SIPClient *line) {
+    if (lineCount >= SIP_MAX_LINES) return;
+    lines[lineCount++] = line;
+    line->set_endpoint(this);
+}
+
+bool SIPEndpoint::begin() {
+    SIPLock lock(endpointMutex);
+    if (wakeFd < 0) {
+        // Kept open across network restarts, ESP_ERR_INVALID_STATE only means it is registered already
+        esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+        esp_vfs_eventfd_register(&config);
+        wakeFd = eventfd(0, 0);
+        if (wakeFd < 0) {
+            LOG_WARN("Could not create SIP wakeup eventfd, requests from other tasks wait for the next timeout");
+        }
+    }
+
+    if (sipSocket >= 0) {
+        close(sipSocket);
+    }
+    rxCount = 0;
+    sipSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sipSocket < 0) {
+        LOG_ERROR("Could not create SIP socket");
+        return false;
+    }
+
+    struct sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(localPort);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sipSocket, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        LOG_ERROR("Could not bind SIP socket to port %u", localPort);
+        close(sipSocket);
+        sipSocket = -1;
+        return false;
+    }
+    return true;
+}
+
+void SIPEndpoint::end() {
+    SIPLock lock(endpointMutex);
+    if (sipSocket >= 0) {
+        close(sipSocket);
+        sipSocket = -1;
+    }
+    rxCount = 0;
+}
+
+// Called from other tasks after changing what a line should do next
+void SIPEndpoint::wake() {
+    if (wakeFd < 0) return;
+    uint64_t one = 1;
+    write(wakeFd, &one, sizeof(one));
+}
+
+void SIPEndpoint::clear_wake() {
+    if (wakeFd < 0) return;
+    uint64_t count;
+    read(wakeFd, &count, sizeof(count));
+}
+
+void SIPEndpoint::send(uint32_t remoteIP, uint16_t remotePort, const char *message, size_t length) {
+    int fd = sipSocket;
+    if (fd < 0) return;
+    struct sockaddr_in destination = {};
+    destination.sin_family = AF_INET;
+    destination.sin_port = htons(remotePort);
+    destination.sin_addr.s_addr = remoteIP;
+    sendto(fd, message, length, 0, (struct sockaddr *)&destination, sizeof(destination));
+}
+
+// Empties the socket into the packet ring, processing whenever the ring fills
+void SIPEndpoint::receive() {
+    SIPLock lock(endpointMutex);
+    if (sipSocket < 0) {
+        return;
+    }
+
+    int burst = 0;
+    for (;;) {
+        if (rxCount == SIP_RX_RING_SIZE) {
+            this->process_packets();
+        }
+
+        SIPPacket &packet = rxRing[(rxHead + rxCount) % SIP_RX_RING_SIZE];
+        socklen_t sourceLen = sizeof(packet.source);
+        int len = recvfrom(sipSocket, packet.data, sizeof(packet.data), MSG_DONTWAIT, (struct sockaddr *)&packet.source, &sourceLen);
+        if (len <= 0) {
+            break;
+        }
+
+        burst++;
+        if (len >= (int)sizeof(packet.data)) {
+            // Truncated, the tail of the message is lost
+            socketStats.dropped++;
+            continue;
+        }
+
+        packet.timestamp = micros();
+        packet.length = len;
+        packet.data[len] = 0;
+        rxCount++;
+    }
+
+    if (burst > socketStats.maxBurst) {
+        socketStats.maxBurst = burst;
+    }
+    if (burst >= CONFIG_LWIP_UDP_RECVMBOX_SIZE) {
+        // lwIP does not expose the mailbox depth, a burst this long only means it may have filled up and discarded datagrams
+        socketStats.drainBursts++;
+        LOG_WARN("SIP receive burst of %d datagrams, the lwIP mailbox may have overflowed", burst);
+    }
+
+    this->process_packets();
+}
+
+void SIPEndpoint::process_packets() {
+    while (rxCount > 0) {
+        this->deliver(rxRing[rxHead], nullptr);
+        rxHead = (rxHead + 1) % SIP_RX_RING_SIZE;
+        rxCount--;
+    }
+}
+
+// Parses the packet and hands it to its line, routing it first when it came in over UDP
+void SIPEndpoint::deliver(SIPPacket &packet, SIPClient *line) {
+    LOG_DEBUG("SIP << %.*s (%u bytes from %s)", (int)strcspn(packet.data, "\r\n"), packet.data, (unsigned)packet.length,
+        IPAddress(packet.source.sin_addr.s_addr).toString().c_str());
+    capture.record(SIP_CAPTURE_IN, packet.source.sin_addr.s_addr, ntohs(packet.source.sin_port), packet.data, packet.length);
+
+    // Index the datagram once, handlers read views into the packet buffer
+    SIPMessage message;
+    if (!message.parse(packet.data, packet.length)) {
+        LOG_WARN("Discarding malformed SIP message");
+        if (line != nullptr) {
+            line->streamStats.dropped++;
+        } else {
+            socketStats.dropped++;
+        }
+        return;
+    }
+
+    SIPPacketStats *stats;
+    if (line != nullptr) {
+        stats = &line->streamStats;
+    } else {
+        line = this->route(message, packet.source.sin_addr.s_addr);
+        if (line == nullptr) {
+            LOG_DEBUG("Discarding SIP message for no configured line");
+            socketStats.dropped++;
+            return;
+        }
+        stats = &line->udpStats;
+        stats->received++;
+    }
+    stats->processed++;
+    line->handle_sip_message(message, packet);
+}
+
+// Responses by their client transaction branch, requests by subscription or the user they are addressed to
+SIPClient *SIPEndpoint::route(const SIPMessage &message, uint32_t source) {
+    if (message.isResponse()) {
+        for (int i = 0; i < lineCount; i++) {
+            if (lines[i]->owns_response(message)) return lines[i];
+        }
+        return nullptr;
+    }
+
+    // NOTIFYs belong to the monitor line whose subscription they are in
+    for (int i = 0; i < lineCount; i++) {
+        if (lines[i]->owns_request(message)) return lines[i];
+    }
+
+    SIPView user = SIPMessage::uriUser(message.requestUri);
+    SIPView toUser = SIPMessage::uriUser(SIPMessage::headerUri(message.to));
+    SIPClient *byUser = nullptr;
+    SIPClient *bySource = nullptr;
+    int configured = 0;
+    SIPClient *onlyLine = nullptr;
+    for (int i = 0; i < lineCount; i++) {
+        SIPClient *candidate = lines[i];
+        if (!candidate->is_configured() || candidate->is_monitor()) continue;
+        configured++;
+        onlyLine = candidate;
+
+        bool fromRegistrar = candidate->is_registrar(source);
+        if (candidate->matches_user(user) || candidate->matches_user(toUser)) {
+            // The same extension on two servers is told apart by where the request came from
+            if (byUser == nullptr || fromRegistrar) byUser = candidate;
+        } else if (fromRegistrar && bySource == nullptr) {
+            bySource = candidate;
+        }
+    }
+
+    // PBXs that address calls to a DID rather than our Contact still reach the line they serve
+    if (byUser != nullptr) return byUser;
+    if (bySource != nullptr) return bySource;
+    return configured == 1 ? onlyLine : nullptr;
+}
@@ -0,0 +1,100 @@
+#ifndef SIPENDPOINT_H
+#define SIPENDPOINT_H
+#include <Arduino.h>
+#include <logger.h>
+#include <sip-message.h>
+#include <sip-builder.h>
+#include <sip-capture.h>
+#include "lwip/sockets.h"
+#include "esp_vfs_eventfd.h"
+#include <sys/eventfd.h>
+#include <atomic>
+
+#define SIP_LOCAL_PORT 5060
+
+// Lines compiled in, bigger sites can build with -D SIP_MAX_LINES=16
+#ifndef SIP_MAX_LINES
+#define SIP_MAX_LINES 8
+#endif
+#define SIP_ALL_LINES (0xFFFFFFFFu >> (32 - SIP_MAX_LINES))
+static_assert(SIP_MAX_LINES >= 1 && SIP_MAX_LINES <= 32, "Line state is kept in 32-bit masks");
+
+#define SIP_RX_BUFFER_SIZE 2048
+#define SIP_RX_RING_SIZE 6 // One full lwIP UDP mailbox per wakeup
+
+#ifndef CONFIG_LWIP_UDP_RECVMBOX_SIZE
+#define CONFIG_LWIP_UDP_RECVMBOX_SIZE 6
+#endif
+
+struct SIPPacket {
+    uint32_t timestamp;
+    struct sockaddr_in source;
+    uint16_t length;
+    char data[SIP_RX_BUFFER_SIZE];
+};
+
+// Written by the SIP task, read by /metrics from the web server
+struct SIPPacketStats {
+    std::atomic<uint32_t> received;
+    std::atomic<uint32_t> processed;
+    std::atomic<uint32_t> dropped;
+};
+
+// What the shared UDP socket lost before a datagram reached a line, the rest is counted on the line
+struct SIPSocketStats {
+    std::atomic<uint32_t> dropped;     // Truncated, malformed or for no line
+    std::atomic<uint32_t> drainBursts; // Wakeups that drained a mailbox's worth of datagrams or more
+    std::atomic<uint16_t> maxBurst;
+};
+
+class SIPClient;
+
+// The one UDP socket all lines share, each datagram is parsed once and handed to its line
+class SIPEndpoint {
+    private:
+        int sipSocket = -1;
+        int wakeFd = -1; // eventfd that ends the SIP task's select() early
+        uint16_t localPort;
+        SemaphoreHandle_t endpointMutex;
+
+        SIPClient *lines[SIP_MAX_LINES];
+        uint8_t lineCount = 0;
+
+        // Preallocated receive ring, drained once per wakeup
+        SIPPacket rxRing[SIP_RX_RING_SIZE];
+        uint8_t rxHead = 0;
+        uint8_t rxCount = 0;
+
+        // A message framed off a line's TCP/TLS connection
+        SIPPacket streamPacket;
+
+        // Outgoing messages are built here, only ever from the SIP task
+        char txBuffer[SIP_TX_BUFFER_SIZE];
+
+        void process_packets();
+        SIPClient *route(const SIPMessage &message, uint32_t source);
+
+    public:
+        SIPSocketStats socketStats = {};
+        SIPCapture capture;
+
+        SIPEndpoint(uint16_t localPort);
+
+        void add_line(SIPClient *line);
+        bool begin();
+        void end();
+
+        int socket_fd() { return sipSocket; }
+        int wake_fd() { return wakeFd; }
+        void wake();
+        static void wake(void *endpoint) { ((SIPEndpoint *)endpoint)->wake(); }
+        void clear_wake();
+        uint16_t local_port() { return localPort; }
+        char *tx_buffer() { return txBuffer; }
+        SIPPacket &stream_packet() { return streamPacket; }
+
+        void send(uint32_t remoteIP, uint16_t remotePort, const char *message, size_t length);
+        void receive();
+        void deliver(SIPPacket &packet, SIPClient *line);
+};
+#endif
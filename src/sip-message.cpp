@@ -0,0 +1,342 @@
+#include <sip-message.h>
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+bool SIPView::equals(const char *text) const {
+    size_t len = strlen(text);
+    return len == length && memcmp(data, text, len) == 0;
+}
+
+bool SIPView::equalsIgnoreCase(const char *text) const {
+    size_t len = strlen(text);
+    return len == length && strncasecmp(data, text, len) == 0;
+}
+
+bool SIPView::startsWith(const char *text) const {
+    size_t len = strlen(text);
+    return len <= length && memcmp(data, text, len) == 0;
+}
+
+long SIPView::toInt() const {
+    long value = 0;
+    uint16_t i = 0;
+    while (i < length && is_space(data[i])) i++;
+    while (i < length && data[i] >= '0' && data[i] <= '9') {
+        value = value * 10 + (data[i] - '0');
+        i++;
+    }
+    return value;
+}
+
+int SIPView::indexOf(char c) const {
+    for (uint16_t i = 0; i < length; i++) {
+        if (data[i] == c) return i;
+    }
+    return -1;
+}
+
+SIPView SIPView::trim() const {
+    uint16_t start = 0;
+    uint16_t end = length;
+    while (start < end && (is_space(data[start]) || data[start] == '\r' || data[start] == '\n')) start++;
+    while (end > start && (is_space(data[end - 1]) || data[end - 1] == '\r' || data[end - 1] == '\n')) end--;
+    return SIPView(data + start, end - start);
+}
+
+String SIPView::toString() const {
+    if (length == 0) return String();
+    return String(data, length);
+}
+
+// Matches a header name against its long form and optional RFC 3261 compact form
+static bool header_is(SIPView name, const char *full, char compact) {
+    if (compact != 0 && name.length == 1 && tolower(name.data[0]) == compact) {
+        return true;
+    }
+    return name.equalsIgnoreCase(full);
+}
+
+SIPView SIPMessage::headerUri(SIPView header) {
+    int open = header.indexOf('<');
+    if (open >= 0) {
+        SIPView rest(header.data + open + 1, header.length - open - 1);
+        int close = rest.indexOf('>');
+        if (close >= 0) {
+            return SIPView(rest.data, close);
+        }
+        return rest;
+    }
+
+    // Bare URI form, parameters belong to the header
+    int semi = header.indexOf(';');
+    if (semi >= 0) {
+        return SIPView(header.data, semi).trim();
+    }
+    return header.trim();
+}
+
+// User part of a sip: or sips: URI, empty when there is none
+SIPView SIPMessage::uriUser(SIPView uri) {
+    int colon = uri.indexOf(':');
+    if (colon < 0) return SIPView();
+    SIPView rest(uri.data + colon + 1, uri.length - colon - 1);
+    int at = rest.indexOf('@');
+    if (at <= 0) return SIPView();
+    return SIPView(rest.data, at);
+}
+
+// False when the header has no such parameter, a flag parameter like ;lr is found with an empty value
+bool SIPMessage::headerParameter(SIPView header, const char *name, SIPView &value) {
+    size_t nameLen = strlen(name);
+    bool quoted = false;
+    bool bracketed = false;
+
+    for (uint16_t i = 0; i < header.length; i++) {
+        char c = header.data[i];
+        if (c == '"') {
+            quoted = !quoted;
+            continue;
+        }
+        if (quoted) continue;
+        if (c == '<') bracketed = true;
+        if (c == '>') bracketed = false;
+        if (bracketed) continue;
+        if (c == ',') break; // Next header value
+        if (c != ';') continue;
+
+        uint16_t p = i + 1;
+        while (p < header.length && is_space(header.data[p])) p++;
+        if (p + nameLen > header.length || strncasecmp(header.data + p, name, nameLen) != 0) {
+            continue;
+        }
+        p += nameLen;
+        while (p < header.length && is_space(header.data[p])) p++;
+        if (p >= header.length || header.data[p] != '=') {
+            // Flag parameter or a longer name sharing the prefix
+            if (p >= header.length || header.data[p] == ';' || header.data[p] == ',') {
+                value = SIPView(header.data + p, 0);
+                return true;
+            }
+            continue;
+        }
+        p++;
+        while (p < header.length && is_space(header.data[p])) p++;
+
+        uint16_t start = p;
+        if (p < header.length && header.data[p] == '"') {
+            start = ++p;
+            while (p < header.length && header.data[p] != '"') p++;
+            value = SIPView(header.data + start, p - start);
+            return true;
+        }
+        while (p < header.length) {
+            char v = header.data[p];
+            if (v == ';' || v == ',' || v == '>' || is_space(v) || v == '\r') break;
+            p++;
+        }
+        value = SIPView(header.data + start, p - start);
+        return true;
+    }
+    value = SIPView();
+    return false;
+}
+
+void SIPMessage::parseStartLine(SIPView line) {
+    if (line.startsWith("SIP/2.0 ")) {
+        isRequest = false;
+        SIPView status(line.data + 8, line.length - 8);
+        statusCode = status.toInt();
+        if (status.length > 4) {
+            reasonPhrase = SIPView(status.data + 4, status.length - 4).trim();
+        }
+        return;
+    }
+
+    isRequest = true;
+    int methodEnd = line.indexOf(' ');
+    if (methodEnd <= 0) {
+        method = line;
+        return;
+    }
+    method = SIPView(line.data, methodEnd);
+
+    SIPView rest(line.data + methodEnd + 1, line.length - methodEnd - 1);
+    int uriEnd = rest.indexOf(' ');
+    requestUri = uriEnd >= 0 ? SIPView(rest.data, uriEnd) : rest;
+}
+
+void SIPMessage::parseCSeq(SIPView value) {
+    cseq = value;
+    cseqNumber = value.toInt();
+    int space = value.indexOf(' ');
+    if (space >= 0) {
+        cseqMethod = SIPView(value.data + space + 1, value.length - space - 1).trim();
+    }
+}
+
+void SIPMessage::parseAuthenticate(SIPView value, SIPChallenge &challenge) {
+    challenge.header = value;
+
+    // Skip the auth scheme ("Digest")
+    uint16_t p = 0;
+    while (p < value.length && !is_space(value.data[p])) p++;
+
+    while (p < value.length) {
+        while (p < value.length && (is_space(value.data[p]) || value.data[p] == ',' || value.data[p] == '\r' || value.data[p] == '\n')) p++;
+
+        uint16_t nameStart = p;
+        while (p < value.length && value.data[p] != '=' && value.data[p] != ',') p++;
+        SIPView name = SIPView(value.data + nameStart, p - nameStart).trim();
+        if (p >= value.length || value.data[p] != '=') continue;
+        p++;
+        while (p < value.length && is_space(value.data[p])) p++;
+
+        SIPView param;
+        if (p < value.length && value.data[p] == '"') {
+            uint16_t start = ++p;
+            while (p < value.length && value.data[p] != '"') p++;
+            param = SIPView(value.data + start, p - start);
+            p++;
+        } else {
+            uint16_t start = p;
+            while (p < value.length && value.data[p] != ',') p++;
+            param = SIPView(value.data + start, p - start).trim();
+        }
+
+        if (name.equalsIgnoreCase("realm")) {
+            challenge.realm = param;
+        } else if (name.equalsIgnoreCase("nonce")) {
+            challenge.nonce = param;
+        } else if (name.equalsIgnoreCase("algorithm")) {
+            challenge.algorithm = param;
+        } else if (name.equalsIgnoreCase("qop")) {
+            challenge.qop = param;
+        } else if (name.equalsIgnoreCase("opaque")) {
+            challenge.opaque = param;
+        } else if (name.equalsIgnoreCase("stale")) {
+            challenge.stale = param.equalsIgnoreCase("true");
+        }
+    }
+}
+
+void SIPMessage::parseHeader(SIPView name, SIPView value) {
+    bool afterVia = viaOpen;
+    viaOpen = false;
+    if (header_is(name, "Via", 'v')) {
+        // Responses copy the block as it is, so any number of Vias come back in order
+        const char *valueEnd = value.data + value.length;
+        if (via.data == nullptr) {
+            via = value;
+            viaBlock = SIPView(name.data, valueEnd - name.data);
+        } else if (afterVia) {
+            viaBlock.length = valueEnd - viaBlock.data;
+        } else {
+            viaSplit = true;
+        }
+        viaOpen = true;
+    } else if (header_is(name, "From", 'f')) {
+        from = value;
+    } else if (header_is(name, "To", 't')) {
+        to = value;
+    } else if (header_is(name, "Call-ID", 'i')) {
+        callId = value;
+    } else if (header_is(name, "CSeq", 0)) {
+        parseCSeq(value);
+    } else if (header_is(name, "Contact", 'm')) {
+        if (contact.isEmpty()) contact = value;
+    } else if (header_is(name, "Expires", 0)) {
+        expires = value;
+    } else if (header_is(name, "Min-Expires", 0)) {
+        minExpires = value;
+    } else if (header_is(name, "Content-Length", 'l')) {
+        contentLength = value.toInt();
+    } else if (header_is(name, "Content-Type", 'c')) {
+        contentType = value;
+    } else if (header_is(name, "Event", 'o')) {
+        event = value;
+    } else if (header_is(name, "Subscription-State", 0)) {
+        subscriptionState = value;
+    } else if (header_is(name, "WWW-Authenticate", 0) || header_is(name, "Proxy-Authenticate", 0)) {
+        // Only Digest can be answered, SIPDigest picks the strongest of what is offered
+        bool digest = value.length > 6 && strncasecmp(value.data, "Digest", 6) == 0 && is_space(value.data[6]);
+        if (digest && challengeCount < SIP_MAX_CHALLENGES) {
+            parseAuthenticate(value, challenges[challengeCount++]);
+        }
+    }
+}
+
+bool SIPMessage::parse(const char *buffer, size_t length) {
+    *this = SIPMessage();
+    if (buffer == nullptr || length == 0 || length > 0xFFFF) {
+        return false;
+    }
+
+    const char *end = buffer + length;
+    const char *line = buffer;
+    bool startLine = true;
+    SIPView headerName;
+    SIPView headerValue;
+
+    while (line < end) {
+        const char *eol = (const char *)memchr(line, '\n', end - line);
+        const char *next = eol ? eol + 1 : end;
+        const char *lineEnd = eol ? eol : end;
+        if (lineEnd > line && lineEnd[-1] == '\r') lineEnd--;
+        SIPView current(line, lineEnd - line);
+
+        if (startLine) {
+            if (current.isEmpty()) {
+                // Tolerate leading CRLF keepalives
+                line = next;
+                continue;
+            }
+            parseStartLine(current);
+            startLine = false;
+            line = next;
+            continue;
+        }
+
+        // Header folding: continuation lines extend the previous value
+        if (!current.isEmpty() && is_space(current.data[0]) && headerName.data != nullptr) {
+            headerValue.length = lineEnd - headerValue.data;
+            line = next;
+            continue;
+        }
+
+        if (headerName.data != nullptr) {
+            parseHeader(headerName, headerValue.trim());
+            headerName = SIPView();
+        }
+
+        if (current.isEmpty()) {
+            body = SIPView(next, end - next);
+            break;
+        }
+
+        int colon = current.indexOf(':');
+        if (colon > 0) {
+            headerName = SIPView(current.data, colon).trim();
+            headerValue = SIPView(current.data + colon + 1, current.length - colon - 1);
+        }
+        line = next;
+    }
+
+    if (headerName.data != nullptr) {
+        parseHeader(headerName, headerValue.trim());
+    }
+
+    if (contentLength >= 0 && contentLength < body.length) {
+        body.length = contentLength;
+    }
+
+    headerParameter(via, "branch", viaBranch);
+    headerParameter(from, "tag", fromTag);
+    headerParameter(to, "tag", toTag);
+
+    if (startLine) return false;
+    // Vias interleaved with other headers cannot be copied into a response as one block
+    if (isRequest) return !method.isEmpty() && !callId.isEmpty() && !viaSplit;
+    return statusCode >= 100 && statusCode < 700;
+}
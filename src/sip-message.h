@@ -0,0 +1,90 @@
+#ifndef SIPMESSAGE_H
+#define SIPMESSAGE_H
+#include <Arduino.h>
+
+#define SIP_MAX_CHALLENGES 4
+
+// Non-owning slice of a received datagram
+struct SIPView {
+    const char *data = nullptr;
+    uint16_t length = 0;
+
+    SIPView() {}
+    SIPView(const char *data, uint16_t length) : data(data), length(length) {}
+
+    bool isEmpty() const { return length == 0; }
+    bool equals(const char *text) const;
+    bool equalsIgnoreCase(const char *text) const;
+    bool startsWith(const char *text) const;
+    long toInt() const;
+    int indexOf(char c) const;
+    SIPView trim() const;
+    String toString() const;
+};
+
+// One WWW-Authenticate / Proxy-Authenticate challenge and its parameters
+struct SIPChallenge {
+    SIPView header;
+    SIPView realm;
+    SIPView nonce;
+    SIPView algorithm;
+    SIPView qop;
+    SIPView opaque;
+    bool stale = false;
+};
+
+class SIPMessage {
+    private:
+        void parseHeader(SIPView name, SIPView value);
+        void parseStartLine(SIPView line);
+        static void parseAuthenticate(SIPView value, SIPChallenge &challenge);
+        void parseCSeq(SIPView value);
+        bool viaOpen = false; // The last header parsed was a Via
+        bool viaSplit = false;
+
+    public:
+        bool isRequest = false;
+
+        // Request line
+        SIPView method;
+        SIPView requestUri;
+
+        // Status line
+        int statusCode = 0;
+        SIPView reasonPhrase;
+
+        // Header index
+        SIPView via;      // Topmost Via header
+        SIPView viaBlock; // Every Via header line, verbatim, for copying into responses
+        SIPView from;
+        SIPView to;
+        SIPView callId;
+        SIPView cseq;
+        SIPView contact;
+        SIPView expires;
+        SIPView minExpires;
+        SIPView contentType;
+        SIPView event;
+        SIPView subscriptionState;
+        long contentLength = -1;
+        SIPView body;
+
+        // Derived fields
+        uint32_t cseqNumber = 0;
+        SIPView cseqMethod;
+        SIPView viaBranch;
+        SIPView fromTag;
+        SIPView toTag;
+
+        // Every WWW-Authenticate / Proxy-Authenticate challenge, RFC 8760 servers offer one per algorithm
+        SIPChallenge challenges[SIP_MAX_CHALLENGES];
+        uint8_t challengeCount = 0;
+
+        bool parse(const char *buffer, size_t length);
+        bool isResponse() const { return !isRequest; }
+
+        static bool headerParameter(SIPView header, const char *name, SIPView &value);
+        static SIPView headerUri(SIPView header);
+        static SIPView uriUser(SIPView uri);
+};
+#endif
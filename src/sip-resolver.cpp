@@ -0,0 +1,433 @@
+#include <sip-resolver.h>
+#include "lwip/netdb.h"
+
+uint8_t SIPResolver::buffer[SIP_RESOLVER_BUFFER_SIZE];
+QueueHandle_t SIPResolver::requests = NULL;
+TaskHandle_t SIPResolver::task = NULL;
+void (*SIPResolver::notify)(void *arg) = nullptr;
+void *SIPResolver::notifyArg = nullptr;
+
+void SIPResolver::begin(size_t lines, void (*notify)(void *arg), void *arg) {
+    if (task != NULL) return;
+    SIPResolver::notify = notify;
+    SIPResolver::notifyArg = arg;
+    requests = xQueueCreate(lines, sizeof(SIPResolver *));
+    xTaskCreatePinnedToCore(SIPResolver::lookup_task, "dns", SIP_RESOLVER_TASK_STACK, nullptr, SIP_RESOLVER_TASK_PRIORITY, &task, SIP_RESOLVER_TASK_CORE);
+}
+
+// Runs one lookup at a time, a resolver is queued at most once while its lookup is busy
+void SIPResolver::lookup_task(void *arg) {
+    for (;;) {
+        SIPResolver *resolver;
+        if (xQueueReceive(requests, &resolver, portMAX_DELAY) != pdTRUE) continue;
+        resolver->refresh();
+        resolver->lookupState.store(SIP_LOOKUP_DONE, std::memory_order_release);
+        if (notify != nullptr) notify(notifyArg);
+    }
+}
+
+void SIPResolver::set_host(const char *host, uint16_t port, const char *service) {
+    if (service == nullptr) service = "";
+    if (strcmp(this->host, host) == 0 && this->port == port && strcmp(this->service, service) == 0) {
+        return;
+    }
+    strlcpy(this->host, host, sizeof(this->host));
+    strlcpy(this->service, service, sizeof(this->service));
+    this->port = port;
+    this->valid = false;
+    this->restart = this->is_resolving();
+}
+
+void SIPResolver::set_dns_server(uint32_t address, uint16_t port) {
+#ifdef SIP_RESOLVER_DNS_SERVER
+    // Build-time stand-in server wins over the DHCP-provided one
+    struct in_addr standIn;
+    if (inet_aton(SIP_RESOLVER_DNS_SERVER, &standIn)) {
+        address = standIn.s_addr;
+    }
+#endif
+    if (this->dnsServer != address || this->dnsPort != port) {
+        this->dnsServer = address;
+        this->dnsPort = port;
+        this->valid = false;
+        this->restart = this->is_resolving();
+    }
+}
+
+// Current target for the configured host. Once the cached records expire a new lookup starts and
+// the old targets stay in use until it answers. False while there is no target yet, is_resolving()
+// tells whether one is on its way.
+bool SIPResolver::resolve(struct sockaddr_in *destination) {
+    if (host[0] == 0) {
+        return false;
+    }
+    this->poll();
+    if (!valid || (int32_t)(millis() - expiresAt) >= 0) {
+        this->start_lookup();
+    }
+    if (!valid || current >= targetCount) {
+        return false;
+    }
+
+    memset(destination, 0, sizeof(*destination));
+    destination->sin_family = AF_INET;
+    destination->sin_port = htons(targets[current].port);
+    destination->sin_addr.s_addr = targets[current].address;
+    return true;
+}
+
+// Moves on to the next target, false once every target has been tried
+bool SIPResolver::mark_failed() {
+    if (!valid) {
+        return false;
+    }
+    if (current + 1 < targetCount) {
+        current++;
+        LOG_WARN("SIP registrar failover to %s:%u", targets[current].name, targets[current].port);
+        return true;
+    }
+    // Everything failed, start again from a fresh lookup
+    valid = false;
+    return false;
+}
+
+// Hands the settings to the resolver task, a literal address needs no lookup at all
+void SIPResolver::start_lookup() {
+    if (this->is_resolving()) {
+        return;
+    }
+    strlcpy(lookupHost, host, sizeof(lookupHost));
+    strlcpy(lookupService, service, sizeof(lookupService));
+    lookupPort = port;
+    lookupDnsServer = dnsServer;
+    lookupDnsPort = dnsPort;
+    restart = false;
+    foundCount = 0;
+    foundTtl = SIP_RESOLVER_MAX_TTL;
+
+    struct in_addr literal;
+    if (inet_aton(host, &literal)) {
+        this->add_target(host, literal.s_addr, port, 0, 0);
+        this->publish();
+        return;
+    }
+
+    SIPResolver *self = this;
+    lookupState.store(SIP_LOOKUP_BUSY, std::memory_order_release);
+    if (requests == NULL || xQueueSend(requests, &self, 0) != pdTRUE) {
+        LOG_ERROR("SIP resolver task not running");
+        lookupState.store(SIP_LOOKUP_IDLE, std::memory_order_relaxed);
+        this->publish();
+    }
+}
+
+// Picks up a finished lookup, called on the SIP task
+void SIPResolver::poll() {
+    if (lookupState.load(std::memory_order_acquire) != SIP_LOOKUP_DONE) {
+        return;
+    }
+    lookupState.store(SIP_LOOKUP_IDLE, std::memory_order_relaxed);
+    if (restart) {
+        // Answers a question nobody asks any more, the next resolve() looks up the new settings
+        restart = false;
+        valid = false;
+        return;
+    }
+    this->publish();
+}
+
+// The lookup's targets replace the cached ones, an empty answer is cached for a short while too
+void SIPResolver::publish() {
+    memcpy(targets, found, sizeof(targets));
+    targetCount = foundCount;
+    current = 0;
+    valid = true;
+
+    if (targetCount == 0) {
+        LOG_WARN("Could not resolve SIP server %s", host);
+        expiresAt = millis() + SIP_RESOLVER_NEGATIVE_TTL * 1000;
+        return;
+    }
+
+    uint32_t ttl = constrain(foundTtl, (uint32_t)SIP_RESOLVER_MIN_TTL, (uint32_t)SIP_RESOLVER_MAX_TTL);
+    expiresAt = millis() + ttl * 1000;
+    for (int t = 0; t < targetCount; t++) {
+        IPAddress address(targets[t].address);
+        LOG_INFO("SIP registrar %s -> %s:%u (ttl %lus)", targets[t].name, address.toString().c_str(), targets[t].port, (unsigned long)ttl);
+    }
+}
+
+void SIPResolver::add_target(const char *name, uint32_t address, uint16_t port, uint16_t priority, uint16_t weight) {
+    if (foundCount >= SIP_RESOLVER_MAX_TARGETS) {
+        return;
+    }
+    SIPTarget &t = found[foundCount++];
+    strlcpy(t.name, name, sizeof(t.name));
+    t.address = address;
+    t.port = port;
+    t.priority = priority;
+    t.weight = weight;
+}
+
+// Runs on the resolver task, reads only the lookup fields and fills in found
+void SIPResolver::refresh() {
+    uint32_t ttl = SIP_RESOLVER_MAX_TTL;
+    int first = 0;
+    int records = 0;
+    char name[SIP_RESOLVER_HOST_SIZE + sizeof(lookupService)];
+    snprintf(name, sizeof(name), "%s.%s", lookupService, lookupHost);
+    int length = lookupService[0] != 0 ? this->query(name, SIP_DNS_TYPE_SRV, &first, &records) : -1;
+
+    SIPDNSRecord record;
+    int offset = first;
+    for (int i = 0; length > 0 && i < records && offset > 0; i++) {
+        offset = this->read_record(length, offset, &record);
+        if (offset < 0 || record.type != SIP_DNS_TYPE_SRV || record.rdlength < 7) {
+            continue;
+        }
+        const uint8_t *rdata = buffer + record.rdata;
+        char target[SIP_RESOLVER_HOST_SIZE];
+        if (this->read_name(length, record.rdata + 6, target, sizeof(target)) < 0 || target[0] == 0) {
+            continue; // "." means the service is not offered
+        }
+        this->add_target(target, 0, (rdata[4] << 8) | rdata[5], (rdata[0] << 8) | rdata[1], (rdata[2] << 8) | rdata[3]);
+        ttl = min(ttl, record.ttl);
+    }
+
+    // Servers usually include the targets' A records as additional data
+    offset = first;
+    for (int i = 0; length > 0 && i < records && offset > 0; i++) {
+        offset = this->read_record(length, offset, &record);
+        if (offset < 0 || record.type != SIP_DNS_TYPE_A || record.rdlength != 4) {
+            continue;
+        }
+        for (int t = 0; t < foundCount; t++) {
+            if (found[t].address == 0 && strcasecmp(found[t].name, record.name) == 0) {
+                memcpy(&found[t].address, buffer + record.rdata, 4);
+                ttl = min(ttl, record.ttl);
+            }
+        }
+    }
+
+    if (foundCount == 0) {
+        this->add_target(lookupHost, 0, lookupPort, 0, 0);
+    }
+
+    // Resolve whatever the additional section left out, dropping targets that do not resolve
+    uint8_t resolved = 0;
+    for (int t = 0; t < foundCount; t++) {
+        uint32_t addressTtl = ttl;
+        if (found[t].address == 0 && !this->lookup_address(found[t].name, &found[t].address, &addressTtl)) {
+            continue;
+        }
+        ttl = min(ttl, addressTtl);
+        found[resolved++] = found[t];
+    }
+    foundCount = resolved;
+    foundTtl = ttl;
+    order_targets(found, foundCount);
+}
+
+// RFC 2782: lowest priority first, weighted random order within a priority
+void SIPResolver::order_targets(SIPTarget *targets, uint8_t count) {
+    for (int i = 1; i < count; i++) {
+        SIPTarget t = targets[i];
+        int j = i - 1;
+        while (j >= 0 && targets[j].priority > t.priority) {
+            targets[j + 1] = targets[j];
+            j--;
+        }
+        targets[j + 1] = t;
+    }
+
+    for (int start = 0; start < count; start++) {
+        uint32_t total = 0;
+        int end = start;
+        while (end < count && targets[end].priority == targets[start].priority) {
+            total += targets[end].weight;
+            end++;
+        }
+        uint32_t pick = random(total + 1);
+        uint32_t sum = 0;
+        for (int i = start; i < end; i++) {
+            sum += targets[i].weight;
+            if (sum >= pick) {
+                SIPTarget t = targets[start];
+                targets[start] = targets[i];
+                targets[i] = t;
+                break;
+            }
+        }
+    }
+}
+
+bool SIPResolver::lookup_address(const char *name, uint32_t *address, uint32_t *ttl) {
+    int first = 0;
+    int records = 0;
+    int length = this->query(name, SIP_DNS_TYPE_A, &first, &records);
+    if (length > 0) {
+        SIPDNSRecord record;
+        int offset = first;
+        for (int i = 0; i < records && offset > 0; i++) {
+            offset = this->read_record(length, offset, &record);
+            if (offset > 0 && record.type == SIP_DNS_TYPE_A && record.rdlength == 4) {
+                // Any CNAME chain ends in the A record we asked for
+                memcpy(address, buffer + record.rdata, 4);
+                *ttl = record.ttl;
+                return true;
+            }
+        }
+        return false;
+    }
+    if (lookupDnsServer != 0) {
+        return false;
+    }
+
+    // No DNS server known to us, let lwIP resolve it
+    struct addrinfo hints = {};
+    struct addrinfo *result = NULL;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(name, NULL, &hints, &result) != 0 || result == NULL) {
+        return false;
+    }
+    *address = ((struct sockaddr_in *)result->ai_addr)->sin_addr.s_addr;
+    *ttl = SIP_RESOLVER_MIN_TTL;
+    freeaddrinfo(result);
+    return true;
+}
+
+// Sends one query and waits for its answer, returns the response length plus where and how many records follow
+int SIPResolver::query(const char *name, uint16_t type, int *first, int *records) {
+    if (lookupDnsServer == 0) {
+        return -1;
+    }
+
+    uint16_t id = random(0x10000);
+    memset(buffer, 0, 12);
+    buffer[0] = id >> 8;
+    buffer[1] = id & 0xFF;
+    buffer[2] = 0x01; // Recursion desired
+    buffer[5] = 1;    // One question
+
+    int length = 12;
+    const char *label = name;
+    while (*label) {
+        const char *dot = strchr(label, '.');
+        size_t size = dot ? (size_t)(dot - label) : strlen(label);
+        if (size == 0 || size > 63 || length + size + 6 > sizeof(buffer)) {
+            return -1;
+        }
+        buffer[length++] = size;
+        memcpy(buffer + length, label, size);
+        length += size;
+        label += size;
+        if (*label == '.') label++;
+    }
+    buffer[length++] = 0;
+    buffer[length++] = type >> 8;
+    buffer[length++] = type & 0xFF;
+    buffer[length++] = 0;
+    buffer[length++] = 1; // IN
+
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0) {
+        return -1;
+    }
+    struct timeval timeout;
+    timeout.tv_sec = SIP_RESOLVER_TIMEOUT / 1000;
+    timeout.tv_usec = (SIP_RESOLVER_TIMEOUT % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in server = {};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(lookupDnsPort);
+    server.sin_addr.s_addr = lookupDnsServer;
+    sendto(fd, buffer, length, 0, (struct sockaddr *)&server, sizeof(server));
+
+    int received;
+    while (true) {
+        struct sockaddr_in source;
+        socklen_t sourceLength = sizeof(source);
+        received = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&source, &sourceLength);
+        if (received < 12) break;
+        if (source.sin_addr.s_addr == lookupDnsServer && ((buffer[0] << 8) | buffer[1]) == id) break;
+    }
+    close(fd);
+
+    // Must be a response with no error, NXDOMAIN has no records for us either
+    if (received < 12 || (buffer[2] & 0x80) == 0 || (buffer[3] & 0x0F) != 0) {
+        return -1;
+    }
+
+    // Step over the question, the answer, authority and additional records follow
+    int offset = 12;
+    for (int q = (buffer[4] << 8) | buffer[5]; q > 0; q--) {
+        offset = this->read_name(received, offset, nullptr, 0);
+        if (offset < 0 || offset + 4 > received) {
+            return -1;
+        }
+        offset += 4;
+    }
+    *records = ((buffer[6] << 8) | buffer[7]) + ((buffer[8] << 8) | buffer[9]) + ((buffer[10] << 8) | buffer[11]);
+
+    *first = offset;
+    return received;
+}
+
+int SIPResolver::read_record(int length, int offset, SIPDNSRecord *record) {
+    offset = this->read_name(length, offset, record->name, sizeof(record->name));
+    if (offset < 0 || offset + 10 > length) {
+        return -1;
+    }
+    const uint8_t *p = buffer + offset;
+    record->type = (p[0] << 8) | p[1];
+    record->ttl = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | (p[6] << 8) | p[7];
+    record->rdlength = (p[8] << 8) | p[9];
+    record->rdata = offset + 10;
+    if (record->rdata + record->rdlength > length) {
+        return -1;
+    }
+    return record->rdata + record->rdlength;
+}
+
+// Decodes a possibly compressed name, returns the offset just past it
+int SIPResolver::read_name(int length, int offset, char *name, size_t size) {
+    size_t out = 0;
+    int next = -1;
+    int jumps = 0;
+
+    while (true) {
+        if (offset >= length) {
+            return -1;
+        }
+        uint8_t label = buffer[offset];
+        if (label == 0) {
+            offset++;
+            break;
+        }
+        if ((label & 0xC0) == 0xC0) {
+            if (offset + 1 >= length || ++jumps > 16) {
+                return -1;
+            }
+            if (next < 0) next = offset + 2;
+            offset = ((label & 0x3F) << 8) | buffer[offset + 1];
+            continue;
+        }
+        if (label > 63 || offset + 1 + label > length) {
+            return -1;
+        }
+        if (name != nullptr) {
+            if (out + label + 2 > size) {
+                return -1;
+            }
+            if (out > 0) name[out++] = '.';
+            memcpy(name + out, buffer + offset + 1, label);
+            out += label;
+        }
+        offset += 1 + label;
+    }
+
+    if (name != nullptr) name[out] = 0;
+    return next >= 0 ? next : offset;
+}
@@ -0,0 +1,114 @@
+#ifndef SIPRESOLVER_H
+#define SIPRESOLVER_H
+#include <Arduino.h>
+#include <logger.h>
+#include "lwip/sockets.h"
+#include <atomic>
+
+#define SIP_RESOLVER_HOST_SIZE 64
+#define SIP_RESOLVER_MAX_TARGETS 4
+#define SIP_RESOLVER_MIN_TTL 30     // Seconds, floor for very short record TTLs
+#define SIP_RESOLVER_MAX_TTL 3600
+#define SIP_RESOLVER_NEGATIVE_TTL 30 // Retry a failed lookup after this long
+#define SIP_RESOLVER_TIMEOUT 1000    // Per DNS query, ms
+#define SIP_RESOLVER_BUFFER_SIZE 512 // Plain DNS over UDP
+
+#define SIP_RESOLVER_TASK_CORE 0 // lwIP runs on the PRO core
+#define SIP_RESOLVER_TASK_PRIORITY 2 // Below the SIP task, a slow lookup never holds up call handling
+#define SIP_RESOLVER_TASK_STACK 4096
+
+// A stand-in DNS server can be set with -D SIP_RESOLVER_DNS_SERVER=\"192.168.1.10\"
+#ifndef SIP_RESOLVER_DNS_PORT
+#define SIP_RESOLVER_DNS_PORT 53
+#endif
+
+#define SIP_DNS_TYPE_A 1
+#define SIP_DNS_TYPE_SRV 33
+
+struct SIPDNSRecord {
+    char name[SIP_RESOLVER_HOST_SIZE];
+    uint16_t type;
+    uint32_t ttl;
+    int rdata; // Offset of the record data in the response
+    uint16_t rdlength;
+};
+
+enum SIPLookupState {
+    SIP_LOOKUP_IDLE,
+    SIP_LOOKUP_BUSY, // Queued or running on the resolver task
+    SIP_LOOKUP_DONE  // Results wait for the SIP task to pick them up
+};
+
+struct SIPTarget {
+    char name[SIP_RESOLVER_HOST_SIZE];
+    uint32_t address; // Network byte order, 0 until resolved
+    uint16_t port;
+    uint16_t priority;
+    uint16_t weight;
+};
+
+// RFC 3263 style registrar lookup: SRV for the transport, then A, cached for the record TTL.
+// DNS queries block, so they run on one resolver task shared by every line. The SIP task only
+// starts a lookup and picks up its result, it never waits for the network under the line lock.
+class SIPResolver {
+    private:
+        // Owned by the SIP task, under the line lock
+        char host[SIP_RESOLVER_HOST_SIZE];
+        uint16_t port = 5060;
+        char service[12];             // SRV service label, empty to skip SRV
+        uint32_t dnsServer = 0;
+        uint16_t dnsPort = SIP_RESOLVER_DNS_PORT;
+
+        SIPTarget targets[SIP_RESOLVER_MAX_TARGETS];
+        uint8_t targetCount = 0;
+        uint8_t current = 0;
+        bool valid = false;
+        bool restart = false; // The settings changed while a lookup was running, its answer is stale
+        uint32_t expiresAt = 0;
+
+        // Handed over with lookupState, the resolver task owns them while a lookup is busy
+        std::atomic<uint8_t> lookupState;
+        char lookupHost[SIP_RESOLVER_HOST_SIZE];
+        uint16_t lookupPort = 0;
+        char lookupService[12];
+        uint32_t lookupDnsServer = 0;
+        uint16_t lookupDnsPort = SIP_RESOLVER_DNS_PORT;
+        SIPTarget found[SIP_RESOLVER_MAX_TARGETS];
+        uint8_t foundCount = 0;
+        uint32_t foundTtl = 0;
+
+        // Only the resolver task queries, so one buffer serves every line
+        static uint8_t buffer[SIP_RESOLVER_BUFFER_SIZE];
+        static QueueHandle_t requests;
+        static TaskHandle_t task;
+        static void (*notify)(void *arg);
+        static void *notifyArg;
+        static void lookup_task(void *arg);
+
+        void start_lookup();
+        void refresh();
+        void publish();
+        int query(const char *name, uint16_t type, int *first, int *records);
+        int read_record(int length, int offset, SIPDNSRecord *record);
+        int read_name(int length, int offset, char *name, size_t size);
+        bool lookup_address(const char *name, uint32_t *address, uint32_t *ttl);
+        void add_target(const char *name, uint32_t address, uint16_t port, uint16_t priority, uint16_t weight);
+        static void order_targets(SIPTarget *targets, uint8_t count);
+
+    public:
+        SIPResolver() : lookupState(SIP_LOOKUP_IDLE) { host[0] = 0; service[0] = 0; lookupHost[0] = 0; lookupService[0] = 0; }
+
+        // Starts the resolver task for up to lines resolvers, notify runs on it after each lookup to wake the SIP task
+        static void begin(size_t lines, void (*notify)(void *arg), void *arg);
+
+        void set_host(const char *host, uint16_t port, const char *service);
+        void set_dns_server(uint32_t address, uint16_t port = SIP_RESOLVER_DNS_PORT);
+        void invalidate() { valid = false; }
+
+        void poll();
+        bool resolve(struct sockaddr_in *destination);
+        bool is_resolving() const { return lookupState.load(std::memory_order_acquire) != SIP_LOOKUP_IDLE; }
+        bool mark_failed();
+        bool has_alternate() const { return valid && current + 1 < targetCount; }
+};
+#endif
@@ -0,0 +1,30 @@
+#ifndef SIP_SCHEDULE_H
+#define SIP_SCHEDULE_H
+#include <Arduino.h>
+
+// When a line next registers. Kept apart from SIPClient so the spread across a site can be simulated.
+
+#define SIP_REGISTER_EXPIRES 900 // 15 minutes, requested, the registrar may grant less
+#define SIP_REGISTER_REFRESH_MIN 50 // Refresh between 50% and 80% of the granted expiry
+#define SIP_REGISTER_REFRESH_MAX 80
+#define SIP_REGISTER_RETRY_BASE 5000
+#define SIP_REGISTER_RETRY_MAX 300000 // 5 minutes
+#define SIP_REGISTER_STARTUP_JITTER 15000 // Spreads a site-wide power cut over 15 seconds
+
+// First registration after boot
+inline uint32_t sip_register_startup() {
+    return random(SIP_REGISTER_STARTUP_JITTER);
+}
+
+// A random point in the refresh window keeps units that booted together apart
+inline uint32_t sip_register_refresh(uint32_t granted) {
+    return granted * 10 * random(SIP_REGISTER_REFRESH_MIN, SIP_REGISTER_REFRESH_MAX + 1);
+}
+
+// Capped exponential backoff with equal jitter, failures counts the attempts already failed
+inline uint32_t sip_register_retry(uint8_t failures) {
+    uint32_t delay = min<uint32_t>(SIP_REGISTER_RETRY_BASE << min<uint8_t>(failures, 6), SIP_REGISTER_RETRY_MAX);
+    return delay / 2 + random(delay / 2 + 1);
+}
+
+#endif
@@ -0,0 +1,350 @@
+#include <sip-stream.h>
+#include <sip-message.h>
+#include "esp_crt_bundle.h"
+
+SIPStream::SIPStream() {
+    mbedtls_net_init(&net);
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    mbedtls_ssl_session_init(&session);
+}
+
+// Starts connecting, progress() carries on once select() reports the socket ready
+bool SIPStream::open(uint32_t remoteIP, uint16_t remotePort, bool tls, const char *serverName, bool verify) {
+    this->close();
+    this->remoteIP = remoteIP;
+    this->remotePort = remotePort;
+    this->tls = tls;
+    this->verify = verify;
+    strlcpy(this->serverName, serverName, sizeof(this->serverName));
+    connectDeadline = millis() + SIP_STREAM_CONNECT_TIMEOUT;
+
+    if (!this->connect_socket()) {
+        LOG_WARN("SIP connection to %s failed", IPAddress(remoteIP).toString().c_str());
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+bool SIPStream::connect_socket() {
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        return false;
+    }
+
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in destination = {};
+    destination.sin_family = AF_INET;
+    destination.sin_port = htons(remotePort);
+    destination.sin_addr.s_addr = remoteIP;
+    if (connect(fd, (struct sockaddr *)&destination, sizeof(destination)) < 0 && errno != EINPROGRESS) {
+        return false;
+    }
+    state = SIP_STREAM_CONNECTING;
+    return true;
+}
+
+// Advances a connect or handshake in flight, false once it has failed and the stream is closed
+bool SIPStream::progress(uint32_t now) {
+    if (!this->is_connecting()) {
+        return state == SIP_STREAM_OPEN;
+    }
+
+    if (state == SIP_STREAM_CONNECTING) {
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(fd, &writable);
+        struct timeval poll = { 0, 0 };
+        if (select(fd + 1, NULL, &writable, NULL, &poll) > 0) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                LOG_WARN("SIP connection to %s refused", IPAddress(remoteIP).toString().c_str());
+                this->close();
+                return false;
+            }
+            if (!tls) {
+                this->established();
+                return true;
+            }
+            if (!this->start_tls()) {
+                this->close();
+                return false;
+            }
+        }
+    }
+
+    if (state == SIP_STREAM_HANDSHAKE && !this->continue_handshake()) {
+        this->close();
+        return false;
+    }
+    if (this->is_connecting() && (int32_t)(now - connectDeadline) >= 0) {
+        LOG_WARN("SIP connection to %s timed out", IPAddress(remoteIP).toString().c_str());
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+bool SIPStream::start_tls() {
+    if (!tlsReady) {
+        if (mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, NULL, 0) != 0 ||
+            mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+            LOG_ERROR("Could not set up TLS");
+            return false;
+        }
+        mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+        esp_crt_bundle_attach(&conf);
+        tlsReady = true;
+    }
+    // Lines whose PBX runs a private CA can turn verification off, it is required otherwise
+    mbedtls_ssl_conf_authmode(&conf, verify ? MBEDTLS_SSL_VERIFY_REQUIRED : MBEDTLS_SSL_VERIFY_NONE);
+
+    if (mbedtls_ssl_setup(&ssl, &conf) != 0) {
+        return false;
+    }
+    mbedtls_ssl_set_hostname(&ssl, serverName);
+    net.fd = fd;
+    mbedtls_ssl_set_bio(&ssl, &net, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+    // Resume the previous session so a reconnect after a flap skips the full handshake
+    if (sessionValid && mbedtls_ssl_set_session(&ssl, &session) != 0) {
+        sessionValid = false;
+    }
+    state = SIP_STREAM_HANDSHAKE;
+    handshakeWrites = false;
+    return true;
+}
+
+// One non-blocking handshake step, false when it failed
+bool SIPStream::continue_handshake() {
+    int result = mbedtls_ssl_handshake(&ssl);
+    if (result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        handshakeWrites = result == MBEDTLS_ERR_SSL_WANT_WRITE;
+        return true;
+    }
+    if (result != 0) {
+        if (mbedtls_ssl_get_verify_result(&ssl) != 0) {
+            LOG_WARN("SIP server certificate for %s could not be verified, connection refused", serverName);
+        } else {
+            LOG_WARN("SIP TLS handshake failed (-0x%x)", -result);
+        }
+        sessionValid = false;
+        return false;
+    }
+
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_session_init(&session);
+    sessionValid = mbedtls_ssl_get_session(&ssl, &session) == 0;
+    this->established();
+    return true;
+}
+
+void SIPStream::established() {
+    state = SIP_STREAM_OPEN;
+    lastActivity = millis();
+    pongDeadline = 0;
+    LOG_INFO("SIP %s connection to %s:%u open", tls ? "TLS" : "TCP", IPAddress(remoteIP).toString().c_str(), remotePort);
+}
+
+// Adds the socket to what the SIP task's select() waits for, returns the highest descriptor
+int SIPStream::watch(fd_set *readable, fd_set *writable, int maxFd) {
+    if (fd < 0) {
+        return maxFd;
+    }
+    bool write = state == SIP_STREAM_CONNECTING || (state == SIP_STREAM_HANDSHAKE && handshakeWrites) ||
+        (state == SIP_STREAM_OPEN && txLength > 0);
+    bool read = state == SIP_STREAM_OPEN || (state == SIP_STREAM_HANDSHAKE && !handshakeWrites);
+    if (write) FD_SET(fd, writable);
+    if (read) FD_SET(fd, readable);
+    return fd > maxFd ? fd : maxFd;
+}
+
+void SIPStream::close() {
+    if (fd >= 0) {
+        if (state == SIP_STREAM_OPEN && tls) {
+            mbedtls_ssl_close_notify(&ssl);
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    state = SIP_STREAM_CLOSED;
+    // Drops the record buffers, the session survives for resumption
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_init(&ssl);
+    net.fd = -1;
+    rxLength = 0;
+    txLength = 0;
+    tlsInFlight = 0;
+}
+
+void SIPStream::forget_session() {
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_session_init(&session);
+    sessionValid = false;
+}
+
+// Writes as much of the backlog as the socket takes, false once the connection is gone
+bool SIPStream::flush() {
+    while (state == SIP_STREAM_OPEN && txLength > 0) {
+        int result;
+        if (tls) {
+            size_t length = tlsInFlight > 0 ? tlsInFlight : txLength;
+            result = mbedtls_ssl_write(&ssl, (const unsigned char *)tx, length);
+            if (result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE) {
+                tlsInFlight = length;
+                return true;
+            }
+            tlsInFlight = 0;
+        } else {
+            result = ::send(fd, tx, txLength, MSG_DONTWAIT);
+            if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return true;
+            }
+        }
+        if (result <= 0) {
+            LOG_WARN("SIP connection write failed");
+            this->close();
+            return false;
+        }
+        memmove(tx, tx + result, txLength - result);
+        txLength -= result;
+        lastActivity = millis();
+    }
+    return state == SIP_STREAM_OPEN;
+}
+
+// Queues the message behind anything still waiting and sends what the socket takes now
+bool SIPStream::send(const char *data, size_t length) {
+    if (state != SIP_STREAM_OPEN) {
+        return false;
+    }
+    if (length > sizeof(tx) - txLength) {
+        LOG_WARN("SIP connection backlog full, closing");
+        this->close();
+        return false;
+    }
+    memcpy(tx + txLength, data, length);
+    txLength += length;
+    return this->flush();
+}
+
+// Reads whatever is waiting, false once the connection is gone
+bool SIPStream::receive() {
+    if (state != SIP_STREAM_OPEN) {
+        return false;
+    }
+
+    while (rxLength < sizeof(rx)) {
+        int result;
+        if (tls) {
+            result = mbedtls_ssl_read(&ssl, (unsigned char *)rx + rxLength, sizeof(rx) - rxLength);
+            if (result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE) break;
+            if (result == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) result = 0;
+        } else {
+            result = recv(fd, rx + rxLength, sizeof(rx) - rxLength, MSG_DONTWAIT);
+            if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        }
+        if (result <= 0) {
+            LOG_INFO("SIP connection closed by peer");
+            this->close();
+            return false;
+        }
+        rxLength += result;
+        lastActivity = millis();
+    }
+    return true;
+}
+
+void SIPStream::consume(size_t length) {
+    memmove(rx, rx + length, rxLength - length);
+    rxLength -= length;
+}
+
+// Frames the next message by its blank line and Content-Length (RFC 3261 18.3).
+// Returns its length, 0 while incomplete or -1 when the stream cannot be framed.
+int SIPStream::next_message(char *out, size_t capacity) {
+    // CRLF between messages: a double CRLF is a ping, a single one the pong (RFC 5626 3.5.1)
+    size_t crlf = 0;
+    while (crlf < rxLength && (rx[crlf] == '\r' || rx[crlf] == '\n')) crlf++;
+    if (crlf > 0) {
+        if (crlf == rxLength && (crlf & 1)) {
+            crlf--; // Wait for the rest of the CRLF
+        }
+        if (crlf >= 4) {
+            if (!this->send("\r\n", 2)) {
+                return 0; // The connection is gone
+            }
+        } else if (crlf >= 2) {
+            pongDeadline = 0;
+        }
+        this->consume(crlf);
+    }
+
+    const char *headerEnd = nullptr;
+    for (size_t i = 3; i < rxLength; i++) {
+        if (rx[i] == '\n' && rx[i - 1] == '\r' && rx[i - 2] == '\n' && rx[i - 3] == '\r') {
+            headerEnd = rx + i + 1;
+            break;
+        }
+    }
+    if (headerEnd == nullptr) {
+        return rxLength == sizeof(rx) ? -1 : 0;
+    }
+
+    SIPMessage headers;
+    headers.parse(rx, headerEnd - rx);
+    size_t total = (headerEnd - rx) + (headers.contentLength > 0 ? headers.contentLength : 0);
+    if (total > sizeof(rx)) {
+        return -1;
+    }
+    if (total > rxLength) {
+        return 0;
+    }
+    if (total >= capacity) {
+        // Too big for a receive slot, skip it like a truncated datagram
+        LOG_WARN("Discarding oversized SIP message");
+        this->consume(total);
+        return this->next_message(out, capacity);
+    }
+
+    memcpy(out, rx, total);
+    out[total] = 0;
+    this->consume(total);
+    return total;
+}
+
+// Sends the CRLF ping on an idle flow, false when the last one went unanswered
+bool SIPStream::handle_keepalive(uint32_t now) {
+    if (state != SIP_STREAM_OPEN) {
+        return false;
+    }
+    if (pongDeadline != 0 && (int32_t)(now - pongDeadline) >= 0) {
+        LOG_WARN("SIP connection keepalive unanswered");
+        this->close();
+        return false;
+    }
+    if (pongDeadline == 0 && now - lastActivity > SIP_STREAM_PING_INTERVAL) {
+        if (!this->send("\r\n\r\n", 4)) {
+            return false;
+        }
+        pongDeadline = now + SIP_STREAM_PONG_TIMEOUT;
+    }
+    return true;
+}
+
+// The CRLF ping once the flow has been idle, the deadline for its pong or for connecting
+uint32_t SIPStream::next_timeout(uint32_t now, uint32_t limit) {
+    if (this->is_connecting()) return timer_until(now, connectDeadline, limit);
+    if (state != SIP_STREAM_OPEN) return limit;
+    if (pongDeadline != 0) return timer_until(now, pongDeadline, limit);
+    return timer_until(now, lastActivity + SIP_STREAM_PING_INTERVAL + 1, limit);
+}
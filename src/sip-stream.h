@@ -0,0 +1,94 @@
+#ifndef SIPSTREAM_H
+#define SIPSTREAM_H
+#include <Arduino.h>
+#include <logger.h>
+#include <timer-wheel.h>
+#include "lwip/sockets.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+
+#define SIP_STREAM_BUFFER_SIZE 4096
+#define SIP_STREAM_TX_SIZE 2048         // Backlog while the socket's send buffer is full, fits any message we build
+#define SIP_STREAM_CONNECT_TIMEOUT 5000 // TCP connect and TLS handshake together, ms
+#define SIP_STREAM_PING_INTERVAL 30000  // RFC 5626 CRLF keepalive when the flow is idle
+#define SIP_STREAM_PONG_TIMEOUT 10000   // Flow is dead if the pong does not arrive
+#define SIP_STREAM_RECONNECT_JITTER 2000
+
+enum SIPTransport {
+    SIP_TRANSPORT_UDP,
+    SIP_TRANSPORT_TCP,
+    SIP_TRANSPORT_TLS
+};
+
+enum SIPStreamState {
+    SIP_STREAM_CLOSED,
+    SIP_STREAM_CONNECTING, // TCP connect in flight
+    SIP_STREAM_HANDSHAKE,  // TLS handshake in flight
+    SIP_STREAM_OPEN
+};
+
+// One persistent TCP or TLS connection to the registrar, carrying both directions.
+// Nothing here blocks: connect, handshake and writes advance whenever the SIP task's select()
+// reports the socket ready, so a slow registrar never holds up the other lines.
+class SIPStream {
+    private:
+        int fd = -1;
+        uint8_t state = SIP_STREAM_CLOSED;
+        bool tls = false;
+        bool verify = true;
+        uint32_t remoteIP = 0;
+        uint16_t remotePort = 0;
+        char serverName[64];
+        uint32_t connectDeadline = 0;
+        bool handshakeWrites = false; // The handshake waits for the socket to take more data
+
+        mbedtls_net_context net;
+        mbedtls_ssl_context ssl;
+        mbedtls_ssl_config conf;
+        mbedtls_entropy_context entropy;
+        mbedtls_ctr_drbg_context drbg;
+        mbedtls_ssl_session session; // Kept across reconnects for resumption
+        bool tlsReady = false;
+        bool sessionValid = false;
+
+        char rx[SIP_STREAM_BUFFER_SIZE];
+        size_t rxLength = 0;
+        char tx[SIP_STREAM_TX_SIZE];
+        size_t txLength = 0;
+        size_t tlsInFlight = 0; // A TLS write that wanted more room must be repeated with the same length
+
+        uint32_t lastActivity = 0;
+        uint32_t pongDeadline = 0;
+
+        bool connect_socket();
+        bool start_tls();
+        bool continue_handshake();
+        void established();
+        void consume(size_t length);
+
+    public:
+        SIPStream();
+
+        bool open(uint32_t remoteIP, uint16_t remotePort, bool tls, const char *serverName, bool verify = true);
+        bool progress(uint32_t now);
+        void close();
+        void forget_session();
+
+        bool is_open() const { return state == SIP_STREAM_OPEN; }
+        bool is_connecting() const { return state == SIP_STREAM_CONNECTING || state == SIP_STREAM_HANDSHAKE; }
+        bool is_peer(uint32_t address, uint16_t port) const { return state == SIP_STREAM_OPEN && remoteIP == address && remotePort == port; }
+        int watch(fd_set *readable, fd_set *writable, int maxFd);
+        uint32_t peer_address() const { return remoteIP; }
+        uint16_t peer_port() const { return remotePort; }
+
+        bool send(const char *data, size_t length);
+        bool flush();
+        bool receive();
+        bool pending() { return state == SIP_STREAM_OPEN && tls && mbedtls_ssl_get_bytes_avail(&ssl) > 0; }
+        int next_message(char *out, size_t capacity);
+        bool handle_keepalive(uint32_t now);
+        uint32_t next_timeout(uint32_t now, uint32_t limit);
+};
+#endif
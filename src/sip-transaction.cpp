@@ -0,0 +1,189 @@
+#include <sip-transaction.h>
+
+SIPServerTransaction *SIPTransactionTable::find(SIPView branch, uint32_t cseq, bool invite) {
+    if (branch.isEmpty()) return nullptr;
+    for (int i = 0; i < SIP_TRANSACTION_SLOTS; i++) {
+        SIPServerTransaction &t = slots[i];
+        if (t.state == SIP_TRANSACTION_FREE || t.invite != invite || t.cseq != cseq) continue;
+        if (branch.equals(t.branch)) return &t;
+    }
+    return nullptr;
+}
+
+// Lower ranks are reused first. A ringing INVITE is never evicted, its CANCEL or BYE must still find it.
+int SIPTransactionTable::eviction_rank(const SIPServerTransaction &t) {
+    if (t.state == SIP_TRANSACTION_FREE) return 0;
+    if (t.state != SIP_TRANSACTION_PROCEEDING) return 1;
+    return t.invite ? -1 : 2;
+}
+
+// False while every slot holds a ringing INVITE
+bool SIPTransactionTable::has_room() {
+    for (int i = 0; i < SIP_TRANSACTION_SLOTS; i++) {
+        if (eviction_rank(slots[i]) >= 0) return true;
+    }
+    return false;
+}
+
+SIPServerTransaction *SIPTransactionTable::create(SIPView branch, uint32_t cseq, bool invite, uint32_t remoteIP, uint16_t remotePort) {
+    if (branch.isEmpty() || branch.length >= SIP_TRANSACTION_BRANCH_SIZE) return nullptr;
+
+    // Prefer a free slot, then the oldest finished one, then the oldest pending non-INVITE
+    SIPServerTransaction *victim = nullptr;
+    int victimRank = SIP_TRANSACTION_SLOTS;
+    for (int i = 0; i < SIP_TRANSACTION_SLOTS; i++) {
+        SIPServerTransaction &t = slots[i];
+        int rank = eviction_rank(t);
+        if (rank < 0) continue;
+        if (victim == nullptr || rank < victimRank || (rank == victimRank && (int32_t)(t.created - victim->created) < 0)) {
+            victim = &t;
+            victimRank = rank;
+        }
+        if (rank == 0) break;
+    }
+    if (victim == nullptr) return nullptr;
+
+    SIPServerTransaction &t = *victim;
+    t.state = SIP_TRANSACTION_PROCEEDING;
+    t.invite = invite;
+    t.cseq = cseq;
+    memcpy(t.branch, branch.data, branch.length);
+    t.branch[branch.length] = 0;
+    t.toTag[0] = 0;
+    t.remoteIP = remoteIP;
+    t.remotePort = remotePort;
+    t.created = millis();
+    t.expires = t.created + (invite ? SIP_INVITE_PROCEEDING_TIMEOUT : SIP_TIMER_J);
+    t.retransmitAt = 0;
+    t.retransmitDelay = 0;
+    t.responseLength = 0;
+    return &t;
+}
+
+void SIPTransactionTable::store_response(SIPServerTransaction *transaction, const char *data, size_t length, bool final) {
+    if (transaction == nullptr) return;
+
+    if (length <= SIP_TRANSACTION_RESPONSE_SIZE) {
+        memcpy(transaction->response, data, length);
+        transaction->responseLength = length;
+    } else {
+        transaction->responseLength = 0;
+    }
+
+    if (!final) return;
+    uint32_t now = millis();
+    transaction->state = SIP_TRANSACTION_COMPLETED;
+    if (transaction->invite) {
+        // Timer G retransmits the final response until the ACK arrives, Timer H gives up.
+        // An uncached response cannot be retransmitted, the INVITE retransmissions go unanswered instead.
+        transaction->retransmitDelay = SIP_T1;
+        transaction->retransmitAt = transaction->responseLength > 0 ? now + SIP_T1 : 0;
+        transaction->expires = now + SIP_TIMER_H;
+    } else {
+        transaction->expires = now + SIP_TIMER_J;
+    }
+}
+
+void SIPTransactionTable::confirm(SIPServerTransaction *transaction) {
+    if (transaction == nullptr || transaction->state != SIP_TRANSACTION_COMPLETED) return;
+    transaction->state = SIP_TRANSACTION_CONFIRMED;
+    transaction->retransmitAt = 0;
+    transaction->expires = millis() + SIP_TIMER_I;
+}
+
+void SIPTransactionTable::expire(uint32_t now) {
+    for (int i = 0; i < SIP_TRANSACTION_SLOTS; i++) {
+        SIPServerTransaction &t = slots[i];
+        if (t.state != SIP_TRANSACTION_FREE && (int32_t)(now - t.expires) >= 0) {
+            t.state = SIP_TRANSACTION_FREE;
+        }
+    }
+}
+
+// Only Timer G needs the task awake, finished transactions are freed whenever it next runs
+uint32_t SIPTransactionTable::next_timeout(uint32_t now, uint32_t limit) {
+    for (int i = 0; i < SIP_TRANSACTION_SLOTS; i++) {
+        SIPServerTransaction &t = slots[i];
+        if (t.state == SIP_TRANSACTION_COMPLETED && t.retransmitAt != 0) {
+            limit = timer_until(now, t.retransmitAt, limit);
+        }
+    }
+    return limit;
+}
+
+void SIPTransactionTable::clear() {
+    for (int i = 0; i < SIP_TRANSACTION_SLOTS; i++) {
+        slots[i].state = SIP_TRANSACTION_FREE;
+    }
+}
+
+void SIPClientTransaction::start(const char *branch, uint32_t cseq, uint32_t remoteIP, uint16_t remotePort, const char *data, size_t length, uint32_t timeout, bool reliable) {
+    uint32_t now = millis();
+    this->state = SIP_CLIENT_TRYING;
+    this->cseq = cseq;
+    strlcpy(this->branch, branch, sizeof(this->branch));
+    this->remoteIP = remoteIP;
+    this->remotePort = remotePort;
+    this->expires = now + timeout;
+    this->retransmitDelay = SIP_T1;
+    this->retransmitAt = reliable ? 0 : now + SIP_T1; // No Timer E over TCP/TLS
+
+    if (length <= sizeof(request)) {
+        memcpy(request, data, length);
+        requestLength = length;
+    } else {
+        requestLength = 0;
+    }
+}
+
+bool SIPClientTransaction::matches(SIPView branch, uint32_t cseq) const {
+    return state != SIP_CLIENT_FREE && this->cseq == cseq && branch.equals(this->branch);
+}
+
+// A provisional response slows Timer E down to T2
+void SIPClientTransaction::proceeding() {
+    if (state != SIP_CLIENT_TRYING) return;
+    state = SIP_CLIENT_PROCEEDING;
+    retransmitDelay = SIP_T2;
+}
+
+void SIPClientTransaction::complete() {
+    state = SIP_CLIENT_COMPLETED;
+    expires = millis() + SIP_TIMER_K;
+}
+
+// True when Timer E fires, the caller resends the request
+bool SIPClientTransaction::retransmit_due(uint32_t now) {
+    if (!is_active() || requestLength == 0 || retransmitAt == 0 || (int32_t)(now - retransmitAt) < 0) {
+        return false;
+    }
+    if (state == SIP_CLIENT_TRYING) {
+        retransmitDelay = min<uint32_t>(retransmitDelay * 2, SIP_T2);
+    }
+    retransmitAt = now + retransmitDelay;
+    return true;
+}
+
+// True once when Timer F fires without a final response
+bool SIPClientTransaction::timed_out(uint32_t now) {
+    if (!is_active() || (int32_t)(now - expires) < 0) {
+        return false;
+    }
+    state = SIP_CLIENT_FREE;
+    return true;
+}
+
+void SIPClientTransaction::expire(uint32_t now) {
+    if (state == SIP_CLIENT_COMPLETED && (int32_t)(now - expires) >= 0) {
+        state = SIP_CLIENT_FREE;
+    }
+}
+
+// Timer E and Timer F while the request is outstanding
+uint32_t SIPClientTransaction::next_timeout(uint32_t now, uint32_t limit) {
+    if (!is_active()) return limit;
+    if (requestLength != 0 && retransmitAt != 0) {
+        limit = timer_until(now, retransmitAt, limit);
+    }
+    return timer_until(now, expires, limit);
+}
@@ -0,0 +1,111 @@
+#ifndef SIPTRANSACTION_H
+#define SIPTRANSACTION_H
+#include <Arduino.h>
+#include <sip-message.h>
+#include <sip-builder.h>
+#include <sip-dialog.h>
+#include <timer-wheel.h>
+
+#define SIP_TRANSACTION_SLOTS (SIP_MAX_DIALOGS + 4) // A ringing INVITE per dialog plus room for BYE, CANCEL, OPTIONS and NOTIFY
+#define SIP_TRANSACTION_RESPONSE_SIZE 768
+#define SIP_TRANSACTION_BRANCH_SIZE 64
+#define SIP_TRANSACTION_TAG_SIZE 12
+
+// RFC 3261 timer values for UDP
+#define SIP_T1 500
+#define SIP_T2 4000
+#define SIP_T4 5000
+#define SIP_TIMER_H (64 * SIP_T1) // Wait for ACK of an INVITE final response
+#define SIP_TIMER_I SIP_T4        // Absorb ACK retransmissions
+#define SIP_TIMER_J (64 * SIP_T1) // Absorb non-INVITE request retransmissions
+#define SIP_TIMER_F (64 * SIP_T1) // Non-INVITE client transaction timeout
+#define SIP_TIMER_K SIP_T4        // Absorb response retransmissions
+#define SIP_INVITE_PROCEEDING_TIMEOUT 300000 // Ringing INVITE without CANCEL or BYE
+
+enum SIPTransactionState {
+    SIP_TRANSACTION_FREE,
+    SIP_TRANSACTION_PROCEEDING,
+    SIP_TRANSACTION_COMPLETED,
+    SIP_TRANSACTION_CONFIRMED
+};
+
+enum SIPClientTransactionState {
+    SIP_CLIENT_FREE,
+    SIP_CLIENT_TRYING,
+    SIP_CLIENT_PROCEEDING,
+    SIP_CLIENT_COMPLETED
+};
+
+struct SIPServerTransaction {
+    uint8_t state;
+    bool invite;
+    uint32_t cseq;
+    char branch[SIP_TRANSACTION_BRANCH_SIZE];
+    char toTag[SIP_TRANSACTION_TAG_SIZE];
+
+    uint32_t remoteIP;
+    uint16_t remotePort;
+
+    uint32_t created;
+    uint32_t expires;         // millis() deadline for the current state
+    uint32_t retransmitAt;    // Timer G, INVITE final responses only
+    uint32_t retransmitDelay;
+
+    uint16_t responseLength;  // 0 when the response was too long to cache, nothing is replayed
+    char response[SIP_TRANSACTION_RESPONSE_SIZE];
+};
+
+// Fixed-capacity server transaction table keyed by Via branch and CSeq
+class SIPTransactionTable {
+    private:
+        SIPServerTransaction slots[SIP_TRANSACTION_SLOTS];
+
+        static int eviction_rank(const SIPServerTransaction &t);
+
+    public:
+        SIPTransactionTable() { clear(); }
+
+        SIPServerTransaction *find(SIPView branch, uint32_t cseq, bool invite);
+        SIPServerTransaction *create(SIPView branch, uint32_t cseq, bool invite, uint32_t remoteIP, uint16_t remotePort);
+        void store_response(SIPServerTransaction *transaction, const char *data, size_t length, bool final);
+        void confirm(SIPServerTransaction *transaction);
+        void expire(uint32_t now);
+        void clear();
+        uint32_t next_timeout(uint32_t now, uint32_t limit);
+        bool has_room();
+
+        int capacity() const { return SIP_TRANSACTION_SLOTS; }
+        SIPServerTransaction &slot(int i) { return slots[i]; }
+};
+// Non-INVITE client transaction (RFC 3261 17.1.2), retransmits its request on Timer E
+class SIPClientTransaction {
+    private:
+        uint8_t state = SIP_CLIENT_FREE;
+        uint32_t cseq = 0;
+        char branch[SIP_TRANSACTION_BRANCH_SIZE];
+        uint32_t expires = 0;        // Timer F while active, Timer K once completed
+        uint32_t retransmitAt = 0;   // Timer E
+        uint32_t retransmitDelay = 0;
+
+    public:
+        uint32_t remoteIP = 0;
+        uint16_t remotePort = 0;
+        uint16_t requestLength = 0;
+        char request[SIP_TX_BUFFER_SIZE];
+
+        SIPClientTransaction() { branch[0] = 0; }
+
+        void start(const char *branch, uint32_t cseq, uint32_t remoteIP, uint16_t remotePort, const char *data, size_t length, uint32_t timeout = SIP_TIMER_F, bool reliable = false);
+        bool matches(SIPView branch, uint32_t cseq) const;
+        void proceeding();
+        void complete();
+        bool retransmit_due(uint32_t now);
+        bool timed_out(uint32_t now);
+        void expire(uint32_t now);
+        void clear() { state = SIP_CLIENT_FREE; }
+        uint32_t next_timeout(uint32_t now, uint32_t limit);
+
+        bool is_active() const { return state == SIP_CLIENT_TRYING || state == SIP_CLIENT_PROCEEDING; }
+        bool is_completed() const { return state == SIP_CLIENT_COMPLETED; }
+};
+#endif
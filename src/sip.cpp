@@ -1,425 +1,1068 @@
 #include <sip.h>
+void SIPClient::generateCallID(char *callID, size_t size) {
+    IPAddress localIP = ETH.localIP();
+    snprintf(callID, size, "%lu@%u.%u.%u.%u", (unsigned long)random(100000000), localIP[0], localIP[1], localIP[2], localIP[3]);
+}
+
+void SIPClient::generateTag(char *tag, size_t size) {
+    snprintf(tag, size, "%lu", (unsigned long)random(100000000));
+}
 
-String SIPClient::generateCallID() {
-    String localIP = ETH.localIP().toString();
-    return String(random(100000000)) + "@" + localIP;
+bool SIPClient::is_registered() {
+    return sipRegistered;
 }
 
-String SIPClient::generateTag() {
-    return String(random(100000000));
+bool SIPClient::is_ringing() {
+    return ringing;
 }
 
-String SIPClient::calculateMD5(String input) {
-    MD5Builder md5;
-    md5.begin();
-    md5.add(input);
-    md5.calculate();
-    return md5.toString();
+void SIPClient::set_registered(bool registered) {
+    if (sipRegistered == registered) return;
+    sipRegistered = registered;
+    this->post_event(registered ? SIP_EVENT_REGISTERED : SIP_EVENT_UNREGISTERED);
 }
 
-String SIPClient::extractParameter(String message, String startDelim, String endDelim) {
-    int startIdx = message.indexOf(startDelim);
-    if (startIdx == -1) return "";
-    
-    startIdx += startDelim.length();
-    int endIdx = message.indexOf(endDelim, startIdx);
-    if (endIdx == -1) {
-        // If endDelim not found, take rest of string (may need trimming)
-        String result = message.substring(startIdx);
-        result.trim();
-        return result;
+void SIPClient::set_ringing(bool ringing) {
+    if (this->ringing == ringing) return;
+    this->ringing = ringing;
+    this->post_event(ringing ? SIP_EVENT_RINGING : SIP_EVENT_IDLE);
+}
+
+void SIPClient::post_event(uint8_t type) {
+    if (eventQueue == NULL) return;
+    SIPLineEvent event = { lineIndex, type, rxTimestamp };
+    if (xQueueSend(eventQueue, &event, 0) != pdTRUE) {
+        LOG_WARN("SIP line event queue full, state change dropped");
+        return;
+    }
+    if (eventTask != NULL) {
+        xTaskNotifyGive(eventTask);
     }
-    
-    String result = message.substring(startIdx, endIdx);
-    result.trim();
-    return result;
 }
 
-bool SIPClient::is_registered() {
-    return sipRegistered;
+// The task that consumes the queue is notified too, it may be asleep until its next timer
+void SIPClient::set_event_queue(QueueHandle_t queue, uint8_t line, TaskHandle_t task) {
+    this->eventQueue = queue;
+    this->lineIndex = line;
+    this->eventTask = task;
 }
 
-bool SIPClient::is_ringing() {
-    return currentCallID != "";
+void SIPClient::set_endpoint(SIPEndpoint *endpoint) {
+    SIPLock lock(sipMutex);
+    this->endpoint = endpoint;
+    this->tx = SIPMessageBuilder(endpoint->tx_buffer(), SIP_TX_BUFFER_SIZE);
+    this->render_static_headers();
 }
 
 void SIPClient::end_registration(bool networkLost) {
-    this->sipRegistered = false;
-    this->currentCallID = "";
-    this->currentFromTag = "";
-    this->currentToTag = "";
+    SIPLock lock(sipMutex);
+    this->set_registered(false);
+    this->dialogs.clear();
+    this->set_ringing(false);
     this->authAttempts = 0;
+    this->registrationStarted = 0;
+    this->transactions.clear();
+    this->registerScheduled = false;
+    this->registerTransaction.clear();
 }
 
-void SIPClient::update_credentials(String sipServer, int sipPort, String sipUsername, String sipPassword, String sipRealm) {
-    if (this->is_registered()) {
-        this->end_registration(false);
-    }
+void SIPClient::update_credentials(String sipServer, int sipPort, String sipUsername, String sipPassword, String sipRealm, int sipTransport,
+    int sipMode, String sipMonitor, bool sipVerify) {
+    SIPLock lock(sipMutex);
+    // Whatever state the line is in, nothing in flight for the old settings may complete under the new ones
+    this->end_registration(false);
+    this->keepaliveOutstanding = false;
 
     this->sipServer = sipServer;
     this->sipPort = sipPort;
     this->sipUsername = sipUsername;
     this->sipPassword = sipPassword;
     this->sipRealm = sipRealm;
+    this->sipTransport = sipTransport;
+    this->sipMode = sipMode;
+    this->sipMonitor = sipMonitor;
+    this->sipVerify = sipVerify;
+    this->watched.clear();
+    this->set_ringing(false);
+
+    // A new server or transport needs a new connection and a full TLS handshake
+    this->stream.close();
+    this->stream.forget_session();
+    this->streamUp = false;
+
+    this->digest.reset();
+    this->configure_registrar();
+    this->render_static_headers();
+    this->new_registration_identity();
+    this->registerExpires = sipMode == SIP_MODE_MONITOR ? SIP_SUBSCRIBE_EXPIRES : SIP_REGISTER_EXPIRES;
+    this->registerFailures = 0;
+}
+
+// Call-ID and From tag shared by a REGISTER and all of its refreshes
+void SIPClient::new_registration_identity() {
+    generateCallID(registerCallID, sizeof(registerCallID));
+    generateTag(registerFromTag, sizeof(registerFromTag));
+    generateCallID(keepaliveCallID, sizeof(keepaliveCallID));
+    subscribeToTag[0] = 0;
+    registerCSeq = 0;
+    keepaliveCSeq = 0;
+}
+
+// SRV applies only when the port was left at the transport's default (RFC 3263 4.2)
+void SIPClient::configure_registrar() {
+    const char *service = nullptr;
+    if (sipTransport == SIP_TRANSPORT_TLS) {
+        if (sipPort == 5061) service = "_sips._tcp";
+    } else if (sipPort == 5060) {
+        service = sipTransport == SIP_TRANSPORT_TCP ? "_sip._tcp" : "_sip._udp";
+    }
+    registrar.set_host(sipServer.c_str(), sipPort, service);
+}
+
+// Pre-render the header text that only changes with credentials or the local IP
+void SIPClient::render_static_headers() {
+    IPAddress localIP = ETH.localIP();
+    int localPort = endpoint != nullptr ? endpoint->local_port() : SIP_LOCAL_PORT;
+    char hostPort[24];
+    snprintf(hostPort, sizeof(hostPort), "%u.%u.%u.%u:%d", localIP[0], localIP[1], localIP[2], localIP[3], localPort);
+
+    snprintf(requestUri, sizeof(requestUri), "sip:%s", sipServer.c_str());
+    snprintf(addressOfRecord, sizeof(addressOfRecord), "<sip:%s@%s>", sipUsername.c_str(), sipServer.c_str());
+    static const char *transports[] = { "UDP", "TCP", "TLS" };
+    static const char *contactTransports[] = { "", ";transport=tcp", ";transport=tls" };
+    int transport = constrain(sipTransport, SIP_TRANSPORT_UDP, SIP_TRANSPORT_TLS);
+    snprintf(viaPrefix, sizeof(viaPrefix), "Via: SIP/2.0/%s %s;branch=", transports[transport], hostPort);
+    snprintf(contactUri, sizeof(contactUri), "sip:%s@%s%s", sipUsername.c_str(), hostPort, contactTransports[transport]);
+    snprintf(contactHeader, sizeof(contactHeader), "Contact: <%s>\r\n", contactUri);
+    snprintf(targetUri, sizeof(targetUri), "sip:%s@%s", sipMonitor.c_str(), sipServer.c_str());
+}
+
+// The next REGISTER, or SUBSCRIBE for a monitor line, into the transmit buffer
+void SIPClient::write_registration(const char *branch, bool authorize) {
+    registerCSeq++;
+    if (sipMode == SIP_MODE_MONITOR) {
+        this->write_subscribe_headers(branch, registerCSeq);
+    } else {
+        this->write_register_headers(branch, registerCSeq);
+    }
+    if (authorize) {
+        digest.write_authorization(tx, this->registration_method(), this->registration_uri(), sipUsername, sipPassword);
+    }
+    if (sipMode == SIP_MODE_MONITOR) {
+        tx.append("Event: dialog\r\n");
+        tx.append("Accept: application/dialog-info+xml\r\n");
+        tx.append("Expires: ").appendNumber(registerExpires).append("\r\n");
+        tx.append(SIP_USER_AGENT_HEADER);
+        tx.end();
+    } else {
+        this->write_register_trailer();
+    }
+}
+
+// Writes a REGISTER up to (and including) Contact, callers add any Authorization
+void SIPClient::write_register_headers(const char *branch, uint32_t cseq) {
+    tx.reset();
+    tx.append("REGISTER ").append(requestUri).append(" SIP/2.0\r\n");
+    tx.append(viaPrefix).append(branch).append(";rport\r\n");
+    tx.append(SIP_MAX_FORWARDS_HEADER);
+    tx.append("From: ").append(addressOfRecord).append(";tag=").append(registerFromTag).append("\r\n");
+    tx.append("To: ").append(addressOfRecord).append("\r\n");
+    tx.append("Call-ID: ").append(registerCallID).append("\r\n");
+    tx.append("CSeq: ").appendNumber(cseq).append(" REGISTER\r\n");
+    tx.append(contactHeader);
+}
+
+// Refreshes carry the notifier's tag and stay in the subscription dialog
+void SIPClient::write_subscribe_headers(const char *branch, uint32_t cseq) {
+    tx.reset();
+    tx.append("SUBSCRIBE ").append(targetUri).append(" SIP/2.0\r\n");
+    tx.append(viaPrefix).append(branch).append(";rport\r\n");
+    tx.append(SIP_MAX_FORWARDS_HEADER);
+    tx.append("From: ").append(addressOfRecord).append(";tag=").append(registerFromTag).append("\r\n");
+    tx.append("To: <").append(targetUri).append(">");
+    if (subscribeToTag[0] != 0) {
+        tx.append(";tag=").append(subscribeToTag);
+    }
+    tx.append("\r\n");
+    tx.append("Call-ID: ").append(registerCallID).append("\r\n");
+    tx.append("CSeq: ").appendNumber(cseq).append(" SUBSCRIBE\r\n");
+    tx.append(contactHeader);
+}
+
+void SIPClient::write_register_trailer() {
+    tx.append(SIP_ALLOW_HEADER);
+    tx.append("Expires: ").appendNumber(registerExpires).append("\r\n");
+    tx.append(SIP_USER_AGENT_HEADER);
+    tx.end();
+}
+
+// Status line plus the dialog-identifying headers copied from a request
+void SIPClient::write_response_headers(const SIPMessage &message, const char *status, const char *toTag, const char *cseqMethod) {
+    tx.reset();
+    tx.append("SIP/2.0 ").append(status).append("\r\n");
+    if (!message.viaBlock.isEmpty()) {
+        tx.append(message.viaBlock).append("\r\n");
+    }
+    tx.header("From", message.from);
+    tx.append("To: ").append(message.to);
+    if (toTag != nullptr && message.toTag.isEmpty()) {
+        tx.append(";tag=").append(toTag);
+    }
+    tx.append("\r\n");
+    tx.header("Call-ID", message.callId);
+    if (cseqMethod != nullptr) {
+        tx.append("CSeq: ").appendNumber(message.cseqNumber).append(" ").append(cseqMethod).append("\r\n");
+    } else {
+        tx.header("CSeq", message.cseq);
+    }
+}
+
+// Sends the response in the transmit buffer and caches it on the active server transaction.
+// One that overflowed the buffer is never sent cut short, a bare 500 goes in its place.
+void SIPClient::send_response(const SIPMessage &request, IPAddress remoteIP, int remotePort, bool final) {
+    if (!tx.ok()) {
+        LOG_WARN("SIP response to %.*s does not fit the transmit buffer, answering 500", (int)request.method.length, request.method.data);
+        this->write_response_headers(request, "500 Server Internal Error", nullptr);
+        tx.end();
+        if (!tx.ok()) {
+            LOG_ERROR("SIP response to %.*s dropped, its headers alone overflow", (int)request.method.length, request.method.data);
+            return;
+        }
+        if (request.method.equals("INVITE")) {
+            // The call was refused, it must not keep ringing
+            dialogs.remove(request.callId);
+            this->set_ringing(dialogs.has_early());
+        }
+        final = true;
+    }
+    this->send_sip_message(remoteIP, remotePort, tx.data(), tx.size());
+    if (activeTransaction != nullptr && tx.size() > SIP_TRANSACTION_RESPONSE_SIZE) {
+        LOG_WARN("SIP response to %.*s too long to cache, retransmissions will not be answered", (int)request.method.length,
+            request.method.data);
+    }
+    transactions.store_response(activeTransaction, tx.data(), tx.size(), final);
 }
 
 void SIPClient::begin_registration() {
+    SIPLock lock(sipMutex);
+    registerScheduled = false;
     if (sipServer.isEmpty() || sipUsername.isEmpty()) {
         return;
     }
+    if (!sipRegistered && registrationStarted == 0) {
+        registrationStarted = millis() | 1;
+    }
     
-    Serial.println("Registering to SIP server...");
-    
-    // Get current IP
-    String localIP = ETH.localIP().toString();
-    
-    // Generate call ID and tag
-    String callID = generateCallID();
-    String fromTag = generateTag();
-    String branch = "z9hG4bK" + generateTag();
-    
-    // Build REGISTER request (RFC 3261 compliant)
-    String registerMsg = "REGISTER sip:" + sipServer + " SIP/2.0\r\n";
-    registerMsg += "Via: SIP/2.0/UDP " + localIP + ":" + String(localSipPort) + ";branch=" + branch + ";rport\r\n";
-    registerMsg += "Max-Forwards: 70\r\n";
-    registerMsg += "From: <sip:" + sipUsername + "@" + sipServer + ">;tag=" + fromTag + "\r\n";
-    registerMsg += "To: <sip:" + sipUsername + "@" + sipServer + ">\r\n";
-    registerMsg += "Call-ID: " + callID + "\r\n";
-    registerMsg += "CSeq: 1 REGISTER\r\n";
-    registerMsg += "Contact: <sip:" + sipUsername + "@" + localIP + ":" + String(localSipPort) + ">\r\n";
-    registerMsg += "Allow: INVITE, ACK, CANCEL, BYE, OPTIONS\r\n";
-    registerMsg += "Expires: ";
-    registerMsg += String(SIP_REGISTER_EXPIRES);
-    registerMsg += "\r\n";
-    registerMsg += "User-Agent: ";
-    registerMsg += SIP_USER_AGENT;
-    registerMsg += "\r\n";
-    registerMsg += "Content-Length: 0\r\n";
-    registerMsg += "\r\n";
+    struct sockaddr_in destination;
+    if (!registrar.resolve(&destination)) {
+        if (registrar.is_resolving()) {
+            // Runs again once the resolver task has the answer, it wakes the SIP task
+            registerScheduled = true;
+            nextRegisterAt = millis();
+            return;
+        }
+        this->registration_failed(false);
+        return;
+    }
+    LOG_INFO("Registering to SIP server %s...", sipServer.c_str());
+    IPAddress remoteIP(destination.sin_addr.s_addr);
+    int remotePort = ntohs(destination.sin_port);
+    if (sipTransport != SIP_TRANSPORT_UDP && !stream.is_peer((uint32_t)remoteIP, remotePort)) {
+        if (!this->open_stream(remoteIP, remotePort)) {
+            registrar.mark_failed();
+            this->registration_failed(false);
+            return;
+        }
+        // Runs again once handle_stream() has the connection up
+        registerScheduled = true;
+        nextRegisterAt = millis();
+        return;
+    }
+
+    // Build REGISTER request (RFC 3261 compliant), refreshes reuse the Call-ID
+    // Answer the last challenge up front with the next nonce count, saving the 401 round trip
+    char branch[24];
+    snprintf(branch, sizeof(branch), "z9hG4bK%lu", (unsigned long)random(100000000));
+    this->write_registration(branch, digest.has_nonce());
     
     // Send REGISTER
-    this->send_sip_message(sipServer.c_str(), sipPort, registerMsg);
-    
-    lastRegisterTime = millis();
-    
-    Serial.println("REGISTER sent:");
-    Serial.println(registerMsg);
+    this->send_register(remoteIP, remotePort, branch);
 }
 
-void SIPClient::send_sip_message(String remoteIP, int remotePort, String message) {
-    udpSIP.beginPacket(remoteIP.c_str(), remotePort);
-    udpSIP.write((const uint8_t*)message.c_str(), message.length());
-    udpSIP.endPacket();
-    Serial.println("SIP Message sent:");
-    Serial.println(message);
+// Sends the REGISTER in the transmit buffer inside a new client transaction
+void SIPClient::send_register(IPAddress remoteIP, int remotePort, const char *branch) {
+    if (!tx.ok()) {
+        LOG_ERROR("SIP %s does not fit the transmit buffer, not sent", this->registration_method());
+        this->registration_failed(false);
+        return;
+    }
+    // Give up on a registrar sooner when the resolver has another one to try
+    uint32_t timeout = registrar.has_alternate() ? SIP_REGISTER_FAILOVER_TIMEOUT : SIP_TIMER_F;
+    bool reliable = stream.is_peer((uint32_t)remoteIP, remotePort);
+    registrarAddress = (uint32_t)remoteIP;
+    registerTransaction.start(branch, registerCSeq, (uint32_t)remoteIP, remotePort, tx.data(), tx.size(), timeout, reliable);
+    this->send_sip_message(remoteIP, remotePort, tx.data(), tx.size());
 }
 
-void SIPClient::handle_auth_challenge(String message, String remoteIP, int remotePort) {
-    // Extract nonce and realm from challenge
-    String nonce = extractParameter(message, "nonce=\"", "\"");
-    String realm = extractParameter(message, "realm=\"", "\"");
-    String algorithm = extractParameter(message, "algorithm=", ",");
-    if (algorithm.isEmpty()) {
-        algorithm = extractParameter(message, "algorithm=", "\r");
+void SIPClient::schedule_registration(uint32_t delay) {
+    SIPLock lock(sipMutex);
+    nextRegisterAt = millis() + delay;
+    registerScheduled = true;
+    if (endpoint != nullptr) {
+        // The SIP task may be asleep until a later deadline
+        endpoint->wake();
     }
-    
-    // Clean up algorithm - remove quotes and whitespace
-    algorithm.trim();
-    algorithm.replace("\"", "");
-    if (algorithm.isEmpty()) {
-        algorithm = "MD5";  // Default to MD5
+}
+
+// Our binding's expires parameter wins over the Expires header (RFC 3261 10.2.4)
+uint32_t SIPClient::granted_expiry(const SIPMessage &message) {
+    long matched = -1;
+    long first = -1;
+    int bindings = 0;
+
+    SIPView contacts = message.contact;
+    while (!contacts.isEmpty()) {
+        SIPView uri = SIPMessage::headerUri(contacts);
+        SIPView expires;
+        if (SIPMessage::headerParameter(contacts, "expires", expires)) {
+            if (first < 0) first = expires.toInt();
+            if (uri.equalsIgnoreCase(contactUri)) matched = expires.toInt();
+        }
+        bindings++;
+
+        // Registrars list every binding of the AOR, comma separated
+        const char *p = uri.data + uri.length;
+        const char *end = contacts.data + contacts.length;
+        bool quoted = false;
+        while (p < end && (quoted || *p != ',')) {
+            if (*p == '"') quoted = !quoted;
+            p++;
+        }
+        if (p >= end) break;
+        contacts = SIPView(p + 1, end - p - 1).trim();
     }
-    
-    // Extract Call-ID, From tag, and CSeq from the 401 response
-    String callID = extractParameter(message, "Call-ID: ", "\r\n");
-    callID.trim();
-    
-    String fromHeader = extractParameter(message, "From: ", "\r\n");
-    String fromTag = extractParameter(fromHeader, ";tag=", "\r");
-    if (fromTag.indexOf(">") > 0) {
-        fromTag = fromTag.substring(0, fromTag.indexOf(">"));
+
+    long granted = registerExpires;
+    if (matched >= 0) {
+        granted = matched;
+    } else if (bindings == 1 && first >= 0) {
+        granted = first;
+    } else if (!message.expires.isEmpty()) {
+        granted = message.expires.toInt();
+    }
+    return min<long>(granted, 86400);
+}
+
+void SIPClient::registration_succeeded(const SIPMessage &message) {
+    authAttempts = 0;
+
+    uint32_t granted = this->granted_expiry(message);
+    if (granted == 0) {
+        LOG_WARN("SIP registrar did not keep our binding");
+        this->registration_failed(true);
+        return;
     }
-    if (fromTag.indexOf(",") > 0) {
-        fromTag = fromTag.substring(0, fromTag.indexOf(","));
+    registerFailures = 0;
+    registeredUntil = millis() + granted * 1000;
+    lineStats.registrations++;
+    if (registrationStarted != 0) {
+        metrics.timeToRegistered.observe(millis() - registrationStarted);
+        registrationStarted = 0;
     }
-    fromTag.trim();
-    
-    String cseqLine = extractParameter(message, "CSeq: ", "\r\n");
-    String cseqNum = cseqLine.substring(0, cseqLine.indexOf(" "));
-    int cseq = cseqNum.toInt();
-    
-    if (realm.isEmpty() && !sipRealm.isEmpty()) {
-        realm = sipRealm;
+
+    uint32_t refresh = sip_register_refresh(granted);
+    this->schedule_registration(refresh);
+
+    // The REGISTER answer proves the path as well as a probe would
+    if (!sipRegistered) {
+        keepaliveInterval = SIP_KEEPALIVE_MIN_INTERVAL;
+        keepaliveMisses = 0;
+    }
+    keepaliveOutstanding = false;
+    nextKeepaliveAt = millis() + keepaliveInterval;
+    this->set_registered(true);
+    LOG_INFO("%s%s successful! Granted %lus, refresh in %lus", sipMode == SIP_MODE_MONITOR ? "Subscription to " : "SIP registration",
+        sipMode == SIP_MODE_MONITOR ? sipMonitor.c_str() : "", (unsigned long)granted, (unsigned long)(refresh / 1000));
+}
+
+// A timeout keeps the current binding until it expires, a rejection drops it now
+void SIPClient::registration_failed(bool rejected) {
+    authAttempts = 0;
+    lineStats.registrationFailures++;
+    if (rejected) {
+        this->set_registered(false);
+    }
+
+    uint32_t delay = sip_register_retry(registerFailures);
+    if (registerFailures < 255) registerFailures++;
+    this->schedule_registration(delay);
+    LOG_INFO("SIP registration retry in %lus", (unsigned long)(delay / 1000));
+}
+
+// Anything for the registrar connection's peer goes over the connection, the rest over UDP
+void SIPClient::send_sip_message(IPAddress remoteIP, int remotePort, const char *message, size_t length) {
+    if (stream.is_peer((uint32_t)remoteIP, remotePort)) {
+        stream.send(message, length);
+    } else if (endpoint != nullptr) {
+        endpoint->send((uint32_t)remoteIP, remotePort, message, length);
+    } else {
+        return;
+    }
+    if (endpoint != nullptr) {
+        endpoint->capture.record(SIP_CAPTURE_OUT, (uint32_t)remoteIP, remotePort, message, length);
+    }
+
+    // Only the start line is traced, dumping the whole message would hold up the SIP task
+    const char *lineEnd = (const char *)memchr(message, '\r', length);
+    LOG_DEBUG("SIP >> %.*s (%u bytes)", (int)(lineEnd != nullptr ? lineEnd - message : length), message, (unsigned)length);
+}
+
+void SIPClient::handle_auth_challenge(const SIPMessage &message, IPAddress remoteIP, int remotePort) {
+    if (!digest.challenge(message, sipRealm)) {
+        if (message.challengeCount == 0) {
+            LOG_ERROR("Authentication requested without a Digest challenge");
+        }
+        for (int i = 0; i < message.challengeCount; i++) {
+            const SIPView &algorithm = message.challenges[i].algorithm;
+            LOG_ERROR("Unsupported authentication challenge (algorithm %.*s)", (int)algorithm.length, algorithm.data);
+        }
+        this->registration_failed(true);
+        return;
     }
     
-    Serial.println("=== Authentication Challenge ===");
-    Serial.println("Nonce: " + nonce);
-    Serial.println("Realm: " + realm);
-    Serial.println("Algorithm: " + algorithm);
-    Serial.println("Call-ID: " + callID);
-    Serial.println("From Tag: " + fromTag);
-    Serial.println("CSeq: " + String(cseq));
-    Serial.println("==============================");
-    
-    // Get current IP
-    String localIP = ETH.localIP().toString();
-    
-    // Calculate digest response (RFC 2617)
-    String uri = "sip:" + sipServer;
-    String ha1 = calculateMD5(sipUsername + ":" + realm + ":" + sipPassword);
-    String ha2 = calculateMD5("REGISTER:" + uri);
-    String response = calculateMD5(ha1 + ":" + nonce + ":" + ha2);
-    
-    Serial.println("HA1: " + ha1);
-    Serial.println("HA2: " + ha2);
-    Serial.println("Response: " + response);
-    
-    // Generate new branch for this transaction
-    String branch = "z9hG4bK" + generateTag();
-    
-    // Increment CSeq
-    cseq++;
-    
-    // Build authenticated REGISTER with same Call-ID and From tag
-    String registerMsg = "REGISTER sip:" + sipServer + " SIP/2.0\r\n";
-    registerMsg += "Via: SIP/2.0/UDP " + localIP + ":" + String(localSipPort) + ";branch=" + branch + ";rport\r\n";
-    registerMsg += "Max-Forwards: 70\r\n";
-    registerMsg += "From: <sip:" + sipUsername + "@" + sipServer + ">;tag=" + fromTag + "\r\n";
-    registerMsg += "To: <sip:" + sipUsername + "@" + sipServer + ">\r\n";
-    registerMsg += "Call-ID: " + callID + "\r\n";
-    registerMsg += "CSeq: " + String(cseq) + " REGISTER\r\n";
-    registerMsg += "Contact: <sip:" + sipUsername + "@" + localIP + ":" + String(localSipPort) + ">\r\n";
-    
-    // Build Authorization header with all parameters properly quoted
-    registerMsg += "Authorization: Digest ";
-    registerMsg += "username=\"" + sipUsername + "\", ";
-    registerMsg += "realm=\"" + realm + "\", ";
-    registerMsg += "nonce=\"" + nonce + "\", ";
-    registerMsg += "uri=\"" + uri + "\", ";
-    registerMsg += "response=\"" + response + "\", ";
-    registerMsg += "algorithm=" + algorithm + "\r\n";
-
-    registerMsg += "Allow: INVITE, ACK, CANCEL, BYE, OPTIONS\r\n";
-    registerMsg += "Expires: ";
-    registerMsg += String(SIP_REGISTER_EXPIRES);
-    registerMsg += "\r\n";
-    registerMsg += "User-Agent: ";
-    registerMsg += SIP_USER_AGENT;
-    registerMsg += "\r\n";
-    registerMsg += "Content-Length: 0\r\n";
-    registerMsg += "\r\n";
+    LOG_DEBUG("Authentication challenge: realm %s, algorithm %s of %u offered", digest.realm_name(), digest.algorithm_name(),
+        (unsigned)message.challengeCount);
     
-    Serial.println("=== Sending Authenticated REGISTER ===");
-    Serial.println(registerMsg);
-    Serial.println("=====================================");
+    // Build authenticated REGISTER with the same Call-ID and From tag and the next CSeq
+    char branch[24];
+    snprintf(branch, sizeof(branch), "z9hG4bK%lu", (unsigned long)random(100000000));
+    this->write_registration(branch, true);
     
     // Send authenticated REGISTER
-    this->send_sip_message(remoteIP, remotePort, registerMsg);
-}
-
-void SIPClient::handle_invite_message(String message, String remoteIP, int remotePort) {
-    // Extract call details
-    currentCallID = extractParameter(message, "Call-ID: ", "\r\n");
-    currentFromTag = extractParameter(message, "From: ", ";tag=");
-    currentFromTag = extractParameter(currentFromTag + message, ";tag=", "\r\n");
-    String cseq = extractParameter(message, "CSeq: ", "\r\n");
-    String via = extractParameter(message, "Via: ", "\r\n");
-    String from = extractParameter(message, "From: ", "\r\n");
-    String to = extractParameter(message, "To: ", "\r\n");
-    String contact = extractParameter(message, "Contact: ", "\r\n");
-    
-    // Generate To tag
-    currentToTag = generateTag();
-    
-    // Get current IP
-    String localIP = ETH.localIP().toString();
+    this->send_register(remoteIP, remotePort, branch);
+}
+
+void SIPClient::handle_invite_message(const SIPMessage &message, IPAddress remoteIP, int remotePort) {
+    if (activeTransaction == nullptr && !transactions.has_room()) {
+        LOG_WARN("Transaction table full, rejecting call");
+        this->write_response_headers(message, "486 Busy Here", nullptr);
+        tx.end();
+        this->send_response(message, remoteIP, remotePort, true);
+        return;
+    }
+
+    // A new Call-ID gets a fresh To tag, a repeat offer keeps its dialog
+    SIPDialog *dialog = dialogs.find(message.callId);
+    if (dialog == nullptr) {
+        char toTag[12];
+        generateTag(toTag, sizeof(toTag));
+        dialog = dialogs.create(message.callId, message.fromTag, toTag);
+    }
+
+    if (dialog == nullptr) {
+        LOG_WARN("Dialog table full, rejecting call");
+        this->write_response_headers(message, "486 Busy Here", nullptr);
+        tx.end();
+        this->send_response(message, remoteIP, remotePort, true);
+        return;
+    }
+
+    if (activeTransaction != nullptr) {
+        strlcpy(activeTransaction->toTag, dialog->toTag, sizeof(activeTransaction->toTag));
+    }
+    this->set_ringing(dialogs.has_early());
     
     // Send 180 Ringing
-    String ringing = "SIP/2.0 180 Ringing\r\n";
-    ringing += "Via: " + via + "\r\n";
-    ringing += "From: " + from + "\r\n";
-    ringing += "To: " + to + ";tag=" + currentToTag + "\r\n";
-    ringing += "Call-ID: " + currentCallID + "\r\n";
-    ringing += "CSeq: " + cseq + "\r\n";
-    ringing += "Contact: <sip:" + sipUsername + "@" + localIP + ":" + String(localSipPort) + ">\r\n";
-    ringing += "Content-Length: 0\r\n";
-    ringing += "\r\n";
+    this->write_response_headers(message, "180 Ringing", dialog->toTag);
+    tx.append(contactHeader);
+    tx.end();
     
-    this->send_sip_message(remoteIP, remotePort, ringing);
+    this->send_response(message, remoteIP, remotePort, false);
 }
 
-void SIPClient::handle_bye_message(String message, String remoteIP, int remotePort) {
-    String cseq = extractParameter(message, "CSeq: ", "\r\n");
-    String via = extractParameter(message, "Via: ", "\r\n");
-    String from = extractParameter(message, "From: ", "\r\n");
-    String to = extractParameter(message, "To: ", "\r\n");
-    String callID = extractParameter(message, "Call-ID: ", "\r\n");
-
-    // Clear call state
-    currentCallID = "";
-    currentFromTag = "";
-    currentToTag = "";
+void SIPClient::handle_bye_message(const SIPMessage &message, IPAddress remoteIP, int remotePort) {
+    // Only the matching call ends, other offers on this line keep ringing
+    if (!dialogs.remove(message.callId)) {
+        this->write_response_headers(message, "481 Call/Transaction Does Not Exist", nullptr);
+        tx.end();
+        this->send_response(message, remoteIP, remotePort, true);
+        return;
+    }
+    this->set_ringing(dialogs.has_early());
     
     // Send 200 OK
-    String ok = "SIP/2.0 200 OK\r\n";
-    ok += "Via: " + via + "\r\n";
-    ok += "From: " + from + "\r\n";
-    ok += "To: " + to + "\r\n";
-    ok += "Call-ID: " + callID + "\r\n";
-    ok += "CSeq: " + cseq + "\r\n";
-    ok += "Content-Length: 0\r\n";
-    ok += "\r\n";
+    this->write_response_headers(message, "200 OK", nullptr);
+    tx.end();
     
-    this->send_sip_message(remoteIP, remotePort, ok);
+    this->send_response(message, remoteIP, remotePort, true);
 }
 
-void SIPClient::handle_options_message(String message, String remoteIP, int remotePort) {
-    // Extract headers from OPTIONS request
-    String cseq = extractParameter(message, "CSeq: ", "\r\n");
-    String via = extractParameter(message, "Via: ", "\r\n");
-    String from = extractParameter(message, "From: ", "\r\n");
-    String to = extractParameter(message, "To: ", "\r\n");
-    String callID = extractParameter(message, "Call-ID: ", "\r\n");
-    
-    // Get current IP
-    String localIP = ETH.localIP().toString();
-    
+void SIPClient::handle_cancel_message(const SIPMessage &message, IPAddress remoteIP, int remotePort) {
+    // The CANCEL's own entry first, making room for it can free a finished INVITE but never a ringing one
+    activeTransaction = transactions.create(message.viaBranch, message.cseqNumber, false, remoteIP, remotePort);
+    // CANCEL carries the branch and CSeq number of the INVITE it targets
+    SIPServerTransaction *invite = transactions.find(message.viaBranch, message.cseqNumber, true);
+
+    // The call stops ringing even if its INVITE transaction is gone
+    dialogs.remove(message.callId);
+    this->set_ringing(dialogs.has_early());
+
+    if (invite == nullptr) {
+        this->write_response_headers(message, "481 Call/Transaction Does Not Exist", nullptr);
+        tx.end();
+        this->send_response(message, remoteIP, remotePort, true);
+        return;
+    }
+
+    this->write_response_headers(message, "200 OK", invite->toTag);
+    tx.end();
+    this->send_response(message, remoteIP, remotePort, true);
+
+    if (invite->state != SIP_TRANSACTION_PROCEEDING) {
+        return;
+    }
+
+    // Terminate the INVITE, Timer G keeps resending the 487 to the INVITE's peer until it is ACKed
+    activeTransaction = invite;
+    this->write_response_headers(message, "487 Request Terminated", invite->toTag, "INVITE");
+    tx.end();
+    this->send_response(message, IPAddress(invite->remoteIP), invite->remotePort, true);
+}
+
+void SIPClient::handle_options_message(const SIPMessage &message, IPAddress remoteIP, int remotePort) {
     // Build 200 OK response with supported methods
-    String ok = "SIP/2.0 200 OK\r\n";
-    ok += "Via: " + via + "\r\n";
-    ok += "From: " + from + "\r\n";
-    ok += "To: " + to + "\r\n";
-    ok += "Call-ID: " + callID + "\r\n";
-    ok += "CSeq: " + cseq + "\r\n";
-    ok += "Contact: <sip:" + sipUsername + "@" + localIP + ":" + String(localSipPort) + ">\r\n";
-    ok += "Accept: application/sdp\r\n";
-    ok += "Accept-Language: en\r\n";
-    ok += "Allow: INVITE, CANCEL, BYE, OPTIONS\r\n";
-    ok += "Supported: replaces, timer\r\n";
-    ok += "User-Agent: ";
-    ok += SIP_USER_AGENT;
-    ok += "\r\n";
-    ok += "Content-Length: 0\r\n";
-    ok += "\r\n";
+    this->write_response_headers(message, "200 OK", nullptr);
+    tx.append(contactHeader);
+    tx.append("Accept: application/sdp\r\n");
+    tx.append("Accept-Language: en\r\n");
+    tx.append(SIP_ALLOW_HEADER);
+    tx.append("Supported: replaces, timer\r\n");
+    tx.append(SIP_USER_AGENT_HEADER);
+    tx.end();
     
-    this->send_sip_message(remoteIP, remotePort, ok);
+    this->send_response(message, remoteIP, remotePort, true);
     
-    Serial.println("OPTIONS 200 OK sent");
+    LOG_DEBUG("OPTIONS 200 OK sent");
 }
 
-void SIPClient::handle_sip_packet() {
-    int packetSize = udpSIP.parsePacket();
-    if (packetSize > 0) {
-        char incomingPacket[2048];
-        int len = udpSIP.read(incomingPacket, sizeof(incomingPacket) - 1);
-        if (len > 0) {
-            incomingPacket[len] = 0;
+// Dialog state of the watched extension, ringing while it has an incoming early dialog
+void SIPClient::handle_notify_message(const SIPMessage &message, IPAddress remoteIP, int remotePort) {
+    if (sipMode != SIP_MODE_MONITOR || !message.callId.equals(registerCallID)) {
+        this->write_response_headers(message, "481 Subscription Does Not Exist", nullptr);
+        tx.end();
+        this->send_response(message, remoteIP, remotePort, true);
+        return;
+    }
+
+    // A NOTIFY can overtake the 2xx, its From tag completes the dialog just the same
+    if (subscribeToTag[0] == 0 && message.fromTag.length < sizeof(subscribeToTag)) {
+        memcpy(subscribeToTag, message.fromTag.data, message.fromTag.length);
+        subscribeToTag[message.fromTag.length] = 0;
+    }
+
+    this->write_response_headers(message, "200 OK", nullptr);
+    tx.end();
+    this->send_response(message, remoteIP, remotePort, true);
+
+    SIPView state = message.subscriptionState;
+    int semi = state.indexOf(';');
+    if (SIPView(state.data, semi >= 0 ? semi : state.length).trim().equalsIgnoreCase("terminated")) {
+        SIPView reason;
+        SIPMessage::headerParameter(state, "reason", reason);
+        this->subscription_ended(reason);
+        return;
+    }
+
+    if (message.event.startsWith("dialog") && !message.body.isEmpty()) {
+        if (!watched.apply(message.body)) {
+            LOG_WARN("Ignoring NOTIFY body that is not dialog-info");
         }
+        this->set_ringing(watched.is_ringing());
+    }
+}
+
+// The notifier ended the subscription, retry at once only when it invites us to (RFC 6665 4.1.3)
+void SIPClient::subscription_ended(SIPView reason) {
+    LOG_INFO("Subscription to %s terminated (%.*s)", sipMonitor.c_str(), (int)reason.length, reason.data);
+    watched.clear();
+    this->set_ringing(false);
+    this->new_registration_identity();
+    if (reason.equals("deactivated") || reason.equals("timeout")) {
+        this->set_registered(false);
+        this->schedule_registration(random(SIP_STREAM_RECONNECT_JITTER));
+    } else {
+        this->registration_failed(true);
+    }
+}
+
+void SIPClient::handle_sip_message(const SIPMessage &message, const SIPPacket &packet) {
+    SIPLock lock(sipMutex);
+    rxTimestamp = packet.timestamp;
+    
+    IPAddress remoteIP = IPAddress(packet.source.sin_addr.s_addr);
+    int remotePort = ntohs(packet.source.sin_port);
+    
+    if (message.isResponse() && message.cseqMethod.equals("OPTIONS")) {
+        this->handle_keepalive_response(message);
+    } else if (message.isResponse()) {
+        this->handle_register_response(message, remoteIP, remotePort);
+    } else {
+        this->handle_sip_request(message, remoteIP, remotePort);
+    }
+}
+
+void SIPClient::handle_register_response(const SIPMessage &message, IPAddress remoteIP, int remotePort) {
+    // Only the response to our own outstanding REGISTER counts, matched on Via branch and CSeq
+    if (!message.cseqMethod.equals(this->registration_method()) || !registerTransaction.matches(message.viaBranch, message.cseqNumber)) {
+        LOG_DEBUG("Ignoring response that matches no client transaction");
+        return;
+    }
+    if (registerTransaction.is_completed()) {
+        return; // Retransmitted final response
+    }
+    if (message.statusCode < 200) {
+        registerTransaction.proceeding();
+        return;
+    }
+    registerTransaction.complete();
+
+    if (message.statusCode == 401 || message.statusCode == 407) {
+        // Authentication required
+        LOG_DEBUG("Authentication challenge received");
+        lineStats.authChallenges++;
         
-        String sipMessage = String(incomingPacket);
-        String remoteIP = udpSIP.remoteIP().toString();
-        int remotePort = udpSIP.remotePort();
-        
-        Serial.println("\n=== Received SIP Message ===");
-        Serial.println(sipMessage);
-        Serial.println("============================\n");
+        // Protect against infinite auth loops
+        if (millis() - lastAuthAttempt < 5000 && authAttempts >= 3) {
+            LOG_ERROR("Too many authentication failures - backing off");
+            this->registration_failed(true);
+            return;
+        }
         
-        // Parse SIP message
-        if (sipMessage.startsWith("SIP/2.0 401")) {
-            // Authentication required
-            Serial.println("Authentication challenge received");
-            
-            // Protect against infinite auth loops
-            if (millis() - lastAuthAttempt < 5000 && authAttempts >= 3) {
-                Serial.println("ERROR: Too many authentication failures - stopping");
-                authAttempts = 0;
-                return;
-            }
-            
-            authAttempts++;
-            lastAuthAttempt = millis();
-            this->handle_auth_challenge(sipMessage, remoteIP, remotePort);
-        } else if (sipMessage.startsWith("SIP/2.0 200")) {
-            // Success response
-            if (sipMessage.indexOf("REGISTER") > 0 || sipMessage.indexOf("CSeq:") > 0) {
-                sipRegistered = true;
-                authAttempts = 0;  // Reset auth attempts on success
-                Serial.println("SIP registration successful!");
+        authAttempts++;
+        lastAuthAttempt = millis();
+        this->handle_auth_challenge(message, remoteIP, remotePort);
+    } else if (message.statusCode < 300) {
+        if (sipMode == SIP_MODE_MONITOR && subscribeToTag[0] == 0 && message.toTag.length < sizeof(subscribeToTag)) {
+            memcpy(subscribeToTag, message.toTag.data, message.toTag.length);
+            subscribeToTag[message.toTag.length] = 0;
+        }
+        this->registration_succeeded(message);
+    } else if (message.statusCode == 481 && sipMode == SIP_MODE_MONITOR) {
+        // The notifier lost the subscription, start a new dialog
+        this->new_registration_identity();
+        this->begin_registration();
+    } else if (message.statusCode == 423 && message.minExpires.toInt() > (long)registerExpires) {
+        // Interval Too Brief, retry straight away with the registrar's minimum
+        registerExpires = message.minExpires.toInt();
+        this->begin_registration();
+    } else if (message.statusCode == 503 && registrar.mark_failed()) {
+        // Overloaded or down for maintenance, try the next registrar (RFC 3263 4.3)
+        this->begin_registration();
+    } else {
+        LOG_WARN("SIP registration rejected: %d %.*s", message.statusCode, (int)message.reasonPhrase.length, message.reasonPhrase.data);
+        this->registration_failed(true);
+    }
+}
+
+// Any answer, even an error, shows the registrar is reachable
+void SIPClient::handle_keepalive_response(const SIPMessage &message) {
+    if (!keepaliveOutstanding || message.cseqNumber != keepaliveCSeq || !message.viaBranch.equals(keepaliveBranch)) {
+        return;
+    }
+    keepaliveOutstanding = false;
+    keepaliveMisses = 0;
+    keepaliveInterval = min<uint32_t>(keepaliveInterval * 2, SIP_KEEPALIVE_MAX_INTERVAL);
+    nextKeepaliveAt = millis() + keepaliveInterval;
+}
+
+void SIPClient::send_keepalive() {
+    struct sockaddr_in destination;
+    if (!registrar.resolve(&destination)) {
+        nextKeepaliveAt = millis() + SIP_KEEPALIVE_MIN_INTERVAL;
+        return;
+    }
+
+    snprintf(keepaliveBranch, sizeof(keepaliveBranch), "z9hG4bK%lu", (unsigned long)random(100000000));
+    keepaliveCSeq++;
+
+    tx.reset();
+    tx.append("OPTIONS ").append(requestUri).append(" SIP/2.0\r\n");
+    tx.append(viaPrefix).append(keepaliveBranch).append(";rport\r\n");
+    tx.append(SIP_MAX_FORWARDS_HEADER);
+    tx.append("From: ").append(addressOfRecord).append(";tag=").append(registerFromTag).append("\r\n");
+    tx.append("To: <").append(requestUri).append(">\r\n");
+    tx.append("Call-ID: ").append(keepaliveCallID).append("\r\n");
+    tx.append("CSeq: ").appendNumber(keepaliveCSeq).append(" OPTIONS\r\n");
+    tx.append(SIP_USER_AGENT_HEADER);
+    tx.end();
+    if (!tx.ok()) {
+        LOG_ERROR("SIP keepalive does not fit the transmit buffer, not sent");
+        nextKeepaliveAt = millis() + SIP_KEEPALIVE_MAX_INTERVAL;
+        return;
+    }
+
+    this->send_sip_message(IPAddress(destination.sin_addr.s_addr), ntohs(destination.sin_port), tx.data(), tx.size());
+    keepaliveSentAt = millis();
+    keepaliveOutstanding = true;
+}
+
+void SIPClient::handle_keepalive() {
+    // Connections are watched by their own CRLF keepalive
+    if (!sipRegistered || registerTransaction.is_active() || sipTransport != SIP_TRANSPORT_UDP) {
+        keepaliveOutstanding = false;
+        return;
+    }
+
+    uint32_t now = millis();
+    if (keepaliveOutstanding && now - keepaliveSentAt > SIP_KEEPALIVE_TIMEOUT) {
+        keepaliveOutstanding = false;
+        keepaliveMisses++;
+        LOG_WARN("SIP keepalive missed (%d)", (int)keepaliveMisses);
+
+        if (keepaliveMisses >= SIP_KEEPALIVE_MAX_MISSES) {
+            LOG_WARN("SIP registrar lost");
+            keepaliveMisses = 0;
+            this->set_registered(false);
+            if (registrar.mark_failed()) {
+                this->begin_registration();
+            } else {
+                this->registration_failed(true);
             }
-        } else if (sipMessage.startsWith("INVITE")) {
-            // Incoming call!
-            Serial.println("*** INCOMING CALL ***");
-            
-            this->handle_invite_message(sipMessage, remoteIP, remotePort);
-        } else if (sipMessage.startsWith("BYE") || sipMessage.startsWith("CANCEL")) {
-            // Call ended
-            Serial.println("*** CALL ENDED ***");
-            
-            this->handle_bye_message(sipMessage, remoteIP, remotePort);
-        } else if (sipMessage.startsWith("OPTIONS")) {
-            // OPTIONS request - respond with capabilities
-            Serial.println("OPTIONS request received");
-            this->handle_options_message(sipMessage, remoteIP, remotePort);
+            return;
         }
+
+        // Probe again straight away and stay tight until the path recovers
+        keepaliveInterval = SIP_KEEPALIVE_MIN_INTERVAL;
+        nextKeepaliveAt = now;
+    }
+
+    if (!keepaliveOutstanding && (int32_t)(now - nextKeepaliveAt) >= 0) {
+        this->send_keepalive();
+    }
+}
+
+void SIPClient::handle_sip_request(const SIPMessage &message, IPAddress remoteIP, int remotePort) {
+    if (message.method.equals("ACK")) {
+        // ACK for a non-2xx final response belongs to the INVITE transaction
+        transactions.confirm(transactions.find(message.viaBranch, message.cseqNumber, true));
+        return;
+    }
+
+    if (message.method.equals("CANCEL")) {
+        SIPServerTransaction *retransmit = transactions.find(message.viaBranch, message.cseqNumber, false);
+        if (retransmit != nullptr) {
+            this->replay_response(retransmit);
+            return;
+        }
+        LOG_INFO("*** CALL CANCELLED ***");
+        this->handle_cancel_message(message, remoteIP, remotePort);
+        activeTransaction = nullptr;
+        return;
+    }
+
+    bool invite = message.method.equals("INVITE");
+    SIPServerTransaction *retransmit = transactions.find(message.viaBranch, message.cseqNumber, invite);
+    if (retransmit != nullptr) {
+        // Retransmitted request, answer with exactly what we sent before
+        this->replay_response(retransmit);
+        return;
+    }
+
+    if (invite) {
+        // Incoming call!
+        LOG_INFO("*** INCOMING CALL ***");
+        activeTransaction = transactions.create(message.viaBranch, message.cseqNumber, true, remoteIP, remotePort);
+        this->handle_invite_message(message, remoteIP, remotePort);
+    } else if (message.method.equals("BYE")) {
+        // Call ended
+        LOG_INFO("*** CALL ENDED ***");
+        activeTransaction = transactions.create(message.viaBranch, message.cseqNumber, false, remoteIP, remotePort);
+        this->handle_bye_message(message, remoteIP, remotePort);
+    } else if (message.method.equals("NOTIFY")) {
+        activeTransaction = transactions.create(message.viaBranch, message.cseqNumber, false, remoteIP, remotePort);
+        this->handle_notify_message(message, remoteIP, remotePort);
+    } else if (message.method.equals("OPTIONS")) {
+        // OPTIONS request - respond with capabilities
+        LOG_DEBUG("OPTIONS request received");
+        activeTransaction = transactions.create(message.viaBranch, message.cseqNumber, false, remoteIP, remotePort);
+        this->handle_options_message(message, remoteIP, remotePort);
+    }
+    activeTransaction = nullptr;
+}
+
+void SIPClient::replay_response(SIPServerTransaction *transaction) {
+    if (transaction->responseLength == 0) {
+        return;
+    }
+    LOG_DEBUG("Retransmitted request absorbed, replaying cached response");
+    this->send_sip_message(IPAddress(transaction->remoteIP), transaction->remotePort, transaction->response, transaction->responseLength);
+}
+
+// Timer G retransmissions and expiry of finished server transactions
+void SIPClient::handle_transactions() {
+    uint32_t now = millis();
+    for (int i = 0; i < transactions.capacity(); i++) {
+        SIPServerTransaction &t = transactions.slot(i);
+        if (t.state != SIP_TRANSACTION_COMPLETED || t.retransmitAt == 0 || (int32_t)(now - t.retransmitAt) < 0) {
+            continue;
+        }
+        if (stream.is_peer(t.remoteIP, t.remotePort) || t.responseLength == 0) {
+            t.retransmitAt = 0; // Timer G is for unreliable transports only, and needs the cached response
+            continue;
+        }
+        this->send_sip_message(IPAddress(t.remoteIP), t.remotePort, t.response, t.responseLength);
+        t.retransmitDelay = min<uint32_t>(t.retransmitDelay * 2, SIP_T2);
+        t.retransmitAt = now + t.retransmitDelay;
+    }
+    transactions.expire(now);
+
+    // Offers abandoned without CANCEL or BYE
+    if (dialogs.has_early()) {
+        dialogs.expire(now, SIP_INVITE_PROCEEDING_TIMEOUT);
+        this->set_ringing(dialogs.has_early());
     }
 }
 
 void SIPClient::handle_sip_registration() {
-    if (sipRegistered && millis() - lastRegisterTime > SIP_REGISTER_INTERVAL) {
+    uint32_t now = millis();
+    if (registerTransaction.retransmit_due(now)) {
+        // Timer E, the REGISTER or its response was lost
+        this->send_sip_message(IPAddress(registerTransaction.remoteIP), registerTransaction.remotePort, registerTransaction.request, registerTransaction.requestLength);
+    }
+    if (registerTransaction.timed_out(now)) {
+        LOG_WARN("SIP registration timed out");
+        if (registrar.mark_failed()) {
+            // Next registrar straight away, backoff only once all of them are silent
+            this->begin_registration();
+        } else {
+            this->registration_failed(false);
+        }
+    }
+    if (sipRegistered && (int32_t)(now - registeredUntil) >= 0) {
+        LOG_WARN("SIP registration expired");
+        this->set_registered(false);
+    }
+    registerTransaction.expire(now);
+    if (registerScheduled && !registerTransaction.is_active() && !registrar.is_resolving() && !stream.is_connecting() &&
+        (int32_t)(now - nextRegisterAt) >= 0) {
         this->begin_registration();
     }
 }
 
+// Milliseconds until handle() next has timed work, at most limit
+uint32_t SIPClient::next_timeout(uint32_t now, uint32_t limit) {
+    SIPLock lock(sipMutex);
+    if (registerScheduled && !registerTransaction.is_active() && !registrar.is_resolving() && !stream.is_connecting()) {
+        limit = timer_until(now, nextRegisterAt, limit);
+    }
+    if (sipRegistered) {
+        limit = timer_until(now, registeredUntil, limit);
+    }
+    limit = registerTransaction.next_timeout(now, limit);
+    limit = transactions.next_timeout(now, limit);
+    if (sipRegistered && !registerTransaction.is_active() && sipTransport == SIP_TRANSPORT_UDP) {
+        limit = timer_until(now, keepaliveOutstanding ? keepaliveSentAt + SIP_KEEPALIVE_TIMEOUT + 1 : nextKeepaliveAt, limit);
+    }
+    return stream.next_timeout(now, limit);
+}
+
 void SIPClient::handle() {
-    this->handle_sip_packet();
+    SIPLock lock(sipMutex);
+    registrar.poll();
+    this->handle_stream();
+    this->handle_transactions();
     this->handle_sip_registration();
+    this->handle_keepalive();
+}
+
+// Starts connecting to the registrar target, handle_stream() finishes it without blocking the SIP task
+bool SIPClient::open_stream(IPAddress remoteIP, int remotePort) {
+    return stream.open((uint32_t)remoteIP, remotePort, sipTransport == SIP_TRANSPORT_TLS, sipServer.c_str(), sipVerify);
+}
+
+// Adds the line's connection to the SIP task's select() sets, returns the highest descriptor
+int SIPClient::watch(fd_set *readable, fd_set *writable, int maxFd) {
+    SIPLock lock(sipMutex);
+    return stream.watch(readable, writable, maxFd);
+}
+
+// Frames messages off the registrar connection, they need no routing
+void SIPClient::handle_stream() {
+    if (stream.is_connecting()) {
+        if (!stream.progress(millis())) {
+            registrar.mark_failed();
+            this->registration_failed(false);
+            return;
+        }
+        streamUp = stream.is_open();
+    }
+
+    if (stream.is_open() && endpoint != nullptr) {
+        stream.flush();
+        SIPPacket &packet = endpoint->stream_packet();
+        do {
+            if (!stream.receive()) break;
+            for (;;) {
+                int len = stream.next_message(packet.data, sizeof(packet.data));
+                if (len == 0) break;
+                if (len < 0) {
+                    LOG_WARN("SIP connection framing error, closing");
+                    streamStats.dropped++;
+                    stream.close();
+                    break;
+                }
+                packet.timestamp = micros();
+                packet.length = len;
+                packet.source.sin_family = AF_INET;
+                packet.source.sin_port = htons(stream.peer_port());
+                packet.source.sin_addr.s_addr = stream.peer_address();
+                streamStats.received++;
+                endpoint->deliver(packet, this);
+            }
+        } while (stream.pending());
+        stream.handle_keepalive(millis());
+    }
+
+    if (streamUp && !stream.is_open()) {
+        // Inbound calls can no longer reach us, reconnect (resuming TLS) and register again
+        LOG_WARN("SIP connection lost");
+        streamUp = false;
+        registerTransaction.clear();
+        this->set_registered(false);
+        this->schedule_registration(random(SIP_STREAM_RECONNECT_JITTER));
+    }
 }
 
 void SIPClient::init() {
-    udpSIP.begin(localSipPort);
+    SIPLock lock(sipMutex);
+    this->configure_registrar();
+    this->registrar.set_dns_server((uint32_t)ETH.dnsIP());
+    this->render_static_headers();
+    this->new_registration_identity();
 }
 
 void SIPClient::end() {
+    SIPLock lock(sipMutex);
     if (this->is_registered()) {
         this->end_registration(true);
     }
-    udpSIP.stop();
+    this->registerScheduled = false;
+    this->registerTransaction.clear();
+    this->stream.close();
+    this->streamUp = false;
 }
 
 bool SIPClient::is_configured() {
-    return (this->sipServer != "" && this->sipUsername != "" && this->sipPassword != "");
+    return (this->sipServer != "" && this->sipUsername != "" && this->sipPassword != "" &&
+        (this->sipMode != SIP_MODE_MONITOR || this->sipMonitor != ""));
 }
 
-SIPClient::SIPClient(int localSipPort) {
+bool SIPClient::is_registrar(uint32_t address) {
+    return address != 0 && (address == registrarAddress || address == stream.peer_address());
+}
+
+bool SIPClient::matches_user(SIPView user) {
+    SIPLock lock(sipMutex);
+    return sipMode != SIP_MODE_MONITOR && !user.isEmpty() && user.equals(sipUsername.c_str());
+}
+
+// Our REGISTER or OPTIONS probe, by Via branch and CSeq
+bool SIPClient::owns_response(const SIPMessage &message) {
+    SIPLock lock(sipMutex);
+    if (message.cseqMethod.equals("OPTIONS")) {
+        return keepaliveOutstanding && message.cseqNumber == keepaliveCSeq && message.viaBranch.equals(keepaliveBranch);
+    }
+    return registerTransaction.matches(message.viaBranch, message.cseqNumber);
+}
+
+// NOTIFYs inside a monitor line's subscription, by Call-ID
+bool SIPClient::owns_request(const SIPMessage &message) {
+    SIPLock lock(sipMutex);
+    return sipMode == SIP_MODE_MONITOR && message.callId.equals(registerCallID);
+}
+
+SIPClient::SIPClient() {
     this->sipServer = "";
     this->sipPort = 5060;
-    this->localSipPort = localSipPort;
     this->sipUsername = "";
     this->sipPassword = "";
     this->sipRealm = "";
+    this->sipTransport = SIP_TRANSPORT_UDP;
+    this->sipMode = SIP_MODE_REGISTER;
+    this->sipMonitor = "";
 
     this->sipRegistered = false;
-    this->lastRegisterTime = 0;
-    this->currentCallID = "";
-    this->currentFromTag = "";
-    this->currentToTag = "";
+    this->ringing = false;
+    this->sipMutex = xSemaphoreCreateRecursiveMutex();
     this->authAttempts = 0;
     this->lastAuthAttempt = 0;
+
+    this->requestUri[0] = 0;
+    this->addressOfRecord[0] = 0;
+    this->viaPrefix[0] = 0;
+    this->contactUri[0] = 0;
+    this->contactHeader[0] = 0;
+    this->targetUri[0] = 0;
+    this->subscribeToTag[0] = 0;
+    this->registerCallID[0] = 0;
+    this->registerFromTag[0] = 0;
+    this->registerCSeq = 0;
+
+    this->registerScheduled = false;
+    this->nextRegisterAt = 0;
+    this->registeredUntil = 0;
+    this->registerExpires = SIP_REGISTER_EXPIRES;
+    this->registerFailures = 0;
+
+    this->keepaliveCallID[0] = 0;
+    this->keepaliveBranch[0] = 0;
+    this->keepaliveCSeq = 0;
+    this->keepaliveInterval = SIP_KEEPALIVE_MIN_INTERVAL;
+    this->nextKeepaliveAt = 0;
+    this->keepaliveSentAt = 0;
+    this->keepaliveOutstanding = false;
+    this->keepaliveMisses = 0;
 }
 
-SIPClient::SIPClient(int localSipPort, String sipServer, int sipPort, String sipUsername, String sipPassword, String sipRealm) {
+SIPClient::SIPClient(String sipServer, int sipPort, String sipUsername, String sipPassword, String sipRealm) {
     this->sipServer = sipServer;
     this->sipPort = sipPort;
-    this->localSipPort = localSipPort;
     this->sipUsername = sipUsername;
     this->sipPassword = sipPassword;
     this->sipRealm = sipRealm;
+    this->sipTransport = SIP_TRANSPORT_UDP;
+    this->sipMode = SIP_MODE_REGISTER;
+    this->sipMonitor = "";
 
     this->sipRegistered = false;
-    this->lastRegisterTime = 0;
-    this->currentCallID = "";
-    this->currentFromTag = "";
-    this->currentToTag = "";
+    this->ringing = false;
+    this->sipMutex = xSemaphoreCreateRecursiveMutex();
     this->authAttempts = 0;
     this->lastAuthAttempt = 0;
+
+    this->requestUri[0] = 0;
+    this->addressOfRecord[0] = 0;
+    this->viaPrefix[0] = 0;
+    this->contactUri[0] = 0;
+    this->contactHeader[0] = 0;
+    this->targetUri[0] = 0;
+    this->subscribeToTag[0] = 0;
+    this->registerCallID[0] = 0;
+    this->registerFromTag[0] = 0;
+    this->registerCSeq = 0;
+
+    this->registerScheduled = false;
+    this->nextRegisterAt = 0;
+    this->registeredUntil = 0;
+    this->registerExpires = SIP_REGISTER_EXPIRES;
+    this->registerFailures = 0;
+
+    this->keepaliveCallID[0] = 0;
+    this->keepaliveBranch[0] = 0;
+    this->keepaliveCSeq = 0;
+    this->keepaliveInterval = SIP_KEEPALIVE_MIN_INTERVAL;
+    this->nextKeepaliveAt = 0;
+    this->keepaliveSentAt = 0;
+    this->keepaliveOutstanding = false;
+    this->keepaliveMisses = 0;
 }
\ No newline at end of file
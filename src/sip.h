@@ -1,60 +1,221 @@
 #ifndef SIP_H
 #define SIP_H
 #include <Arduino.h>
-#include <WiFiUdp.h>
+#include <logger.h>
+#include <metrics.h>
 #include <ETH.h>
-#include <MD5Builder.h>
+#include <sip-message.h>
+#include <sip-builder.h>
+#include <sip-transaction.h>
+#include <sip-dialog.h>
+#include <sip-dialog-info.h>
+#include <sip-digest.h>
+#include <sip-resolver.h>
+#include <sip-stream.h>
+#include <sip-endpoint.h>
+#include <sip-schedule.h>
+#include <idle-waits.h>
+#include "lwip/sockets.h"
 
-#define SIP_REGISTER_INTERVAL 600000 // 10 minutes
-#define SIP_REGISTER_EXPIRES 900 // 15 minutes
+#define SIP_REGISTER_FAILOVER_TIMEOUT 8000 // Give up on a registrar sooner when another one is listed
+#define SIP_SUBSCRIBE_EXPIRES 3600 // Dialog event subscriptions of monitor lines
+
+#define SIP_KEEPALIVE_TIMEOUT 2000        // Reply wait before a probe counts as missed
+#define SIP_KEEPALIVE_MAX_MISSES 3        // Misses in a row before the registrar is declared lost
 #define SIP_USER_AGENT "ESP32-SIP/1.1"
 
+#define SIP_ALLOW_HEADER "Allow: INVITE, ACK, CANCEL, BYE, OPTIONS, NOTIFY\r\n"
+#define SIP_USER_AGENT_HEADER "User-Agent: " SIP_USER_AGENT "\r\n"
+#define SIP_MAX_FORWARDS_HEADER "Max-Forwards: 70\r\n"
+
+// A line either registers and rings on its own calls, or watches another extension
+enum SIPLineMode {
+    SIP_MODE_REGISTER,
+    SIP_MODE_MONITOR // SUBSCRIBE to the extension's dialog events (RFC 4235)
+};
+
+enum SIPLineEventType {
+    SIP_EVENT_REGISTERED,
+    SIP_EVENT_UNREGISTERED,
+    SIP_EVENT_RINGING,
+    SIP_EVENT_IDLE
+};
+
+// Line state change pushed from the SIP task to the LED/relay side
+struct SIPLineEvent {
+    uint8_t line;
+    uint8_t type;
+    uint32_t timestamp; // micros() when the triggering datagram arrived
+};
+
+// Per-line counters for /metrics, bumped from the SIP task without taking the line lock
+struct SIPLineStats {
+    std::atomic<uint32_t> registrations;
+    std::atomic<uint32_t> registrationFailures;
+    std::atomic<uint32_t> authChallenges; // 401 and 407
+};
+
+// Holds a line's recursive mutex for the current scope
+class SIPLock {
+    private:
+        SemaphoreHandle_t mutex;
+    public:
+        SIPLock(SemaphoreHandle_t mutex) : mutex(mutex) { xSemaphoreTakeRecursive(mutex, portMAX_DELAY); }
+        ~SIPLock() { xSemaphoreGiveRecursive(mutex); }
+};
+
 class SIPClient {
     private:
-        bool sipRegistered;
-        unsigned long lastRegisterTime;
-        String currentCallID;
-        String currentFromTag;
-        String currentToTag;
+        volatile bool sipRegistered;
+        volatile bool ringing;
         int authAttempts;
         unsigned long lastAuthAttempt;
         
-        WiFiUDP udpSIP;
+        SemaphoreHandle_t sipMutex;
+
+        QueueHandle_t eventQueue = NULL;
+        TaskHandle_t eventTask = NULL;
+        uint8_t lineIndex = 0;
+        uint32_t rxTimestamp = 0;
+
+        // Shared socket, and the transmit buffer every line builds into
+        SIPEndpoint *endpoint = nullptr;
+        SIPMessageBuilder tx = SIPMessageBuilder(nullptr, 0);
+
+        // Rendered once per credential or IP change
+        char requestUri[96];
+        char addressOfRecord[128];
+        char viaPrefix[64];
+        char contactUri[96];
+        char contactHeader[128];
+        char targetUri[96]; // Watched extension of a monitor line
+
+        void render_static_headers();
+        void write_registration(const char *branch, bool authorize);
+        void write_register_headers(const char *branch, uint32_t cseq);
+        void write_register_trailer();
+        void write_subscribe_headers(const char *branch, uint32_t cseq);
+        const char *registration_method() { return sipMode == SIP_MODE_MONITOR ? "SUBSCRIBE" : "REGISTER"; }
+        const char *registration_uri() { return sipMode == SIP_MODE_MONITOR ? targetUri : requestUri; }
+        void write_response_headers(const SIPMessage &message, const char *status, const char *toTag, const char *cseqMethod = nullptr);
+
+        // Server transactions absorb request retransmissions
+        SIPTransactionTable transactions;
+        SIPServerTransaction *activeTransaction = nullptr;
+        void send_response(const SIPMessage &request, IPAddress remoteIP, int remotePort, bool final);
+        void replay_response(SIPServerTransaction *transaction);
+        void handle_transactions();
+
+        // Calls currently offered to this line, ringing while any is early
+        SIPDialogTable dialogs;
+
+        // Monitor lines: the subscription dialog's remote tag and the extension's early dialogs
+        char subscribeToTag[SIP_DIALOG_TAG_SIZE];
+        SIPWatchedDialogs watched;
+        void subscription_ended(SIPView reason);
+
+        // Registration identity and the last digest challenge
+        char registerCallID[48];
+        char registerFromTag[12];
+        uint32_t registerCSeq;
+        SIPDigest digest;
+        void new_registration_identity();
+
+        // Registration scheduler, all times in millis()
+        bool registerScheduled;
+        uint32_t nextRegisterAt;
+        uint32_t registeredUntil;
+        uint32_t registerExpires; // Requested expiry, raised by 423 Min-Expires
+        uint8_t registerFailures;
+        uint32_t registrationStarted = 0; // First attempt since the line was last registered
+
+        // OPTIONS probes to the registrar, relaxed while answered and tightened after a miss
+        char keepaliveCallID[48];
+        char keepaliveBranch[24];
+        uint32_t keepaliveCSeq;
+        uint32_t keepaliveInterval;
+        uint32_t nextKeepaliveAt;
+        uint32_t keepaliveSentAt;
+        bool keepaliveOutstanding;
+        uint8_t keepaliveMisses;
+        void send_keepalive();
+        void handle_keepalive();
+        SIPClientTransaction registerTransaction;
+        void send_register(IPAddress remoteIP, int remotePort, const char *branch);
+        void registration_succeeded(const SIPMessage &message);
+        void registration_failed(bool rejected);
+        uint32_t granted_expiry(const SIPMessage &message);
+
+        void set_registered(bool registered);
+        void set_ringing(bool ringing);
+        void post_event(uint8_t type);
+
+        // Registrar addresses, looked up again only when their TTL runs out
+        SIPResolver registrar;
+        uint32_t registrarAddress = 0; // Target of the last REGISTER, for routing its requests
+        void configure_registrar();
+
+        // Persistent registrar connection when the line uses TCP or TLS
+        SIPStream stream;
+        bool streamUp = false;
+        bool open_stream(IPAddress remoteIP, int remotePort);
+        void handle_stream();
 
     public:
         String sipServer;
         int sipPort;
-        int localSipPort;
         String sipUsername;
         String sipPassword;
         String sipRealm;
+        int sipTransport;
+        int sipMode;
+        String sipMonitor;
+        bool sipVerify = true; // Require a valid server certificate on TLS lines
+
+        SIPLineStats lineStats = {};
+        SIPPacketStats udpStats = {};    // Datagrams the shared socket routed to this line
+        SIPPacketStats streamStats = {}; // Messages framed off the line's TCP/TLS connection
         
-        SIPClient(int localSipPort);
-        SIPClient(int localSipPort, String sipServer, int sipPort, String sipUsername, String sipPassword, String sipRealm);
+        SIPClient();
+        SIPClient(String sipServer, int sipPort, String sipUsername, String sipPassword, String sipRealm);
 
-        static String generateCallID();
-        static String generateTag();
-        static String calculateMD5(String input);
-        static String extractParameter(String message, String startDelim, String endDelim);
+        static void generateCallID(char *callID, size_t size);
+        static void generateTag(char *tag, size_t size);
 
         void init();
         void end();
+        void set_event_queue(QueueHandle_t queue, uint8_t line, TaskHandle_t task);
+        void set_endpoint(SIPEndpoint *endpoint);
+        int watch(fd_set *readable, fd_set *writable, int maxFd);
         bool is_registered();
         bool is_ringing();
         bool is_configured();
+        bool is_monitor() { return sipMode == SIP_MODE_MONITOR; }
+        bool is_registrar(uint32_t address);
+        bool matches_user(SIPView user);
+        bool owns_response(const SIPMessage &message);
+        bool owns_request(const SIPMessage &message);
 
         void begin_registration();
+        void schedule_registration(uint32_t delay);
         void end_registration(bool networkLost);
-        void update_credentials(String sipServer, int sipPort, String sipUsername, String sipPassword, String sipRealm);
+        void update_credentials(String sipServer, int sipPort, String sipUsername, String sipPassword, String sipRealm, int sipTransport = SIP_TRANSPORT_UDP,
+            int sipMode = SIP_MODE_REGISTER, String sipMonitor = "", bool sipVerify = true);
         
-        void send_sip_message(String remoteIP, int remotePort, String message);
+        void send_sip_message(IPAddress remoteIP, int remotePort, const char *message, size_t length);
 
-        void handle_auth_challenge(String message, String remoteIP, int remotePort);
-        void handle_invite_message(String message, String remoteIP, int remotePort);
-        void handle_bye_message(String message, String remoteIP, int remotePort);
-        void handle_options_message(String message, String remoteIP, int remotePort);
-        void handle_sip_packet();
+        void handle_auth_challenge(const SIPMessage &message, IPAddress remoteIP, int remotePort);
+        void handle_invite_message(const SIPMessage &message, IPAddress remoteIP, int remotePort);
+        void handle_bye_message(const SIPMessage &message, IPAddress remoteIP, int remotePort);
+        void handle_cancel_message(const SIPMessage &message, IPAddress remoteIP, int remotePort);
+        void handle_options_message(const SIPMessage &message, IPAddress remoteIP, int remotePort);
+        void handle_notify_message(const SIPMessage &message, IPAddress remoteIP, int remotePort);
+        void handle_register_response(const SIPMessage &message, IPAddress remoteIP, int remotePort);
+        void handle_keepalive_response(const SIPMessage &message);
+        void handle_sip_message(const SIPMessage &message, const SIPPacket &packet);
+        void handle_sip_request(const SIPMessage &message, IPAddress remoteIP, int remotePort);
         void handle_sip_registration();
         void handle();
+        uint32_t next_timeout(uint32_t now, uint32_t limit);
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <timer-wheel.h>
+
+void TimerWheel::schedule(Timer &timer, uint32_t delay) {
+    this->schedule_at(timer, clock() + delay);
+}
+
+// Replaces any earlier deadline the timer had
+void TimerWheel::schedule_at(Timer &timer, uint32_t expires) {
+    if (!started) {
+        current = clock();
+        started = true;
+    }
+    if (timer.is_pending()) {
+        this->unlink(timer);
+    }
+    timer.expires = expires;
+    this->link(timer);
+}
+
+void TimerWheel::cancel(Timer &timer) {
+    if (timer.is_pending()) {
+        this->unlink(timer);
+    }
+}
+
+// Files the timer by how far away it is, deadlines already passed go in the next tick to run
+void TimerWheel::link(Timer &timer) {
+    uint32_t delta = timer.expires - current;
+    uint32_t filed = timer.expires;
+    if ((int32_t)delta < 0) {
+        delta = 0;
+        filed = current;
+    } else if (delta >= TIMER_WHEEL_RANGE) {
+        delta = TIMER_WHEEL_RANGE - 1;
+        filed = current + delta;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ul << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    uint8_t slot = (filed >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+    Timer *&head = slots[level][slot];
+    timer.next = head;
+    if (head != nullptr) head->pprev = &timer.next;
+    head = &timer;
+    timer.pprev = &head;
+    timer.level = level;
+    timer.slot = slot;
+    occupied[level] |= 1ull << slot;
+}
+
+void TimerWheel::unlink(Timer &timer) {
+    *timer.pprev = timer.next;
+    if (timer.next != nullptr) timer.next->pprev = timer.pprev;
+    timer.next = nullptr;
+    timer.pprev = nullptr;
+    if (slots[timer.level][timer.slot] == nullptr) {
+        occupied[timer.level] &= ~(1ull << timer.slot);
+    }
+}
+
+// Moves a slot's list to a local head so timers can still be cancelled while it is worked through
+Timer *TimerWheel::detach(Timer *&head) {
+    Timer *list = head;
+    head = nullptr;
+    return list;
+}
+
+// Re-files the slot of this level that the clock just reached into the levels below
+void TimerWheel::cascade(int level) {
+    uint8_t slot = (current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    Timer *list = detach(slots[level][slot]);
+    occupied[level] &= ~(1ull << slot);
+    if (list != nullptr) list->pprev = &list;
+    while (list != nullptr) {
+        Timer &timer = *list;
+        this->unlink(timer);
+        this->link(timer);
+    }
+}
+
+// Runs every timer that is due, returns how many ran. Callbacks may schedule and cancel freely,
+// a timer rescheduled for now runs on the next tick rather than in this one.
+uint32_t TimerWheel::advance() {
+    uint32_t now = clock();
+    uint32_t ran = 0;
+    if (!started) {
+        current = now;
+        started = true;
+    }
+
+    while ((int32_t)(now - current) >= 0) {
+        uint8_t index = current & TIMER_WHEEL_MASK;
+        if (index == 0) {
+            for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                this->cascade(level);
+                if (((current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK) != 0) break;
+            }
+        }
+
+        if (occupied[0] == 0) {
+            // Nothing due before the next cascade, jump straight to it
+            uint32_t next = (current | TIMER_WHEEL_MASK) + 1;
+            if ((int32_t)(now - next) < 0) {
+                current = now + 1;
+                break;
+            }
+            current = next;
+            continue;
+        }
+
+        Timer *due = detach(slots[0][index]);
+        occupied[0] &= ~(1ull << index);
+        current++;
+        if (due != nullptr) due->pprev = &due;
+        while (due != nullptr) {
+            Timer &timer = *due;
+            this->unlink(timer);
+            timer.callback(timer.arg);
+            ran++;
+        }
+    }
+    return ran;
+}
+
+// Milliseconds until the earliest timer could be due, TIMER_NEVER with nothing pending.
+// Upper levels only know their slot, so this may be early but never late.
+uint32_t TimerWheel::next_timeout() {
+    uint32_t best = TIMER_NEVER;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t bits = occupied[level];
+        if (bits == 0) continue;
+
+        int shift = TIMER_WHEEL_BITS * level;
+        uint8_t index = (current >> shift) & TIMER_WHEEL_MASK;
+        uint64_t rotated = index == 0 ? bits : (bits >> index) | (bits << (TIMER_WHEEL_SLOTS - index));
+
+        uint32_t until;
+        if (level == 0) {
+            until = __builtin_ctzll(rotated);
+        } else {
+            // A slot cascades when the clock reaches its start. Unless the clock sits exactly on the
+            // start of its own slot, that one has cascaded already and what it holds is a turn away.
+            uint32_t skip = (current & ((1ul << shift) - 1)) == 0 ? 0 : 1;
+            uint64_t ahead = skip == 0 ? rotated : (rotated >> 1) | (rotated << (TIMER_WHEEL_SLOTS - 1));
+            uint32_t distance = skip + __builtin_ctzll(ahead);
+            until = (((current >> shift) + distance) << shift) - current;
+        }
+        if (until < best) best = until;
+    }
+    if (best == TIMER_NEVER) return TIMER_NEVER;
+
+    int32_t remaining = (int32_t)(current + best - clock());
+    return remaining > 0 ? remaining : 0;
+}
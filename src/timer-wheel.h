@@ -0,0 +1,63 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+#include <Arduino.h>
+
+// 1 ms ticks, each level 64 times coarser than the one below, 64^4 ms (about 4.6 hours) of range.
+// Longer delays park at the top level and are re-filed when they cascade down.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_RANGE (1ul << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+#define TIMER_NEVER UINT32_MAX
+
+// Milliseconds from now until a millis() deadline, 0 once it has passed, never more than limit
+inline uint32_t timer_until(uint32_t now, uint32_t deadline, uint32_t limit) {
+    int32_t remaining = (int32_t)(deadline - now);
+    if (remaining <= 0) return 0;
+    return (uint32_t)remaining < limit ? remaining : limit;
+}
+
+typedef void (*TimerCallback)(void *arg);
+typedef unsigned long (*TimerClock)(); // millis() or a test clock
+
+// Lives in its owner and is linked into one wheel slot while pending, so scheduling never allocates
+struct Timer {
+    Timer *next = nullptr;
+    Timer **pprev = nullptr; // The pointer that points at us, null while not pending
+    uint32_t expires = 0;
+    uint8_t level = 0;
+    uint8_t slot = 0;
+    TimerCallback callback = nullptr;
+    void *arg = nullptr;
+
+    Timer() {}
+    Timer(TimerCallback callback, void *arg) : callback(callback), arg(arg) {}
+    bool is_pending() const { return pprev != nullptr; }
+};
+
+// Hierarchical timing wheel (Varghese and Lauck), owned by a single task.
+// Scheduling and cancelling are O(1), advancing only visits ticks that have something due.
+class TimerWheel {
+    private:
+        Timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS] = {};
+        uint64_t occupied[TIMER_WHEEL_LEVELS] = {}; // Bit n set while slot n has timers
+        uint32_t current = 0;                       // Next tick to run
+        bool started = false;
+
+        void link(Timer &timer);
+        void unlink(Timer &timer);
+        void cascade(int level);
+        static Timer *detach(Timer *&head);
+
+    public:
+        TimerClock clock = millis;
+
+        void schedule(Timer &timer, uint32_t delay);
+        void schedule_at(Timer &timer, uint32_t expires);
+        void cancel(Timer &timer);
+        uint32_t advance();
+        uint32_t next_timeout();
+};
+#endif
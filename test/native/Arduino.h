@@ -0,0 +1,162 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+// Just enough of the Arduino core for the portable sources to build in [env:native].
+// Time is the host's monotonic clock, tests that need control over it inject their own.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+
+using std::min;
+using std::max;
+
+#define IRAM_ATTR
+
+// The parts of Arduino's String the portable sources use, on top of std::string
+class String {
+    private:
+        std::string text;
+
+    public:
+        String() {}
+        String(const char *text) : text(text != nullptr ? text : "") {}
+        String(const char *text, unsigned int length) : text(text, length) {}
+        String(const std::string &text) : text(text) {}
+        String(long value) : text(std::to_string(value)) {}
+
+        const char *c_str() const { return text.c_str(); }
+        unsigned int length() const { return text.size(); }
+        bool isEmpty() const { return text.empty(); }
+        char operator[](unsigned int index) const { return index < text.size() ? text[index] : 0; }
+
+        int indexOf(char c, unsigned int from = 0) const {
+            size_t found = text.find(c, from);
+            return found == std::string::npos ? -1 : (int)found;
+        }
+        int indexOf(const String &s, unsigned int from = 0) const {
+            size_t found = text.find(s.text, from);
+            return found == std::string::npos ? -1 : (int)found;
+        }
+        String substring(unsigned int from) const { return from < text.size() ? String(text.substr(from)) : String(); }
+        String substring(unsigned int from, unsigned int to) const {
+            if (from > to) std::swap(from, to);
+            return from < text.size() ? String(text.substr(from, to - from)) : String();
+        }
+        bool startsWith(const String &prefix) const { return text.compare(0, prefix.text.size(), prefix.text) == 0; }
+        bool equalsIgnoreCase(const String &other) const { return strcasecmp(text.c_str(), other.text.c_str()) == 0; }
+        long toInt() const { return atol(text.c_str()); }
+        void trim() {
+            size_t first = text.find_first_not_of(" \t\r\n");
+            size_t last = text.find_last_not_of(" \t\r\n");
+            text = first == std::string::npos ? std::string() : text.substr(first, last - first + 1);
+        }
+        void toLowerCase() {
+            for (char &c : text) c = tolower(c);
+        }
+
+        String &operator+=(const String &other) { text += other.text; return *this; }
+        String &operator+=(const char *other) { text += other; return *this; }
+        bool operator==(const String &other) const { return text == other.text; }
+        bool operator==(const char *other) const { return text == other; }
+        bool operator!=(const String &other) const { return text != other.text; }
+        bool operator!=(const char *other) const { return text != other; }
+        friend String operator+(const String &a, const String &b) { return String(a.text + b.text); }
+        friend String operator+(const String &a, const char *b) { return String(a.text + b); }
+        friend String operator+(const char *a, const String &b) { return String(a + b.text); }
+};
+
+// IPv4 only, held in network byte order like the ESP32 core's
+class IPAddress {
+    private:
+        union {
+            uint8_t bytes[4];
+            uint32_t dword;
+        } address;
+
+    public:
+        IPAddress() { address.dword = 0; }
+        IPAddress(uint32_t address) { this->address.dword = address; }
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+            address.bytes[0] = a;
+            address.bytes[1] = b;
+            address.bytes[2] = c;
+            address.bytes[3] = d;
+        }
+
+        operator uint32_t() const { return address.dword; }
+        uint8_t operator[](int index) const { return address.bytes[index]; }
+        String toString() const {
+            char text[16];
+            snprintf(text, sizeof(text), "%u.%u.%u.%u", address.bytes[0], address.bytes[1], address.bytes[2], address.bytes[3]);
+            return String(text);
+        }
+};
+
+// Console output goes to stdout
+class HardwareSerial {
+    public:
+        size_t write(const char *data, size_t length) { return fwrite(data, 1, length, stdout); }
+        size_t write(const uint8_t *data, size_t length) { return fwrite(data, 1, length, stdout); }
+};
+
+inline HardwareSerial Serial;
+
+// newlib has it, glibc only from 2.38
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+inline size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t length = strlen(src);
+    if (size > 0) {
+        size_t n = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return length;
+}
+#endif
+
+inline unsigned long micros() {
+    return (unsigned long)(uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline unsigned long millis() {
+    return (unsigned long)(uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Seeded the same way on every host, so a simulation is repeatable
+inline uint32_t &random_state() {
+    static uint32_t state = 1;
+    return state;
+}
+
+inline void randomSeed(unsigned long seed) {
+    random_state() = seed != 0 ? seed : 1;
+}
+
+inline long random(long howbig) {
+    if (howbig <= 0) return 0;
+    uint32_t &x = random_state();
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x % howbig;
+}
+
+inline long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) return howsmall;
+    return howsmall + random(howbig - howsmall);
+}
+#endif
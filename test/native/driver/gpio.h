@@ -0,0 +1,8 @@
+#ifndef DRIVER_GPIO_H
+#define DRIVER_GPIO_H
+typedef enum {
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_MAX = 49
+} gpio_num_t;
+#endif
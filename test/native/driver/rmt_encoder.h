@@ -0,0 +1,73 @@
+#ifndef DRIVER_RMT_ENCODER_H
+#define DRIVER_RMT_ENCODER_H
+// Encoders are built and freed as on the target but never run, the stand-in channel keeps the bytes
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "esp_err.h"
+
+typedef struct rmt_channel_t *rmt_channel_handle_t;
+
+typedef enum {
+    RMT_ENCODING_RESET = 0,
+    RMT_ENCODING_COMPLETE = (1 << 0),
+    RMT_ENCODING_MEM_FULL = (1 << 1)
+} rmt_encode_state_t;
+
+typedef union {
+    struct {
+        uint16_t duration0 : 15;
+        uint16_t level0 : 1;
+        uint16_t duration1 : 15;
+        uint16_t level1 : 1;
+    };
+    uint32_t val;
+} rmt_symbol_word_t;
+
+typedef struct rmt_encoder_t rmt_encoder_t;
+struct rmt_encoder_t {
+    size_t (*encode)(rmt_encoder_t *encoder, rmt_channel_handle_t channel, const void *data, size_t size, rmt_encode_state_t *state);
+    esp_err_t (*reset)(rmt_encoder_t *encoder);
+    esp_err_t (*del)(rmt_encoder_t *encoder);
+};
+typedef rmt_encoder_t *rmt_encoder_handle_t;
+
+typedef struct {
+    rmt_symbol_word_t bit0;
+    rmt_symbol_word_t bit1;
+    struct {
+        uint32_t msb_first : 1;
+    } flags;
+} rmt_bytes_encoder_config_t;
+
+typedef struct {
+} rmt_copy_encoder_config_t;
+
+inline esp_err_t rmt_native_encoder_reset(rmt_encoder_t *encoder) { return ESP_OK; }
+inline esp_err_t rmt_native_encoder_del(rmt_encoder_t *encoder) { free(encoder); return ESP_OK; }
+
+inline esp_err_t rmt_native_new_encoder(rmt_encoder_handle_t *out) {
+    rmt_encoder_t *encoder = (rmt_encoder_t *)calloc(1, sizeof(rmt_encoder_t));
+    if (encoder == nullptr) return ESP_ERR_NO_MEM;
+    encoder->reset = rmt_native_encoder_reset;
+    encoder->del = rmt_native_encoder_del;
+    *out = encoder;
+    return ESP_OK;
+}
+
+inline esp_err_t rmt_new_bytes_encoder(const rmt_bytes_encoder_config_t *config, rmt_encoder_handle_t *out) {
+    return rmt_native_new_encoder(out);
+}
+
+inline esp_err_t rmt_new_copy_encoder(const rmt_copy_encoder_config_t *config, rmt_encoder_handle_t *out) {
+    return rmt_native_new_encoder(out);
+}
+
+inline esp_err_t rmt_encoder_reset(rmt_encoder_handle_t encoder) {
+    return encoder->reset(encoder);
+}
+
+inline esp_err_t rmt_del_encoder(rmt_encoder_handle_t encoder) {
+    return encoder->del(encoder);
+}
+#endif
@@ -0,0 +1,90 @@
+#ifndef DRIVER_RMT_TX_H
+#define DRIVER_RMT_TX_H
+// A transmit copies the frame into the channel and is done at once, unless a test marks the
+// channel busy to stand for a frame still on the wire
+#include <string.h>
+#include <vector>
+#include "driver/gpio.h"
+#include "driver/rmt_encoder.h"
+
+#define RMT_NATIVE_CHANNELS 4
+
+typedef int rmt_clock_source_t;
+#define RMT_CLK_SRC_DEFAULT 0
+
+typedef struct {
+    gpio_num_t gpio_num;
+    rmt_clock_source_t clk_src;
+    uint32_t resolution_hz;
+    size_t mem_block_symbols;
+    size_t trans_queue_depth;
+    int intr_priority;
+    struct {
+        uint32_t invert_out : 1;
+        uint32_t with_dma : 1;
+        uint32_t io_loop_back : 1;
+        uint32_t io_od_mode : 1;
+    } flags;
+} rmt_tx_channel_config_t;
+
+typedef struct {
+    int loop_count;
+    struct {
+        uint32_t eot_level : 1;
+    } flags;
+} rmt_transmit_config_t;
+
+struct rmt_channel_t {
+    bool used = false;
+    gpio_num_t gpio = GPIO_NUM_NC;
+    bool enabled = false;
+    bool busy = false;
+    uint32_t frames = 0;
+    std::vector<uint8_t> frame; // The last one sent
+};
+
+inline rmt_channel_t *rmt_native_channels() {
+    static rmt_channel_t channels[RMT_NATIVE_CHANNELS];
+    return channels;
+}
+
+// The channel driving a pin, for tests to look at what went out
+inline rmt_channel_t *rmt_native_channel(int gpio) {
+    for (int i = 0; i < RMT_NATIVE_CHANNELS; i++) {
+        rmt_channel_t &channel = rmt_native_channels()[i];
+        if (channel.used && channel.gpio == gpio) return &channel;
+    }
+    return nullptr;
+}
+
+inline esp_err_t rmt_new_tx_channel(const rmt_tx_channel_config_t *config, rmt_channel_handle_t *out) {
+    for (int i = 0; i < RMT_NATIVE_CHANNELS; i++) {
+        rmt_channel_t &channel = rmt_native_channels()[i];
+        if (channel.used) continue;
+        channel = rmt_channel_t();
+        channel.used = true;
+        channel.gpio = config->gpio_num;
+        *out = &channel;
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+inline esp_err_t rmt_enable(rmt_channel_handle_t channel) { channel->enabled = true; return ESP_OK; }
+inline esp_err_t rmt_disable(rmt_channel_handle_t channel) { channel->enabled = false; return ESP_OK; }
+inline esp_err_t rmt_del_channel(rmt_channel_handle_t channel) { channel->used = false; return ESP_OK; }
+
+inline esp_err_t rmt_tx_wait_all_done(rmt_channel_handle_t channel, int timeout) {
+    if (channel->busy && timeout >= 0) return ESP_ERR_TIMEOUT;
+    channel->busy = false;
+    return ESP_OK;
+}
+
+inline esp_err_t rmt_transmit(rmt_channel_handle_t channel, rmt_encoder_handle_t encoder, const void *data, size_t size,
+    const rmt_transmit_config_t *config) {
+    if (!channel->enabled) return ESP_ERR_INVALID_STATE;
+    channel->frame.assign((const uint8_t *)data, (const uint8_t *)data + size);
+    channel->frames++;
+    return ESP_OK;
+}
+#endif
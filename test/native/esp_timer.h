@@ -0,0 +1,51 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+// One-shot timers are recorded, never fired: a test drives whatever the callback would have
+#include <stdint.h>
+#include <chrono>
+#include "esp_err.h"
+
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef enum {
+    ESP_TIMER_TASK,
+    ESP_TIMER_ISR
+} esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void *arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char *name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    bool armed;
+    uint64_t timeout; // us, of the last start
+};
+typedef esp_timer *esp_timer_handle_t;
+
+inline int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out) {
+    *out = new esp_timer{ *args, false, 0 };
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout) {
+    if (timer == nullptr) return ESP_ERR_INVALID_ARG;
+    timer->armed = true;
+    timer->timeout = timeout;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (timer == nullptr || !timer->armed) return ESP_ERR_INVALID_STATE;
+    timer->armed = false;
+    return ESP_OK;
+}
+#endif
@@ -0,0 +1,69 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+// The FreeRTOS calls the portable sources make. Native tests are single threaded: no task is ever
+// started, mutexes never contend and notifications are only recorded.
+#include <stdint.h>
+#include <limits.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY UINT32_MAX
+#define portTICK_PERIOD_MS 10
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) / portTICK_PERIOD_MS)
+
+struct NativeTask {
+    uint32_t notifiedValue = 0;
+    uint32_t notifications = 0;
+};
+typedef NativeTask *TaskHandle_t;
+
+enum eNotifyAction { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite, eSetValueWithoutOverwrite };
+
+// The task is never run, its handle only collects notifications
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack, void *arg, UBaseType_t priority,
+    TaskHandle_t *handle, BaseType_t core) {
+    static NativeTask tasks[8];
+    static int created = 0;
+    if (handle != nullptr) *handle = created < 8 ? &tasks[created++] : nullptr;
+    return pdPASS;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    static NativeTask current;
+    return &current;
+}
+
+inline BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+    if (action == eSetBits) task->notifiedValue |= value;
+    else if (action == eIncrement) task->notifiedValue++;
+    else if (action != eNoAction) task->notifiedValue = value;
+    task->notifications++;
+    return pdPASS;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    return xTaskNotify(task, 0, eIncrement);
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    uint32_t value = task->notifiedValue;
+    task->notifiedValue = clear ? 0 : (value > 0 ? value - 1 : 0);
+    return value;
+}
+
+inline BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value, TickType_t ticks) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    if (value != nullptr) *value = task->notifiedValue;
+    task->notifiedValue &= ~clearOnExit;
+    return pdPASS;
+}
+
+inline void vTaskDelay(TickType_t ticks) {}
+#endif
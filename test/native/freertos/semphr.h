@@ -0,0 +1,24 @@
+#ifndef SEMPHR_H
+#define SEMPHR_H
+#include "freertos/FreeRTOS.h"
+
+// Nothing else runs, so taking a mutex always succeeds at once
+struct NativeSemaphore {
+    int held = 0;
+};
+typedef NativeSemaphore *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new NativeSemaphore();
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    semaphore->held++;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    semaphore->held--;
+    return pdTRUE;
+}
+#endif
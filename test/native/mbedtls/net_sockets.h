@@ -0,0 +1,28 @@
+#ifndef MBEDTLS_NET_SOCKETS_H
+#define MBEDTLS_NET_SOCKETS_H
+#include <stddef.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "mbedtls/ssl.h"
+
+#define MBEDTLS_ERR_NET_SEND_FAILED -0x004E
+#define MBEDTLS_ERR_NET_RECV_FAILED -0x004C
+
+typedef struct {
+    int fd;
+} mbedtls_net_context;
+
+inline void mbedtls_net_init(mbedtls_net_context *ctx) { ctx->fd = -1; }
+
+inline int mbedtls_net_send(void *ctx, const unsigned char *buf, size_t len) {
+    int result = send(((mbedtls_net_context *)ctx)->fd, buf, len, MSG_DONTWAIT);
+    if (result < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+    return result;
+}
+
+inline int mbedtls_net_recv(void *ctx, unsigned char *buf, size_t len) {
+    int result = recv(((mbedtls_net_context *)ctx)->fd, buf, len, MSG_DONTWAIT);
+    if (result < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+    return result;
+}
+#endif
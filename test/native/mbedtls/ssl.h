@@ -0,0 +1,57 @@
+#ifndef MBEDTLS_SSL_H
+#define MBEDTLS_SSL_H
+// Enough of the mbedTLS client API to build SIPStream. There is no TLS on the host: seeding the
+// RNG fails, so a TLS stream closes once its TCP connect completes and tests cover TCP only.
+#include <stddef.h>
+#include <stdint.h>
+
+#define MBEDTLS_SSL_IS_CLIENT 0
+#define MBEDTLS_SSL_TRANSPORT_STREAM 0
+#define MBEDTLS_SSL_PRESET_DEFAULT 0
+#define MBEDTLS_SSL_VERIFY_NONE 0
+#define MBEDTLS_SSL_VERIFY_OPTIONAL 1
+#define MBEDTLS_SSL_VERIFY_REQUIRED 2
+#define MBEDTLS_ERR_SSL_WANT_READ -0x6900
+#define MBEDTLS_ERR_SSL_WANT_WRITE -0x6880
+#define MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY -0x7880
+#define MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE -0x7080
+
+typedef int mbedtls_ssl_send_t(void *ctx, const unsigned char *buf, size_t len);
+typedef int mbedtls_ssl_recv_t(void *ctx, unsigned char *buf, size_t len);
+typedef int mbedtls_ssl_recv_timeout_t(void *ctx, unsigned char *buf, size_t len, uint32_t timeout);
+
+typedef struct {
+    int authmode;
+} mbedtls_ssl_config;
+
+typedef struct {
+    const mbedtls_ssl_config *conf;
+} mbedtls_ssl_context;
+
+typedef struct {
+    int valid;
+} mbedtls_ssl_session;
+
+inline void mbedtls_ssl_init(mbedtls_ssl_context *ssl) { ssl->conf = nullptr; }
+inline void mbedtls_ssl_free(mbedtls_ssl_context *ssl) {}
+inline void mbedtls_ssl_config_init(mbedtls_ssl_config *conf) { conf->authmode = MBEDTLS_SSL_VERIFY_REQUIRED; }
+inline void mbedtls_ssl_config_free(mbedtls_ssl_config *conf) {}
+inline void mbedtls_ssl_session_init(mbedtls_ssl_session *session) { session->valid = 0; }
+inline void mbedtls_ssl_session_free(mbedtls_ssl_session *session) {}
+
+inline int mbedtls_ssl_config_defaults(mbedtls_ssl_config *conf, int endpoint, int transport, int preset) { return 0; }
+inline void mbedtls_ssl_conf_rng(mbedtls_ssl_config *conf, int (*rng)(void *, unsigned char *, size_t), void *ctx) {}
+inline void mbedtls_ssl_conf_authmode(mbedtls_ssl_config *conf, int authmode) { conf->authmode = authmode; }
+inline int mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf) { ssl->conf = conf; return 0; }
+inline int mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname) { return 0; }
+inline void mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *bio, mbedtls_ssl_send_t *send, mbedtls_ssl_recv_t *recv,
+    mbedtls_ssl_recv_timeout_t *recvTimeout) {}
+inline int mbedtls_ssl_set_session(mbedtls_ssl_context *ssl, const mbedtls_ssl_session *session) { return 0; }
+inline int mbedtls_ssl_get_session(const mbedtls_ssl_context *ssl, mbedtls_ssl_session *session) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+inline int mbedtls_ssl_handshake(mbedtls_ssl_context *ssl) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+inline uint32_t mbedtls_ssl_get_verify_result(const mbedtls_ssl_context *ssl) { return UINT32_MAX; }
+inline int mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+inline int mbedtls_ssl_write(mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+inline int mbedtls_ssl_close_notify(mbedtls_ssl_context *ssl) { return 0; }
+inline size_t mbedtls_ssl_get_bytes_avail(const mbedtls_ssl_context *ssl) { return 0; }
+#endif
@@ -0,0 +1,214 @@
+#include <unity.h>
+#include <led-manager.h>
+
+#define BAR_PIN 2
+#define BAR_PIXELS 300
+
+// Drives LedManager the way its render task does, one frame per call
+struct LedManagerProbe {
+    static void draw(LedManager &manager) {
+        manager.drawFrame(false);
+    }
+
+    static uint32_t render(LedManager &manager, int segment, int pattern, uint32_t elapsed) {
+        return manager.render(manager.segments[segment], *manager.patternSpec(pattern), elapsed);
+    }
+
+    static LedStrip &strip(LedManager &manager, int strip) {
+        return manager.strips[strip];
+    }
+};
+
+// A light bar on one output, stopped again so every test gets a fresh RMT channel
+struct Bar {
+    LedManager manager;
+
+    Bar(uint16_t pixels = BAR_PIXELS) {
+        manager.configureStrip(0, BAR_PIN, pixels);
+        manager.configureSegment(0, 0, 0, pixels);
+    }
+
+    ~Bar() {
+        manager.configureStrip(0, -1, 0);
+        manager.configureStrip(1, -1, 0);
+    }
+
+    const uint8_t *wire() {
+        return rmt_native_channel(BAR_PIN)->frame.data();
+    }
+
+    uint32_t frames() {
+        return rmt_native_channel(BAR_PIN)->frames;
+    }
+};
+
+static bool pixel_is(const uint8_t *frame, int index, const uint8_t grb[3]) {
+    return memcmp(frame + index * 3, grb, 3) == 0;
+}
+
+static const uint8_t dark[3] = { 0, 0, 0 };
+
+void setUp() {}
+void tearDown() {}
+
+void test_solid_fills_every_pixel() {
+    Bar bar;
+    bar.manager.setPattern(0, RED_SOLID);
+    LedManagerProbe::draw(bar.manager);
+    TEST_ASSERT_EQUAL(BAR_PIXELS * 3, rmt_native_channel(BAR_PIN)->frame.size());
+    const uint8_t *frame = bar.wire();
+    TEST_ASSERT_EQUAL_UINT8(0, frame[0]);
+    TEST_ASSERT_GREATER_THAN(0, frame[1]);
+    TEST_ASSERT_EQUAL_UINT8(0, frame[2]);
+    for (int i = 1; i < BAR_PIXELS; i++) {
+        TEST_ASSERT_TRUE(pixel_is(frame, i, frame));
+    }
+}
+
+// Word-wide fills start and end anywhere, the pixels either side stay as they were
+void test_fill_edges_are_exact() {
+    Bar bar;
+    LedStrip &strip = LedManagerProbe::strip(bar.manager, 0);
+    for (uint16_t first = 0; first < 9; first++) {
+        for (uint16_t length = 0; length < 13; length++) {
+            strip.fill(LED_BLACK);
+            strip.fill(LED_BLUE, first, length);
+            strip.show();
+            const uint8_t *frame = bar.wire();
+            for (int i = 0; i < 24; i++) {
+                bool lit = i >= first && i < first + length;
+                TEST_ASSERT_EQUAL(lit, frame[i * 3 + 2] != 0);
+            }
+        }
+    }
+}
+
+// Line 1 on LEDs 0-149 and line 2 on 150-299, each drawn from its own pattern
+void test_segments_render_independently() {
+    Bar bar;
+    bar.manager.configureSegment(0, 0, 0, 150);
+    bar.manager.configureSegment(1, 0, 150, 150);
+    bar.manager.setPattern(0, GREEN_SOLID);
+    bar.manager.setPattern(1, BLUE_SOLID);
+    LedManagerProbe::draw(bar.manager);
+    const uint8_t *frame = bar.wire();
+    for (int i = 0; i < BAR_PIXELS; i++) {
+        bool green = i < 150;
+        TEST_ASSERT_EQUAL(green, frame[i * 3] != 0);
+        TEST_ASSERT_EQUAL(!green, frame[i * 3 + 2] != 0);
+    }
+}
+
+// The second lit pixel wraps to the segment start instead of running past the strip end
+void test_chase_wraps_at_the_strip_end() {
+    Bar bar;
+    bar.manager.setPattern(0, RED_CHASE);
+    uint32_t next = LedManagerProbe::render(bar.manager, 0, RED_CHASE, (BAR_PIXELS - 1) * LED_CHASE_STEP + 10);
+    TEST_ASSERT_EQUAL_UINT32(LED_CHASE_STEP - 10, next);
+    LedManagerProbe::strip(bar.manager, 0).show();
+    const uint8_t *frame = bar.wire();
+    for (int i = 0; i < BAR_PIXELS; i++) {
+        bool lit = i == 0 || i == BAR_PIXELS - 1;
+        TEST_ASSERT_EQUAL(lit, !pixel_is(frame, i, dark));
+    }
+}
+
+// A segment longer than its strip stops at the end
+void test_segment_past_the_strip_is_clipped() {
+    Bar bar(100);
+    bar.manager.configureSegment(0, 0, 50, 200);
+    bar.manager.setPattern(0, PURPLE_SOLID);
+    LedManagerProbe::draw(bar.manager);
+    TEST_ASSERT_EQUAL(100 * 3, rmt_native_channel(BAR_PIN)->frame.size());
+    const uint8_t *frame = bar.wire();
+    TEST_ASSERT_TRUE(pixel_is(frame, 49, dark));
+    TEST_ASSERT_FALSE(pixel_is(frame, 50, dark));
+    TEST_ASSERT_FALSE(pixel_is(frame, 99, dark));
+}
+
+// An unchanged frame is not sent again, and one held back by a busy channel goes out once it is free
+void test_frames_only_go_out_when_they_change() {
+    Bar bar;
+    bar.manager.setPattern(0, BLUE_SOLID);
+    LedManagerProbe::draw(bar.manager);
+    uint32_t sent = bar.frames();
+    LedManagerProbe::draw(bar.manager);
+    TEST_ASSERT_EQUAL_UINT32(sent, bar.frames());
+
+    rmt_native_channel(BAR_PIN)->busy = true;
+    bar.manager.setPattern(0, RED_SOLID);
+    LedManagerProbe::draw(bar.manager);
+    TEST_ASSERT_EQUAL_UINT32(sent, bar.frames());
+    TEST_ASSERT_TRUE(LedManagerProbe::strip(bar.manager, 0).isPending());
+
+    rmt_native_channel(BAR_PIN)->busy = false;
+    LedManagerProbe::draw(bar.manager);
+    TEST_ASSERT_EQUAL_UINT32(sent + 1, bar.frames());
+    TEST_ASSERT_FALSE(LedManagerProbe::strip(bar.manager, 0).isPending());
+}
+
+// What every pattern did before: one setPixelColor() per pixel
+static void fill_per_pixel(LedStrip &strip, uint32_t color) {
+    for (uint16_t i = 0; i < strip.numPixels(); i++) {
+        strip.setPixelColor(i, color);
+    }
+}
+
+static double per_frame_ns(std::chrono::steady_clock::time_point start, int frames) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+// Render plus show per frame at 300 pixels, the time advancing a frame each time so every frame differs.
+// Reported rather than asserted, the host is not the ESP32-S3.
+void test_render_benchmark() {
+    Bar bar;
+    bar.manager.setUserPattern(0, "fade ff0000/1000 0000ff/1000");
+    bar.manager.setUserPattern(1, "breathe 00ff00/3000");
+    bar.manager.setUserPattern(2, "comet ffa500/20");
+    struct {
+        const char *name;
+        int pattern;
+    } cases[] = {
+        { "solid", RED_SOLID },
+        { "flash", RED_BLUE_FLASH },
+        { "chase", GREEN_CHASE },
+        { "fade", LED_USER_PATTERN + 0 },
+        { "breathe", LED_USER_PATTERN + 1 },
+        { "comet", LED_USER_PATTERN + 2 },
+    };
+    const int frames = 20000;
+    LedStrip &strip = LedManagerProbe::strip(bar.manager, 0);
+    char line[120];
+    volatile uint32_t sink = 0;
+
+    for (auto &c : cases) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            sink = sink + LedManagerProbe::render(bar.manager, 0, c.pattern, i * 17);
+            strip.show();
+        }
+        snprintf(line, sizeof(line), "%s: %.0f ns per %d pixel frame", c.name, per_frame_ns(start, frames), BAR_PIXELS);
+        TEST_MESSAGE(line);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) strip.fill(i & 1 ? LED_RED : LED_BLUE);
+    double words = per_frame_ns(start, frames);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) fill_per_pixel(strip, i & 1 ? LED_RED : LED_BLUE);
+    double pixels = per_frame_ns(start, frames);
+    snprintf(line, sizeof(line), "fill of %d pixels: %.0f ns word-wide, %.0f ns per pixel (before)", BAR_PIXELS, words, pixels);
+    TEST_MESSAGE(line);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_solid_fills_every_pixel);
+    RUN_TEST(test_fill_edges_are_exact);
+    RUN_TEST(test_segments_render_independently);
+    RUN_TEST(test_chase_wraps_at_the_strip_end);
+    RUN_TEST(test_segment_past_the_strip_is_clipped);
+    RUN_TEST(test_frames_only_go_out_when_they_change);
+    RUN_TEST(test_render_benchmark);
+    return UNITY_END();
+}
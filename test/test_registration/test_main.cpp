@@ -0,0 +1,183 @@
+#include <unity.h>
+#include <sip-schedule.h>
+#include <vector>
+
+// A site of units against one registrar, in virtual milliseconds. Each unit registers at its
+// scheduled time; the registrar either grants SIP_REGISTER_EXPIRES or, while it is down, answers
+// 503 straight away (the quickest a failure can come back, so the most retries it can cause).
+#define SITE_UNITS 500
+
+typedef uint32_t (*RefreshPolicy)(uint32_t granted);
+typedef uint32_t (*RetryPolicy)(uint8_t failures);
+
+struct Site {
+    RefreshPolicy refresh = sip_register_refresh;
+    RetryPolicy retry = sip_register_retry;
+    uint32_t downFrom = 0; // Registrar outage, [downFrom, downUntil) in ms
+    uint32_t downUntil = 0;
+
+    std::vector<uint32_t> perSecond; // REGISTER requests the registrar saw in each second
+    uint32_t lastRegistered[SITE_UNITS] = {};
+    uint32_t backAt[SITE_UNITS] = {}; // First registration once the outage ended
+
+    void run(uint32_t duration) {
+        uint32_t next[SITE_UNITS];
+        uint8_t failures[SITE_UNITS] = {};
+        for (int i = 0; i < SITE_UNITS; i++) next[i] = sip_register_startup();
+        perSecond.assign(duration / 1000 + 1, 0);
+
+        for (;;) {
+            int unit = 0;
+            for (int i = 1; i < SITE_UNITS; i++) {
+                if (next[i] < next[unit]) unit = i;
+            }
+            uint32_t now = next[unit];
+            if (now >= duration) return;
+            perSecond[now / 1000]++;
+            if (now >= downFrom && now < downUntil) {
+                next[unit] = now + retry(failures[unit]);
+                if (failures[unit] < 255) failures[unit]++;
+            } else {
+                failures[unit] = 0;
+                lastRegistered[unit] = now;
+                if (backAt[unit] == 0 && now >= downUntil) backAt[unit] = now;
+                next[unit] = now + refresh(SIP_REGISTER_EXPIRES);
+            }
+        }
+    }
+
+    uint32_t peak(uint32_t from, uint32_t to) const {
+        uint32_t most = 0;
+        for (uint32_t s = from / 1000; s < to / 1000 && s < perSecond.size(); s++) most = max(most, perSecond[s]);
+        return most;
+    }
+
+    uint32_t total(uint32_t from, uint32_t to) const {
+        uint32_t sum = 0;
+        for (uint32_t s = from / 1000; s < to / 1000 && s < perSecond.size(); s++) sum += perSecond[s];
+        return sum;
+    }
+};
+
+// Baselines: the original fixed 10 minute refresh, and a retry every 5 seconds without backoff
+static uint32_t fixed_refresh(uint32_t granted) { return 600000; }
+static uint32_t fixed_retry(uint8_t failures) { return SIP_REGISTER_RETRY_BASE; }
+
+static void report(const char *what, uint32_t value) {
+    char line[120];
+    snprintf(line, sizeof(line), "%s: %lu", what, (unsigned long)value);
+    TEST_MESSAGE(line);
+}
+
+void setUp() {
+    randomSeed(20240611);
+}
+
+void tearDown() {}
+
+void test_refresh_lands_in_the_window() {
+    const uint32_t grants[] = { 60, 300, SIP_REGISTER_EXPIRES, 3600 };
+    for (uint32_t granted : grants) {
+        uint32_t lowest = UINT32_MAX, highest = 0;
+        for (int i = 0; i < 10000; i++) {
+            uint32_t refresh = sip_register_refresh(granted);
+            lowest = min(lowest, refresh);
+            highest = max(highest, refresh);
+        }
+        TEST_ASSERT_EQUAL_UINT32(granted * 10 * SIP_REGISTER_REFRESH_MIN, lowest);
+        TEST_ASSERT_EQUAL_UINT32(granted * 10 * SIP_REGISTER_REFRESH_MAX, highest);
+    }
+}
+
+// Each retry waits between half and all of the capped exponential step, and the cap holds
+void test_retry_backs_off_to_the_cap() {
+    for (int failures = 0; failures < 300; failures++) {
+        uint32_t step = min<uint32_t>(SIP_REGISTER_RETRY_BASE << min(failures, 6), SIP_REGISTER_RETRY_MAX);
+        uint32_t lowest = UINT32_MAX, highest = 0;
+        for (int i = 0; i < 2000; i++) {
+            uint32_t delay = sip_register_retry(min(failures, 255));
+            lowest = min(lowest, delay);
+            highest = max(highest, delay);
+        }
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(step / 2, lowest);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(step, highest);
+        // The jitter really spreads, not just in theory
+        TEST_ASSERT_GREATER_THAN_UINT32(step / 2 + step / 4, highest);
+        TEST_ASSERT_LESS_THAN_UINT32(step / 2 + step / 4, lowest);
+    }
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(SIP_REGISTER_RETRY_MAX, sip_register_retry(255));
+}
+
+void test_startup_spreads_a_site_wide_power_cut() {
+    Site site;
+    site.run(SIP_REGISTER_STARTUP_JITTER);
+    uint32_t peak = site.peak(0, SIP_REGISTER_STARTUP_JITTER);
+    report("boot: peak REGISTERs per second", peak);
+    TEST_ASSERT_EQUAL_UINT32(SITE_UNITS, site.total(0, SIP_REGISTER_STARTUP_JITTER));
+    // 500 units over 15 s average 33 a second, the busiest second stays within twice that
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(2 * SITE_UNITS * 1000 / SIP_REGISTER_STARTUP_JITTER, peak);
+}
+
+// Units that booted together drift apart with every refresh instead of refreshing in lock step
+void test_refreshes_drift_apart_after_boot() {
+    const uint32_t hour = 3600000;
+    Site site;
+    site.run(4 * hour);
+    Site before;
+    before.refresh = fixed_refresh;
+    before.run(4 * hour);
+
+    uint32_t boot = site.peak(0, SIP_REGISTER_STARTUP_JITTER);
+    uint32_t steady = site.peak(3 * hour, 4 * hour);
+    uint32_t lockstep = before.peak(3 * hour, 4 * hour);
+    report("refresh 50-80% of expiry: peak per second in the fourth hour", steady);
+    report("fixed 10 minute refresh (before): peak per second in the fourth hour", lockstep);
+
+    // Every unit stays registered: a refresh at least every 80% of the expiry
+    for (int i = 0; i < SITE_UNITS; i++) {
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(4 * hour - SIP_REGISTER_EXPIRES * 10 * SIP_REGISTER_REFRESH_MAX, site.lastRegistered[i]);
+    }
+    // The same number of requests an hour, no longer bunched into the boot-time seconds
+    TEST_ASSERT_LESS_THAN_UINT32(boot / 3, steady);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(boot / 2, lockstep);
+}
+
+// A registrar down for half an hour sees the site back off to the cap, then all units return
+// within one capped retry of it coming back
+void test_outage_backs_off_and_recovers() {
+    const uint32_t minute = 60000;
+    Site site;
+    site.downFrom = 10 * minute;
+    site.downUntil = 40 * minute;
+    site.run(60 * minute);
+    Site before;
+    before.retry = fixed_retry;
+    before.downFrom = site.downFrom;
+    before.downUntil = site.downUntil;
+    before.run(60 * minute);
+
+    // Past the first few doublings every unit waits 150-300 s between attempts
+    uint32_t settled = site.total(20 * minute, 40 * minute);
+    uint32_t hammered = before.total(20 * minute, 40 * minute);
+    report("backoff: REGISTERs in the last 20 minutes of the outage", settled);
+    report("retry every 5 s without backoff: REGISTERs in the last 20 minutes of the outage", hammered);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(SITE_UNITS * (20 * minute / (SIP_REGISTER_RETRY_MAX / 2) + 1), settled);
+    TEST_ASSERT_LESS_THAN_UINT32(hammered / 10, settled);
+
+    uint32_t back = site.peak(40 * minute, 60 * minute);
+    report("backoff: peak per second after the registrar returns", back);
+    for (int i = 0; i < SITE_UNITS; i++) {
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(site.downUntil, site.backAt[i]);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(site.downUntil + SIP_REGISTER_RETRY_MAX, site.backAt[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_refresh_lands_in_the_window);
+    RUN_TEST(test_retry_backs_off_to_the_cap);
+    RUN_TEST(test_startup_spreads_a_site_wide_power_cut);
+    RUN_TEST(test_refreshes_drift_apart_after_boot);
+    RUN_TEST(test_outage_backs_off_and_recovers);
+    return UNITY_END();
+}
@@ -0,0 +1,195 @@
+#include <unity.h>
+#include <sip-message.h>
+#include <new>
+
+// Every heap allocation in the process, so the benchmark can show the parser makes none
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static const char invite[] =
+    "INVITE sip:1001@10.0.0.20:5060 SIP/2.0\r\n"
+    "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK-proxy2;rport\r\n"
+    "v: SIP/2.0/UDP 10.0.0.2:5060;branch=z9hG4bK-proxy1;received=10.0.0.2\r\n"
+    "Via: SIP/2.0/UDP 10.0.0.3:5060;branch=z9hG4bK-ua, SIP/2.0/UDP 10.0.0.4;branch=z9hG4bK-b2bua\r\n"
+    "Via: SIP/2.0/UDP 10.0.0.5;branch=z9hG4bK-e\r\n"
+    "Via: SIP/2.0/UDP 10.0.0.6;branch=z9hG4bK-f\r\n"
+    "Max-Forwards: 68\r\n"
+    "f: \"Front Desk\" <sip:2000@pbx.example.com>;tag=8f3a21\r\n"
+    "To: <sip:1001@pbx.example.com>\r\n"
+    "i: 5b2e1c7a@10.0.0.3\r\n"
+    "cseq: 102 INVITE\r\n"
+    "m: <sip:2000@10.0.0.3:5060;transport=udp>;expires=60\r\n"
+    "Record-Route: <sip:10.0.0.1;lr>\r\n"
+    "c: application/sdp\r\n"
+    "l: 12\r\n"
+    "\r\n"
+    "v=0\r\no=- 1 1\r\ntrailing";
+
+static const char challenge[] =
+    "SIP/2.0 401 Unauthorized\r\n"
+    "Via: SIP/2.0/UDP 10.0.0.20:5060;branch=z9hG4bK123;rport=5060\r\n"
+    "From: <sip:1001@pbx.example.com>;tag=abc\r\n"
+    "To: <sip:1001@pbx.example.com>;tag=def\r\n"
+    "Call-ID: reg-1@10.0.0.20\r\n"
+    "CSeq: 7 REGISTER\r\n"
+    "WWW-Authenticate: Digest realm=\"pbx\", nonce=\"md5nonce\", algorithm=MD5, qop=\"auth\"\r\n"
+    "WWW-Authenticate: Basic realm=\"pbx\"\r\n"
+    "WWW-Authenticate: Digest realm=\"pbx\",\r\n"
+    "  nonce=\"shanonce\", algorithm=SHA-256, qop=\"auth,auth-int\", opaque=\"xyz\", stale=TRUE\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+static bool view_is(SIPView view, const char *text) {
+    return view.equals(text);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_request_line_and_compact_headers() {
+    SIPMessage message;
+    TEST_ASSERT_TRUE(message.parse(invite, sizeof(invite) - 1));
+    TEST_ASSERT_TRUE(message.isRequest);
+    TEST_ASSERT_TRUE(view_is(message.method, "INVITE"));
+    TEST_ASSERT_TRUE(view_is(message.requestUri, "sip:1001@10.0.0.20:5060"));
+    TEST_ASSERT_TRUE(view_is(message.callId, "5b2e1c7a@10.0.0.3"));
+    TEST_ASSERT_TRUE(view_is(message.fromTag, "8f3a21"));
+    TEST_ASSERT_TRUE(message.toTag.isEmpty());
+    TEST_ASSERT_EQUAL_UINT32(102, message.cseqNumber);
+    TEST_ASSERT_TRUE(view_is(message.cseqMethod, "INVITE"));
+    TEST_ASSERT_TRUE(view_is(message.contentType, "application/sdp"));
+    TEST_ASSERT_EQUAL(12, message.contentLength);
+    TEST_ASSERT_TRUE(view_is(message.body, "v=0\r\no=- 1 1"));
+}
+
+// Responses copy the Via block as one span, so none are lost however many proxies added one
+void test_via_block_spans_every_via() {
+    SIPMessage message;
+    TEST_ASSERT_TRUE(message.parse(invite, sizeof(invite) - 1));
+    TEST_ASSERT_TRUE(view_is(message.viaBranch, "z9hG4bK-proxy2"));
+    const char *first = strstr(invite, "Via:");
+    const char *last = strstr(invite, "branch=z9hG4bK-f") + strlen("branch=z9hG4bK-f");
+    TEST_ASSERT_TRUE(message.viaBlock.data == first);
+    TEST_ASSERT_EQUAL(last - first, message.viaBlock.length);
+}
+
+void test_split_via_block_is_rejected() {
+    const char split[] = "OPTIONS sip:a@b SIP/2.0\r\nVia: SIP/2.0/UDP p1\r\nFrom: <sip:x@y>\r\nVia: SIP/2.0/UDP p2\r\nCall-ID: c\r\n\r\n";
+    SIPMessage message;
+    TEST_ASSERT_FALSE(message.parse(split, sizeof(split) - 1));
+}
+
+void test_header_parameter_found_flag() {
+    const char *text = "<sip:10.0.0.1;lr>;expires=60;flag;q=\"0.5\"";
+    SIPView header(text, strlen(text));
+    SIPView value;
+    TEST_ASSERT_TRUE(SIPMessage::headerParameter(header, "expires", value));
+    TEST_ASSERT_EQUAL(60, value.toInt());
+    // A flag parameter is present with an empty value, unlike one that is missing
+    TEST_ASSERT_TRUE(SIPMessage::headerParameter(header, "flag", value));
+    TEST_ASSERT_TRUE(value.isEmpty());
+    TEST_ASSERT_FALSE(SIPMessage::headerParameter(header, "missing", value));
+    // Parameters inside the URI brackets belong to the URI
+    TEST_ASSERT_FALSE(SIPMessage::headerParameter(header, "lr", value));
+    TEST_ASSERT_TRUE(SIPMessage::headerParameter(header, "q", value));
+    TEST_ASSERT_TRUE(view_is(value, "0.5"));
+}
+
+void test_every_digest_challenge_is_indexed() {
+    SIPMessage message;
+    TEST_ASSERT_TRUE(message.parse(challenge, sizeof(challenge) - 1));
+    TEST_ASSERT_FALSE(message.isRequest);
+    TEST_ASSERT_EQUAL(401, message.statusCode);
+    TEST_ASSERT_EQUAL(2, message.challengeCount);
+    TEST_ASSERT_TRUE(view_is(message.challenges[0].algorithm, "MD5"));
+    TEST_ASSERT_TRUE(view_is(message.challenges[0].nonce, "md5nonce"));
+    TEST_ASSERT_TRUE(view_is(message.challenges[1].algorithm, "SHA-256"));
+    TEST_ASSERT_TRUE(view_is(message.challenges[1].nonce, "shanonce"));
+    TEST_ASSERT_TRUE(view_is(message.challenges[1].qop, "auth,auth-int"));
+    TEST_ASSERT_TRUE(view_is(message.challenges[1].opaque, "xyz"));
+    TEST_ASSERT_TRUE(message.challenges[1].stale);
+}
+
+void test_truncated_and_garbage_input() {
+    SIPMessage message;
+    TEST_ASSERT_FALSE(message.parse(nullptr, 0));
+    TEST_ASSERT_FALSE(message.parse("\r\n\r\n", 4));
+    TEST_ASSERT_FALSE(message.parse("INVITE sip:a@b SIP/2.0\r\nVia: x\r\n", 33));
+    for (size_t length = 0; length < sizeof(invite) - 1; length++) {
+        message.parse(invite, length);
+    }
+}
+
+// The legacy handlers copied the datagram into a String and searched it once per field
+static String extract_parameter(String message, String startDelim, String endDelim) {
+    int start = message.indexOf(startDelim);
+    if (start == -1) return "";
+    start += startDelim.length();
+    int end = message.indexOf(endDelim, start);
+    String result = end == -1 ? message.substring(start) : message.substring(start, end);
+    result.trim();
+    return result;
+}
+
+static uint32_t legacy_parse(const char *data, size_t length) {
+    String message(data, length);
+    String callId = extract_parameter(message, "Call-ID: ", "\r\n");
+    String from = extract_parameter(message, "From: ", "\r\n");
+    String tag = extract_parameter(from, ";tag=", "\r");
+    String cseq = extract_parameter(message, "CSeq: ", "\r\n");
+    String via = extract_parameter(message, "Via: ", "\r\n");
+    String branch = extract_parameter(via, "branch=", ";");
+    return callId.length() + tag.length() + cseq.toInt() + branch.length();
+}
+
+void test_parse_benchmark() {
+    const int rounds = 200000;
+    char line[160];
+    volatile uint32_t sink = 0;
+
+    size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        SIPMessage message;
+        message.parse(invite, sizeof(invite) - 1);
+        sink = sink + message.cseqNumber + message.viaBlock.length;
+    }
+    double parseNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+    double parseAllocations = (double)(allocations - before) / rounds;
+
+    before = allocations;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        sink = sink + legacy_parse(invite, sizeof(invite) - 1);
+    }
+    double legacyNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+    double legacyAllocations = (double)(allocations - before) / rounds;
+
+    snprintf(line, sizeof(line), "header index: %.0f ns and %.1f allocations per INVITE", parseNs, parseAllocations);
+    TEST_MESSAGE(line);
+    snprintf(line, sizeof(line), "String extraction (before): %.0f ns and %.1f allocations per INVITE", legacyNs, legacyAllocations);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE(parseAllocations == 0);
+    TEST_ASSERT_GREATER_THAN(0, legacyAllocations);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_request_line_and_compact_headers);
+    RUN_TEST(test_via_block_spans_every_via);
+    RUN_TEST(test_split_via_block_is_rejected);
+    RUN_TEST(test_header_parameter_found_flag);
+    RUN_TEST(test_every_digest_challenge_is_indexed);
+    RUN_TEST(test_truncated_and_garbage_input);
+    RUN_TEST(test_parse_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,314 @@
+#include <unity.h>
+#include <sip-stream.h>
+
+// A registrar stand-in: a loopback TCP listener the test drives by hand, so every split write,
+// ping and slow read is under its control
+struct Registrar {
+    int listener = -1;
+    int peer = -1;
+    uint16_t port = 0;
+
+    Registrar(int receiveBuffer = 0) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        // Set before listen() so the accepted line advertises a window this small
+        if (receiveBuffer > 0) setsockopt(listener, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listener, (struct sockaddr *)&address, sizeof(address));
+        socklen_t length = sizeof(address);
+        getsockname(listener, (struct sockaddr *)&address, &length);
+        port = ntohs(address.sin_port);
+        listen(listener, 1);
+    }
+
+    ~Registrar() {
+        if (peer >= 0) ::close(peer);
+        if (listener >= 0) ::close(listener);
+    }
+
+    bool accept_line() {
+        peer = accept(listener, nullptr, nullptr);
+        return peer >= 0;
+    }
+
+    void write(const char *text) {
+        TEST_ASSERT_EQUAL((int)strlen(text), ::send(peer, text, strlen(text), 0));
+    }
+
+    // Whatever has arrived within a short wait
+    std::string read(int waitMs = 100) {
+        std::string data;
+        char buffer[4096];
+        fd_set readable;
+        for (;;) {
+            FD_ZERO(&readable);
+            FD_SET(peer, &readable);
+            struct timeval timeout = { 0, waitMs * 1000 };
+            if (select(peer + 1, &readable, NULL, NULL, &timeout) <= 0) return data;
+            int result = recv(peer, buffer, sizeof(buffer), 0);
+            if (result <= 0) return data;
+            data.append(buffer, result);
+            waitMs = 10;
+        }
+    }
+};
+
+static const uint32_t loopback = IPAddress(127, 0, 0, 1);
+
+// Waits in select() on what the stream asks for, the way the SIP task does
+static bool wait_for(SIPStream &stream, int waitMs = 100) {
+    fd_set readable, writable;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    int maxFd = stream.watch(&readable, &writable, -1);
+    if (maxFd < 0) return false;
+    struct timeval timeout = { 0, waitMs * 1000 };
+    return select(maxFd + 1, &readable, &writable, NULL, &timeout) > 0;
+}
+
+static void connect_line(SIPStream &stream, Registrar &registrar) {
+    TEST_ASSERT_TRUE(stream.open(loopback, registrar.port, false, "registrar.test"));
+    TEST_ASSERT_TRUE(stream.is_connecting());
+    for (int i = 0; i < 50 && stream.is_connecting(); i++) {
+        wait_for(stream);
+        TEST_ASSERT_TRUE(stream.progress(millis()));
+    }
+    TEST_ASSERT_TRUE(stream.is_open());
+    TEST_ASSERT_TRUE(registrar.accept_line());
+}
+
+// Receives until a whole message is framed or the registrar has nothing more
+static int next(SIPStream &stream, char *out, size_t capacity) {
+    int length = stream.next_message(out, capacity);
+    for (int i = 0; i < 10 && length == 0 && stream.is_open(); i++) {
+        if (!wait_for(stream, 50)) break;
+        stream.receive();
+        length = stream.next_message(out, capacity);
+    }
+    return length;
+}
+
+static const char ok[] =
+    "SIP/2.0 200 OK\r\n"
+    "Via: SIP/2.0/TCP 127.0.0.1;branch=z9hG4bK1\r\n"
+    "Call-ID: reg@test\r\n"
+    "CSeq: 2 REGISTER\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+static const char invite[] =
+    "INVITE sip:1001@127.0.0.1;transport=tcp SIP/2.0\r\n"
+    "Via: SIP/2.0/TCP 127.0.0.1;branch=z9hG4bK2\r\n"
+    "Call-ID: call@test\r\n"
+    "CSeq: 1 INVITE\r\n"
+    "Content-Type: application/sdp\r\n"
+    "Content-Length: 12\r\n"
+    "\r\n"
+    "v=0\r\no=- 1 1";
+
+void setUp() {}
+void tearDown() {}
+
+void test_connects_without_blocking() {
+    Registrar registrar;
+    SIPStream stream;
+    connect_line(stream, registrar);
+    TEST_ASSERT_TRUE(stream.is_peer(loopback, registrar.port));
+    TEST_ASSERT_FALSE(stream.is_peer(loopback, registrar.port + 1));
+
+    TEST_ASSERT_TRUE(stream.send(ok, sizeof(ok) - 1));
+    TEST_ASSERT_EQUAL_STRING(ok, registrar.read().c_str());
+}
+
+// Messages are framed by Content-Length however the registrar's writes split them
+void test_frames_messages_across_split_writes() {
+    Registrar registrar;
+    SIPStream stream;
+    connect_line(stream, registrar);
+    char out[2048];
+
+    // Cut inside the headers, then inside the body
+    std::string text(invite);
+    registrar.write(text.substr(0, 30).c_str());
+    TEST_ASSERT_EQUAL(0, next(stream, out, sizeof(out)));
+    registrar.write(text.substr(30, text.size() - 35).c_str());
+    TEST_ASSERT_EQUAL(0, next(stream, out, sizeof(out)));
+    registrar.write(text.substr(text.size() - 5).c_str());
+    TEST_ASSERT_EQUAL(sizeof(invite) - 1, next(stream, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_STRING(invite, out);
+
+    // Two in one write come out one at a time
+    registrar.write((std::string(ok) + invite).c_str());
+    TEST_ASSERT_EQUAL(sizeof(ok) - 1, next(stream, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_STRING(ok, out);
+    TEST_ASSERT_EQUAL(sizeof(invite) - 1, next(stream, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_STRING(invite, out);
+}
+
+// A message bigger than the caller's slot is skipped, the one after it still arrives
+void test_oversized_message_is_skipped() {
+    Registrar registrar;
+    SIPStream stream;
+    connect_line(stream, registrar);
+    char out[sizeof(ok) + 8];
+    registrar.write((std::string(invite) + ok).c_str());
+    TEST_ASSERT_EQUAL(sizeof(ok) - 1, next(stream, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_STRING(ok, out);
+}
+
+// RFC 5626: the registrar's double CRLF ping gets a single CRLF pong
+void test_registrar_ping_gets_a_pong() {
+    Registrar registrar;
+    SIPStream stream;
+    connect_line(stream, registrar);
+    char out[2048];
+    registrar.write("\r\n\r\n");
+    TEST_ASSERT_EQUAL(0, next(stream, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_STRING("\r\n", registrar.read().c_str());
+    TEST_ASSERT_TRUE(stream.is_open());
+}
+
+// An idle flow is pinged, an answered ping keeps it, an unanswered one closes it
+void test_keepalive_ping_and_pong() {
+    Registrar registrar;
+    SIPStream stream;
+    connect_line(stream, registrar);
+    char out[2048];
+
+    // Virtual times from here, the flow's last activity was at connect
+    uint32_t start = millis();
+    TEST_ASSERT_TRUE(stream.handle_keepalive(start));
+    TEST_ASSERT_EQUAL_STRING("", registrar.read(20).c_str());
+    uint32_t ping = start + SIP_STREAM_PING_INTERVAL + 1;
+    TEST_ASSERT_TRUE(stream.handle_keepalive(ping));
+    TEST_ASSERT_EQUAL_STRING("\r\n\r\n", registrar.read().c_str());
+    TEST_ASSERT_EQUAL_UINT32(SIP_STREAM_PONG_TIMEOUT, stream.next_timeout(ping, UINT32_MAX));
+
+    // Answered: the flow stays up past the pong deadline, and is pinged again since it is still idle
+    registrar.write("\r\n");
+    TEST_ASSERT_EQUAL(0, next(stream, out, sizeof(out)));
+    uint32_t again = ping + SIP_STREAM_PONG_TIMEOUT;
+    TEST_ASSERT_TRUE(stream.handle_keepalive(again));
+    TEST_ASSERT_TRUE(stream.is_open());
+    TEST_ASSERT_EQUAL_STRING("\r\n\r\n", registrar.read().c_str());
+
+    // Unanswered: closed at the pong deadline
+    TEST_ASSERT_TRUE(stream.handle_keepalive(again + SIP_STREAM_PONG_TIMEOUT - 1));
+    TEST_ASSERT_FALSE(stream.handle_keepalive(again + SIP_STREAM_PONG_TIMEOUT));
+    TEST_ASSERT_FALSE(stream.is_open());
+}
+
+// When the registrar stops reading, sends queue instead of blocking and go out in order once it reads again
+void test_slow_registrar_backlog_drains_in_order() {
+    Registrar registrar(4096);
+    SIPStream stream;
+    connect_line(stream, registrar);
+
+    char message[200];
+    int sent = 0;
+    size_t total = 0;
+    bool backlog = false;
+    while (!backlog && sent < 200000) {
+        int length = snprintf(message, sizeof(message), "OPTIONS sip:%08d SIP/2.0\r\nContent-Length: 0\r\n\r\n", sent);
+        TEST_ASSERT_TRUE(stream.send(message, length));
+        sent++;
+        total += length;
+        fd_set readable, writable;
+        FD_ZERO(&readable);
+        FD_ZERO(&writable);
+        int fd = stream.watch(&readable, &writable, -1);
+        backlog = FD_ISSET(fd, &writable);
+    }
+    TEST_ASSERT_TRUE(backlog);
+
+    std::string received;
+    for (int i = 0; i < 10000 && received.size() < total; i++) {
+        received += registrar.read(1);
+        if (wait_for(stream, 5)) TEST_ASSERT_TRUE(stream.flush());
+    }
+    TEST_ASSERT_TRUE(stream.is_open());
+    TEST_ASSERT_EQUAL(total, received.size());
+
+    size_t at = 0;
+    for (int i = 0; i < sent; i++) {
+        int length = snprintf(message, sizeof(message), "OPTIONS sip:%08d SIP/2.0\r\nContent-Length: 0\r\n\r\n", i);
+        TEST_ASSERT_TRUE(received.compare(at, length, message) == 0);
+        at += length;
+    }
+}
+
+void test_connection_refused_fails_cleanly() {
+    int port;
+    {
+        Registrar gone;
+        port = gone.port;
+    }
+    SIPStream stream;
+    bool started = stream.open(loopback, port, false, "registrar.test");
+    for (int i = 0; i < 50 && stream.is_connecting(); i++) {
+        wait_for(stream);
+        stream.progress(millis());
+    }
+    TEST_ASSERT_FALSE(stream.is_connecting());
+    TEST_ASSERT_FALSE(stream.is_open());
+    TEST_ASSERT_FALSE(stream.progress(millis()) && started);
+    fd_set readable, writable;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    TEST_ASSERT_EQUAL(-1, stream.watch(&readable, &writable, -1));
+}
+
+// A registrar too busy to accept leaves the connect in flight until its deadline
+void test_connect_deadline() {
+    Registrar registrar;
+    // Fill the accept queue, further SYNs are dropped
+    listen(registrar.listener, 0);
+    int waiting[2];
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = loopback;
+    address.sin_port = htons(registrar.port);
+    for (int &fd : waiting) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        connect(fd, (struct sockaddr *)&address, sizeof(address));
+    }
+
+    SIPStream stream;
+    TEST_ASSERT_TRUE(stream.open(loopback, registrar.port, false, "registrar.test"));
+    wait_for(stream);
+    TEST_ASSERT_TRUE(stream.progress(millis()));
+    TEST_ASSERT_TRUE(stream.is_connecting());
+    uint32_t left = stream.next_timeout(millis(), UINT32_MAX);
+    TEST_ASSERT_TRUE(left > 0 && left <= SIP_STREAM_CONNECT_TIMEOUT);
+    TEST_ASSERT_FALSE(stream.progress(millis() + SIP_STREAM_CONNECT_TIMEOUT));
+    TEST_ASSERT_FALSE(stream.is_connecting());
+    for (int fd : waiting) ::close(fd);
+}
+
+void test_peer_close_is_noticed() {
+    Registrar registrar;
+    SIPStream stream;
+    connect_line(stream, registrar);
+    ::close(registrar.peer);
+    registrar.peer = -1;
+    wait_for(stream);
+    TEST_ASSERT_FALSE(stream.receive());
+    TEST_ASSERT_FALSE(stream.is_open());
+    TEST_ASSERT_FALSE(stream.send(ok, sizeof(ok) - 1));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_connects_without_blocking);
+    RUN_TEST(test_frames_messages_across_split_writes);
+    RUN_TEST(test_oversized_message_is_skipped);
+    RUN_TEST(test_registrar_ping_gets_a_pong);
+    RUN_TEST(test_keepalive_ping_and_pong);
+    RUN_TEST(test_slow_registrar_backlog_drains_in_order);
+    RUN_TEST(test_connection_refused_fails_cleanly);
+    RUN_TEST(test_connect_deadline);
+    RUN_TEST(test_peer_close_is_noticed);
+    return UNITY_END();
+}
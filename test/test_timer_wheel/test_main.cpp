@@ -0,0 +1,203 @@
+#include <unity.h>
+#include <timer-wheel.h>
+
+// Virtual clock, the wheel reads it instead of millis() so hours pass in microseconds
+static uint32_t now;
+static unsigned long virtual_clock() { return now; }
+
+struct Probe {
+    uint32_t firedAt = 0;
+    int fired = 0;
+};
+
+static void record(void *arg) {
+    Probe *probe = (Probe *)arg;
+    probe->firedAt = now;
+    probe->fired++;
+}
+
+// Sleeps the way the runtime does, straight to the next deadline, until end or nothing is pending
+static void run_until(TimerWheel &wheel, uint32_t end) {
+    for (int guard = 0; guard < 1000000; guard++) {
+        wheel.advance();
+        uint32_t timeout = wheel.next_timeout();
+        if (timeout == TIMER_NEVER || (int32_t)(end - now) <= 0) return;
+        uint32_t left = end - now;
+        now += timeout == 0 ? 1 : min(timeout, left);
+    }
+    TEST_FAIL_MESSAGE("wheel did not settle");
+}
+
+void setUp() {
+    now = 1000;
+}
+
+void tearDown() {}
+
+void test_fires_on_its_deadline_at_every_level() {
+    TimerWheel wheel;
+    wheel.clock = virtual_clock;
+    const uint32_t delays[] = { 0, 1, 63, 64, 65, 4095, 4096, 100000, 262143, 262144, 3600000 };
+    const int count = sizeof(delays) / sizeof(delays[0]);
+    Probe probes[count];
+    Timer timers[count];
+    for (int i = 0; i < count; i++) {
+        timers[i] = Timer(record, &probes[i]);
+        wheel.schedule(timers[i], delays[i]);
+    }
+    run_until(wheel, 1000 + 3600000 + 10);
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(1, probes[i].fired);
+        TEST_ASSERT_EQUAL_UINT32(1000 + delays[i], probes[i].firedAt);
+    }
+}
+
+void test_cancelled_timer_never_fires() {
+    TimerWheel wheel;
+    wheel.clock = virtual_clock;
+    Probe kept, cancelled;
+    Timer keep(record, &kept);
+    Timer cancel(record, &cancelled);
+    wheel.schedule(keep, 500);
+    wheel.schedule(cancel, 500);
+    wheel.cancel(cancel);
+    TEST_ASSERT_FALSE(cancel.is_pending());
+    run_until(wheel, 2000);
+    TEST_ASSERT_EQUAL(1, kept.fired);
+    TEST_ASSERT_EQUAL(0, cancelled.fired);
+    TEST_ASSERT_EQUAL_UINT32(TIMER_NEVER, wheel.next_timeout());
+}
+
+void test_reschedule_replaces_the_deadline() {
+    TimerWheel wheel;
+    wheel.clock = virtual_clock;
+    Probe probe;
+    Timer timer(record, &probe);
+    wheel.schedule(timer, 100000);
+    wheel.schedule(timer, 250);
+    run_until(wheel, 200000);
+    TEST_ASSERT_EQUAL(1, probe.fired);
+    TEST_ASSERT_EQUAL_UINT32(1250, probe.firedAt);
+}
+
+struct Periodic {
+    TimerWheel *wheel;
+    Timer timer;
+    uint32_t period;
+    uint32_t last = 0;
+    int fired = 0;
+    bool late = false;
+};
+
+static void periodic_tick(void *arg) {
+    Periodic *p = (Periodic *)arg;
+    if (p->fired > 0 && now - p->last != p->period) p->late = true;
+    p->last = now;
+    p->fired++;
+    p->wheel->schedule(p->timer, p->period);
+}
+
+void test_callback_can_reschedule_itself() {
+    TimerWheel wheel;
+    wheel.clock = virtual_clock;
+    Periodic p;
+    p.wheel = &wheel;
+    p.period = 700;
+    p.timer = Timer(periodic_tick, &p);
+    wheel.schedule(p.timer, p.period);
+    run_until(wheel, 1000 + 700 * 100);
+    TEST_ASSERT_EQUAL(100, p.fired);
+    TEST_ASSERT_FALSE(p.late);
+}
+
+// millis() wraps after 49.7 days, deadlines on either side of it must still fire in order and on time
+void test_deadlines_across_the_32_bit_wrap() {
+    now = UINT32_MAX - 5000;
+    TimerWheel wheel;
+    wheel.clock = virtual_clock;
+    const uint32_t delays[] = { 1000, 5000, 5001, 5002, 10000, 70000, 300000 };
+    const int count = sizeof(delays) / sizeof(delays[0]);
+    Probe probes[count];
+    Timer timers[count];
+    uint32_t start = now;
+    for (int i = 0; i < count; i++) {
+        timers[i] = Timer(record, &probes[i]);
+        wheel.schedule(timers[i], delays[i]);
+    }
+    run_until(wheel, start + 400000);
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(1, probes[i].fired);
+        TEST_ASSERT_EQUAL_UINT32(start + delays[i], probes[i].firedAt);
+    }
+}
+
+void test_wrap_with_the_wheel_started_just_before_it() {
+    now = UINT32_MAX;
+    TimerWheel wheel;
+    wheel.clock = virtual_clock;
+    Probe probe;
+    Timer timer(record, &probe);
+    wheel.schedule(timer, 1);
+    TEST_ASSERT_EQUAL_UINT32(1, wheel.next_timeout());
+    run_until(wheel, 100);
+    TEST_ASSERT_EQUAL(1, probe.fired);
+    TEST_ASSERT_EQUAL_UINT32(0, probe.firedAt);
+}
+
+// Past the top level's range a timer parks at its edge and is filed again as it cascades down
+void test_delay_beyond_the_wheel_range() {
+    TimerWheel wheel;
+    wheel.clock = virtual_clock;
+    Probe probe;
+    Timer timer(record, &probe);
+    uint32_t delay = TIMER_WHEEL_RANGE + 12345;
+    wheel.schedule(timer, delay);
+    run_until(wheel, 1000 + delay + 10);
+    TEST_ASSERT_EQUAL(1, probe.fired);
+    TEST_ASSERT_EQUAL_UINT32(1000 + delay, probe.firedAt);
+}
+
+// next_timeout() may wake the caller early but never late, checked against many random deadlines
+void test_next_timeout_is_never_late() {
+    TimerWheel wheel;
+    wheel.clock = virtual_clock;
+    const int count = 300;
+    static Probe probes[count];
+    static Timer timers[count];
+    uint32_t deadlines[count];
+    uint32_t seed = 12345;
+    for (int i = 0; i < count; i++) {
+        probes[i] = Probe();
+        seed = seed * 1103515245 + 12345;
+        uint32_t delay = (seed >> 8) % 2000000;
+        deadlines[i] = now + delay;
+        timers[i] = Timer(record, &probes[i]);
+        wheel.schedule(timers[i], delay);
+    }
+    run_until(wheel, now + 2000010);
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(1, probes[i].fired);
+        TEST_ASSERT_EQUAL_UINT32(deadlines[i], probes[i].firedAt);
+    }
+}
+
+void test_idle_wheel_has_no_timeout() {
+    TimerWheel wheel;
+    wheel.clock = virtual_clock;
+    TEST_ASSERT_EQUAL_UINT32(TIMER_NEVER, wheel.next_timeout());
+    TEST_ASSERT_EQUAL(0, wheel.advance());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_fires_on_its_deadline_at_every_level);
+    RUN_TEST(test_cancelled_timer_never_fires);
+    RUN_TEST(test_reschedule_replaces_the_deadline);
+    RUN_TEST(test_callback_can_reschedule_itself);
+    RUN_TEST(test_deadlines_across_the_32_bit_wrap);
+    RUN_TEST(test_wrap_with_the_wheel_started_just_before_it);
+    RUN_TEST(test_delay_beyond_the_wheel_range);
+    RUN_TEST(test_next_timeout_is_never_late);
+    RUN_TEST(test_idle_wheel_has_no_timeout);
+    return UNITY_END();
+}
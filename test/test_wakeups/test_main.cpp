@@ -0,0 +1,166 @@
+#include <unity.h>
+#include <timer-wheel.h>
+#include <sip-schedule.h>
+#include <idle-waits.h>
+#include <led-pattern.h>
+
+// An idle hour on a virtual clock: one registered UDP line, a solid LED pattern, no calls and no web
+// clients. Each task blocks until its own deadline or idle cap, the chip light sleeps while they all
+// do, so every distinct millisecond in which some task's wait ends is one wakeup.
+
+#define LOG_DRAIN_POLL_MS 20 // The log task's poll before it was woken by log(), gone from the firmware
+
+#define HOUR 3600000u
+
+static uint32_t now;
+static unsigned long virtual_clock() { return now; }
+
+enum Task { TASK_LOOP, TASK_SIP, TASK_LED, TASK_LOG, TASKS };
+// The tasks start at different points in boot, so their once-a-second caps are out of phase
+static const uint32_t taskStart[TASKS] = { 0, 337, 611, 0 };
+
+struct Hour {
+    bool frameHook = true;  // Web traffic notifies the loop, otherwise it polls
+    bool drainPolls = false;
+
+    uint32_t wakeups = 0;
+    uint32_t byTask[TASKS] = {};
+    uint32_t lldpSent = 0;
+    uint32_t keepalives = 0;
+    uint32_t registrations = 0;
+
+    TimerWheel *timers = nullptr;
+    Timer lldp;
+};
+
+// LLDPService's send timer, which re-arms itself
+static void lldp_send(void *arg) {
+    Hour *hour = (Hour *)arg;
+    hour->lldpSent++;
+    hour->timers->schedule(hour->lldp, LLDP_INTERVAL);
+}
+
+static void run_hour(Hour &hour) {
+    now = 0;
+    TimerWheel timers;
+    timers.clock = virtual_clock;
+    hour.timers = &timers;
+    hour.lldp = Timer(lldp_send, &hour);
+    timers.schedule(hour.lldp, 0);
+
+    uint32_t nextKeepaliveAt = SIP_KEEPALIVE_MAX_INTERVAL;
+    uint32_t nextRegisterAt = sip_register_refresh(SIP_REGISTER_EXPIRES);
+    uint32_t wakeAt[TASKS];
+    for (int task = 0; task < TASKS; task++) wakeAt[task] = taskStart[task];
+    uint32_t lastWake = UINT32_MAX;
+
+    while (now < HOUR) {
+        // Run every task whose wait ends now, then block each one again
+        for (int task = 0; task < TASKS; task++) {
+            if (wakeAt[task] != now) continue;
+            hour.byTask[task]++;
+            if (lastWake != now) {
+                hour.wakeups++;
+                lastWake = now;
+            }
+            uint32_t wait = UINT32_MAX;
+            switch (task) {
+                case TASK_LOOP: {
+                    // Runtime::handle() and wait_for_work()
+                    timers.advance();
+                    uint32_t limit = hour.frameHook ? LOOP_IDLE_MAX_MS : LOOP_WEB_POLL_MS;
+                    wait = min(timers.next_timeout(), limit);
+                    break;
+                }
+                case TASK_SIP: {
+                    // SIPClient::handle() then the select() timeout from next_timeout()
+                    if ((int32_t)(now - nextKeepaliveAt) >= 0) {
+                        hour.keepalives++;
+                        nextKeepaliveAt = now + SIP_KEEPALIVE_MAX_INTERVAL;
+                    }
+                    if ((int32_t)(now - nextRegisterAt) >= 0) {
+                        hour.registrations++;
+                        nextRegisterAt = now + sip_register_refresh(SIP_REGISTER_EXPIRES);
+                    }
+                    wait = timer_until(now, nextKeepaliveAt, SIP_TASK_TIMEOUT_MS);
+                    wait = timer_until(now, nextRegisterAt, wait);
+                    break;
+                }
+                case TASK_LED:
+                    // A solid pattern is redrawn once per LED_SOLID_REFRESH
+                    wait = LED_SOLID_REFRESH;
+                    break;
+                case TASK_LOG:
+                    // Nothing is logged while idle, a notified drain never wakes
+                    wait = hour.drainPolls ? LOG_DRAIN_POLL_MS : UINT32_MAX;
+                    break;
+            }
+            // A wait rounds up to whole ticks, never to zero
+            wakeAt[task] = wait == UINT32_MAX ? UINT32_MAX : now + max<uint32_t>(wait, 1);
+        }
+
+        uint32_t next = UINT32_MAX;
+        for (int task = 0; task < TASKS; task++) next = min(next, wakeAt[task]);
+        if (next == UINT32_MAX) break;
+        now = next;
+    }
+}
+
+static void report(const char *what, const Hour &hour) {
+    char line[160];
+    snprintf(line, sizeof(line), "%s: %lu wakeups/hour (loop %lu, sip %lu, led %lu, log %lu)", what, (unsigned long)hour.wakeups,
+        (unsigned long)hour.byTask[TASK_LOOP], (unsigned long)hour.byTask[TASK_SIP], (unsigned long)hour.byTask[TASK_LED],
+        (unsigned long)hour.byTask[TASK_LOG]);
+    TEST_MESSAGE(line);
+}
+
+void setUp() {
+    randomSeed(7);
+}
+
+void tearDown() {}
+
+// The deadline-driven work still happens on time while the chip sleeps in between
+void test_idle_hour_keeps_its_deadlines() {
+    Hour hour;
+    run_hour(hour);
+    TEST_ASSERT_EQUAL_UINT32(HOUR / LLDP_INTERVAL, hour.lldpSent);
+    TEST_ASSERT_EQUAL_UINT32(HOUR / SIP_KEEPALIVE_MAX_INTERVAL - 1, hour.keepalives);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(HOUR / (SIP_REGISTER_EXPIRES * 10 * SIP_REGISTER_REFRESH_MAX), hour.registrations);
+    // The log task only ran when it started
+    TEST_ASSERT_EQUAL_UINT32(1, hour.byTask[TASK_LOG]);
+}
+
+// Each task wakes about once a second at most, so an idle hour is a few thousand wakeups, where
+// polling the web server and the log ring woke the chip every 10 ms
+void test_idle_wakeups_per_hour() {
+    Hour sleeping;
+    run_hour(sleeping);
+    Hour polling;
+    polling.frameHook = false;
+    polling.drainPolls = true;
+    run_hour(polling);
+
+    report("woken by deadlines and interrupts", sleeping);
+    report("polling web and log (before)", polling);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(3 * HOUR / 1000 + 10, sleeping.wakeups);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(HOUR / LOOP_WEB_POLL_MS, polling.wakeups);
+    TEST_ASSERT_LESS_THAN_UINT32(polling.wakeups / 30, sleeping.wakeups);
+}
+
+// Without the LLDP frame hook nothing tells the loop about web clients and it has to poll
+void test_missing_frame_hook_polls() {
+    Hour hour;
+    hour.frameHook = false;
+    run_hour(hour);
+    report("no frame hook", hour);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(HOUR / LOOP_WEB_POLL_MS, hour.byTask[TASK_LOOP]);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_idle_hour_keeps_its_deadlines);
+    RUN_TEST(test_idle_wakeups_per_hour);
+    RUN_TEST(test_missing_frame_hook_polls);
+    return UNITY_END();
+}